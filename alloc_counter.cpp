@@ -0,0 +1,38 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "alloc_counter.hpp"
+
+static std::atomic<uint64_t> allocations { 0 };
+
+
+uint64_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+
+// Replacing these is enough: the array and nothrow forms call them by default
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t /* size */) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations made through operator new in the whole process.
+// Used to check that the frame loop does not allocate once it is warm.
+// Allocations made by a library with its own allocator (e.g. wgpu-native, GLFW) are not seen.
+uint64_t allocationCount();
@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
-#include <map>
 #include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <optional>
 #include <thread>
 
 #include <GLFW/glfw3.h>
@@ -11,6 +15,31 @@
 #include <webgpu/webgpu.hpp>
 #include <glfw3webgpu.h>
 
+#include "gpu_future.hpp"
+#include "blob_cache.hpp"
+#include "deferred_release.hpp"
+#include "enum_names.hpp"
+#include "alloc_counter.hpp"
+#include "attachment_pool.hpp"
+#include "bind_group_cache.hpp"
+#include "compute_selftest.hpp"
+#include "frame_capture.hpp"
+#include "frames_in_flight.hpp"
+#include "golden_test.hpp"
+#include "gpu_driven_scene.hpp"
+#include "gpu_handle.hpp"
+#include "gpu_profiler.hpp"
+#include "grid_scene.hpp"
+#include "options.hpp"
+#include "parallel_encoder.hpp"
+#include "pipeline_cache.hpp"
+#include "render_graph.hpp"
+#include "render_target.hpp"
+#include "sliding_stats.hpp"
+#include "staging_belt.hpp"
+#include "startup_profiler.hpp"
+#include "uniform_ring.hpp"
+
 struct TerminatorGLFW
 {
     ~TerminatorGLFW()
@@ -20,75 +49,121 @@ struct TerminatorGLFW
 };
 
 
-wgpu::Adapter requestAdapter(wgpu::Instance instance, const wgpu::RequestAdapterOptions& options)
+// Window callbacks only record what happened, the frame loop reacts to it
+struct WindowEvents
 {
-    struct UserData
-    {
-        wgpu::Adapter adapter = nullptr;
-        bool requestEnded = false;
-    };
-    UserData userData;
+    bool cyclePresentMode = false;
+    bool captureFrame = false;
+
+    // Latest framebuffer size, applied after it stays the same for resizeDebounce
+    bool resizePending = false;
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    std::chrono::steady_clock::time_point lastResize;
+};
 
-    //TODO: promise & future for wait
-    instance.requestAdapter(options, [&userData](wgpu::RequestAdapterStatus status, wgpu::Adapter adapter, char const * message) -> void
-    {
-        if (status == wgpu::RequestAdapterStatus::Success)
-        {
-            userData.adapter = adapter;
-        } else
-        {
-            std::cout << "Could not get WebGPU adapter: " << message << std::endl;
-        }
-        userData.requestEnded = true;
-    });
 
-    // In theory we should wait until onAdapterReady has been called, which
-    // could take some time (what the 'await' keyword does in the JavaScript
-    // code). In practice, we know that when the wgpuInstanceRequestAdapter()
-    // function returns its callback has been called.
-    if(!userData.requestEnded)
-    {
-        throw std::runtime_error("Failed to get an adapter");
-    }
+// What the passes of the frame graph need, they capture a single reference to it
+struct FrameContext
+{
+    // One of them is set
+    GridScene* scene = nullptr;
+    GpuDrivenScene* gpuScene = nullptr;
+    GpuProfiler* profiler = nullptr;
+    UniformRing* uniforms = nullptr;
+    StagingBelt* stagingBelt = nullptr;
+    uint32_t slot = 0;
+    // CPU time of encoding the scene's draws, to compare with and without render bundles
+    SlidingStats encodeMs;
+};
 
-    return userData.adapter;
-}
 
+static constexpr EnumName<WGPUFeatureName> featureNames[] =
+{
+    {wgpu::FeatureName::Undefined,                     "Undefined"},
+    {wgpu::FeatureName::DepthClipControl,              "DepthClipControl"},
+    {wgpu::FeatureName::Depth32FloatStencil8,          "Depth32FloatStencil8"},
+    {wgpu::FeatureName::TimestampQuery,                "TimestampQuery"},
+    {wgpu::FeatureName::PipelineStatisticsQuery,       "PipelineStatisticsQuery"},
+    {wgpu::FeatureName::TextureCompressionBC,          "TextureCompressionBC"},
+    {wgpu::FeatureName::TextureCompressionETC2,        "TextureCompressionETC2"},
+    {wgpu::FeatureName::TextureCompressionASTC,        "TextureCompressionASTC"},
+    {wgpu::FeatureName::IndirectFirstInstance,         "IndirectFirstInstance"},
+    {wgpu::FeatureName::ShaderF16,                     "ShaderF16"},
+    {wgpu::FeatureName::RG11B10UfloatRenderable,       "RG11B10UfloatRenderable"},
+    {wgpu::FeatureName::BGRA8UnormStorage,             "BGRA8UnormStorage"},
+    {wgpu::FeatureName::Float32Filterable,             "Float32Filterable"},
+
+#ifdef WEBGPU_BACKEND_DAWN
+    {wgpu::FeatureName::DawnShaderFloat16,             "DawnShaderFloat16"},
+    {wgpu::FeatureName::DawnInternalUsages,            "DawnInternalUsages"},
+    {wgpu::FeatureName::DawnMultiPlanarFormats,        "DawnMultiPlanarFormats"},
+    {wgpu::FeatureName::DawnNative,                    "DawnNative"},
+    {wgpu::FeatureName::ChromiumExperimentalDp4a,      "ChromiumExperimentalDp4a"},
+    {wgpu::FeatureName::TimestampQueryInsidePasses,    "TimestampQueryInsidePasses"},
+    {wgpu::FeatureName::ImplicitDeviceSynchronization, "ImplicitDeviceSynchronization"},
+    {wgpu::FeatureName::SurfaceCapabilities,           "SurfaceCapabilities"},
+    {wgpu::FeatureName::TransientAttachments,          "TransientAttachments"},
+    {wgpu::FeatureName::MSAARenderToSingleSampled,     "MSAARenderToSingleSampled"},
+#endif
+
+    {wgpu::FeatureName::Force32, "Force32"},
+};
 
-wgpu::Device requestDevice(wgpu::Adapter adapter, const wgpu::DeviceDescriptor& descriptor)
+static constexpr EnumName<WGPUDeviceLostReason> deviceLostReasonNames[] =
 {
-    struct UserData
-    {
-        wgpu::Device device = nullptr;
-        bool requestEnded = false;
-    };
-    UserData userData;
+    {wgpu::DeviceLostReason::Undefined, "Undefined"},
+    {wgpu::DeviceLostReason::Destroyed, "Destroyed"},
 
-    //TODO: promise&future for wait
-    adapter.requestDevice(descriptor, [&userData](wgpu::RequestDeviceStatus status, wgpu::Device device, char const * message) -> void
-    {
-        if (status == wgpu::RequestDeviceStatus::Success)
-        {
-            userData.device = device;
-        }
-        else
-        {
-            std::cout << "Could not get WebGPU device: " << message << std::endl;
-        }
-        userData.requestEnded = true;
-    });
+    {wgpu::DeviceLostReason::Force32,   "Force32"}
+};
+
+#ifdef WEBGPU_BACKEND_DAWN
+static constexpr EnumName<WGPULoggingType> loggingTypeNames[] =
+{
+    {wgpu::LoggingType::Verbose, "Verbose"},
+    {wgpu::LoggingType::Info,    "Info"},
+    {wgpu::LoggingType::Warning, "Warning"},
+    {wgpu::LoggingType::Error,   "Error"},
+
+    {wgpu::LoggingType::Force32, "Force32"}
+};
+#endif
 
-    if(!userData.requestEnded)
-    {
-        throw std::runtime_error("Failed to open a device");
-    }
 
-    return userData.device;
-}
+// Adapter and device requests are waited for not longer than that
+constexpr std::chrono::milliseconds requestTimeout(5000);
+// A drag-resize sends an event per mouse move, the swap chain is recreated only when it settles
+constexpr std::chrono::milliseconds resizeDebounce(100);
+// A frame that takes longer than that on the GPU means something is stuck
+constexpr std::chrono::milliseconds frameTimeout(5000);
+// Frames allowed to allocate while pools, rings and stats fill up, see --check-allocations
+constexpr uint32_t allocationWarmupFrames = 16;
 
 
-int main (int /* argc */, char** /* argv */)
+int main (int argc, char** argv)
 {
+    // Goes first so that the report covers everything
+    StartupProfiler profiler;
+
+    AppOptions options;
+    try
+    {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (options.showHelp)
+    {
+        printUsage(argv[0]);
+        return 0;
+    }
+
 #ifdef WEBGPU_BACKEND_DAWN
     const std::string backendName = "Dawn";
 #elif defined(WEBGPU_BACKEND_WGPU)
@@ -96,9 +171,15 @@ int main (int /* argc */, char** /* argv */)
 #endif
 
     std::cout << "Running with " << backendName << " backend" << std::endl;
+    profiler.setInfo("backend", backendName);
 
     wgpu::InstanceDescriptor desc;
-    wgpu::Instance instance = wgpu::createInstance(desc);
+    // Owned handles are released in reverse order of creation when main() returns
+    Owned<wgpu::Instance> instance;
+    {
+        ScopedPhase phase(profiler, "instance creation");
+        instance.reset(wgpu::createInstance(desc));
+    }
     if (!instance)
     {
         std::cerr << "Could not initialize WebGPU!" << std::endl;
@@ -106,31 +187,91 @@ int main (int /* argc */, char** /* argv */)
     }
 
     // WGPUInstance is a simple pointer, it may be copied around without worrying about its size
-    std::cout << "WGPU instance: " << instance << std::endl;
+    std::cout << "WGPU instance: " << instance.get() << std::endl;
 
-    if (!glfwInit())
+    // The adapter is requested before the window is created so that both can progress at the same time
+    wgpu::RequestAdapterOptions adapterOpts;
+    adapterOpts.setDefault();
+    adapterOpts.forceFallbackAdapter = options.fallbackAdapter;
+    size_t adapterPhase = profiler.begin("adapter request");
+    GpuFuture<wgpu::Adapter> adapterFuture = requestAdapterAsync(instance, adapterOpts);
+
+    // Headless mode needs no display server at all
+    std::optional<TerminatorGLFW> terminatorGlfw;
+    GLFWwindow* window = nullptr;
+    Owned<wgpu::Surface> surface;
+    if (!options.headless)
     {
-        std::cerr << "Could not initialize GLFW!" << std::endl;
-        return 1;
-    }
+        size_t glfwPhase = profiler.begin("glfwInit");
+        if (!glfwInit())
+        {
+            std::cerr << "Could not initialize GLFW!" << std::endl;
+            return 1;
+        }
+        profiler.end(glfwPhase);
 
-    TerminatorGLFW terminatorGlfw;
+        terminatorGlfw.emplace();
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    GLFWwindow* window = glfwCreateWindow(640, 480, "WebGPU C++ Demo", NULL, NULL);
+        size_t windowPhase = profiler.begin("window creation");
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+        window = glfwCreateWindow(options.width, options.height, "WebGPU C++ Demo", NULL, NULL);
+        profiler.end(windowPhase);
 
-    if (!window)
-    {
-        std::cerr << "Could not open window!" << std::endl;
-        return 1;
+        if (!window)
+        {
+            std::cerr << "Could not open window!" << std::endl;
+            return 1;
+        }
+
+        ScopedPhase phase(profiler, "surface creation");
+        surface.reset(glfwGetWGPUSurface(instance.get(), window));
     }
 
-    wgpu::Surface surface = glfwGetWGPUSurface(instance, window);
+    WindowEvents windowEvents;
+    if (window)
+    {
+        // Framebuffer size may differ from the window size on high-DPI displays
+        glfwGetFramebufferSize(window, &windowEvents.framebufferWidth, &windowEvents.framebufferHeight);
 
-    wgpu::RequestAdapterOptions adapterOpts;
-    adapterOpts.setDefault();
-    wgpu::Adapter adapter = requestAdapter(instance, adapterOpts);
+        glfwSetWindowUserPointer(window, &windowEvents);
+        glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int width, int height)
+        {
+            WindowEvents& events = *reinterpret_cast<WindowEvents*>(glfwGetWindowUserPointer(w));
+            events.framebufferWidth = width;
+            events.framebufferHeight = height;
+            events.resizePending = true;
+            events.lastResize = std::chrono::steady_clock::now();
+        });
+        glfwSetKeyCallback(window, [](GLFWwindow* w, int key, int /* scancode */, int action, int /* mods */)
+        {
+            WindowEvents& events = *reinterpret_cast<WindowEvents*>(glfwGetWindowUserPointer(w));
+            if (key == GLFW_KEY_P && action == GLFW_PRESS)
+            {
+                events.cyclePresentMode = true;
+            }
+            if (key == GLFW_KEY_C && action == GLFW_PRESS)
+            {
+                events.captureFrame = true;
+            }
+        });
+    }
+
+    Owned<wgpu::Adapter> adapter;
+    {
+        // How long we were actually blocked by the adapter request
+        ScopedPhase phase(profiler, "adapter wait");
+        try
+        {
+            adapter.reset(adapterFuture.get(requestTimeout));
+        }
+        catch (const std::exception& e)
+        {
+            // A timed out request is reported like a failed one below
+            std::cerr << e.what() << std::endl;
+        }
+    }
+    profiler.end(adapterPhase);
 
     if (!adapter)
     {
@@ -138,88 +279,96 @@ int main (int /* argc */, char** /* argv */)
         return 1;
     }
 
-    std::cout << "WGPU adapter: " << adapter << std::endl;
+    std::cout << "WGPU adapter: " << adapter.get() << std::endl;
 
-    const std::map<wgpu::FeatureName, std::string> featuresNames =
     {
-        {wgpu::FeatureName::Undefined,                     "Undefined"},
-        {wgpu::FeatureName::DepthClipControl,              "DepthClipControl"},
-        {wgpu::FeatureName::Depth32FloatStencil8,          "Depth32FloatStencil8"},
-        {wgpu::FeatureName::TimestampQuery,                "TimestampQuery"},
-        {wgpu::FeatureName::PipelineStatisticsQuery,       "PipelineStatisticsQuery"},
-        {wgpu::FeatureName::TextureCompressionBC,          "TextureCompressionBC"},
-        {wgpu::FeatureName::TextureCompressionETC2,        "TextureCompressionETC2"},
-        {wgpu::FeatureName::TextureCompressionASTC,        "TextureCompressionASTC"},
-        {wgpu::FeatureName::IndirectFirstInstance,         "IndirectFirstInstance"},
-        {wgpu::FeatureName::ShaderF16,                     "ShaderF16"},
-        {wgpu::FeatureName::RG11B10UfloatRenderable,       "RG11B10UfloatRenderable"},
-        {wgpu::FeatureName::BGRA8UnormStorage,             "BGRA8UnormStorage"},
-        {wgpu::FeatureName::Float32Filterable,             "Float32Filterable"},
+        wgpu::AdapterProperties adapterProps;
+        adapter->getProperties(&adapterProps);
+        profiler.setInfo("adapter", adapterProps.name ? adapterProps.name : "");
+        profiler.setInfo("driver", adapterProps.driverDescription ? adapterProps.driverDescription : "");
+        profiler.setInfo("vendor_id", std::to_string(adapterProps.vendorID));
+        profiler.setInfo("device_id", std::to_string(adapterProps.deviceID));
+    }
 
-#ifdef WEBGPU_BACKEND_DAWN
-        {wgpu::FeatureName::DawnShaderFloat16,             "DawnShaderFloat16"},
-        {wgpu::FeatureName::DawnInternalUsages,            "DawnInternalUsages"},
-        {wgpu::FeatureName::DawnMultiPlanarFormats,        "DawnMultiPlanarFormats"},
-        {wgpu::FeatureName::DawnNative,                    "DawnNative"},
-        {wgpu::FeatureName::ChromiumExperimentalDp4a,      "ChromiumExperimentalDp4a"},
-        {wgpu::FeatureName::TimestampQueryInsidePasses,    "TimestampQueryInsidePasses"},
-        {wgpu::FeatureName::ImplicitDeviceSynchronization, "ImplicitDeviceSynchronization"},
-        {wgpu::FeatureName::SurfaceCapabilities,           "SurfaceCapabilities"},
-        {wgpu::FeatureName::TransientAttachments,          "TransientAttachments"},
-        {wgpu::FeatureName::MSAARenderToSingleSampled,     "MSAARenderToSingleSampled"},
-#endif
+    size_t featuresPhase = profiler.begin("feature enumeration");
 
-        {wgpu::FeatureName::Force32, "Force32"},
-    };
 
     std::vector<wgpu::FeatureName> features;
     // First call for a size, second call for actual features list
-    size_t featureCount = adapter.enumerateFeatures(nullptr);
+    size_t featureCount = adapter->enumerateFeatures(nullptr);
     features.resize(featureCount, wgpu::FeatureName::Undefined);
-    adapter.enumerateFeatures(features.data());
+    adapter->enumerateFeatures(features.data());
 
     std::cout << "Adapter features:" << std::endl;
     for (const auto& f : features)
     {
-        std::string fs;
-        if (featuresNames.count(f))
-            fs = featuresNames.at(f);
-        else
-            fs = std::to_string(f);
-
-        std::cout << " - " << fs << std::endl;
+        std::cout << " - ";
+        writeEnumName(std::cout, featureNames, f);
+        std::cout << std::endl;
     }
 
+    profiler.end(featuresPhase);
+
+    size_t cachePhase = profiler.begin("blob cache open");
+    // Compiled shaders and pipelines are only valid for the same adapter, driver and implementation
+    const std::string adapterKey = makeAdapterCacheKey(adapter);
+    BlobCache blobCache(defaultCacheRoot(), adapterKey, defaultCacheMaxBytes());
+    std::cout << "Blob cache: " << blobCache.directory() << std::endl;
+    profiler.setInfo("blob_cache", blobCache.directory().string());
+    profiler.end(cachePhase);
+
     wgpu::DeviceDescriptor deviceDesc;
     deviceDesc.setDefault();
 
     deviceDesc.label = "My Device"; // anything works here, that's your call
-    deviceDesc.requiredFeaturesCount = 0; // we do not require any specific feature
+
+    // Optional features are requested only when the adapter has them, the code checks the device later
+    std::vector<WGPUFeatureName> requiredFeatures;
+    auto adapterHas = [&features](wgpu::FeatureName f)
+    {
+        return std::find(features.begin(), features.end(), f) != features.end();
+    };
+    if (options.gpuProfiler && adapterHas(wgpu::FeatureName::TimestampQuery))
+    {
+        requiredFeatures.push_back(wgpu::FeatureName::TimestampQuery);
+    }
+#ifdef WEBGPU_BACKEND_DAWN
+    // Dawn devices are not thread-safe unless asked to be
+    if (options.encoderThreads > 0 && adapterHas(wgpu::FeatureName::ImplicitDeviceSynchronization))
+    {
+        requiredFeatures.push_back(wgpu::FeatureName::ImplicitDeviceSynchronization);
+    }
+    // Lets the attachment pool keep transient attachments in tile memory
+    if (adapterHas(wgpu::FeatureName::TransientAttachments))
+    {
+        requiredFeatures.push_back(wgpu::FeatureName::TransientAttachments);
+    }
+#endif
+    deviceDesc.requiredFeaturesCount = requiredFeatures.size();
+    deviceDesc.requiredFeatures = requiredFeatures.data();
     deviceDesc.requiredLimits = nullptr; // we do not require any specific limit
+    // The compute test sorts up to 64M keys in 256 MiB buffers, over the default 128 MiB storage binding
+    // size: it asks for as much as the adapter supports, larger sizes are skipped if that is not enough
+    wgpu::RequiredLimits requiredLimits;
+    requiredLimits.setDefault();
+    wgpu::SupportedLimits adapterLimits;
+    if (options.computeTest && adapter->getLimits(&adapterLimits))
+    {
+        requiredLimits.limits.maxStorageBufferBindingSize = adapterLimits.limits.maxStorageBufferBindingSize;
+        requiredLimits.limits.maxBufferSize = adapterLimits.limits.maxBufferSize;
+        deviceDesc.requiredLimits = &requiredLimits;
+    }
     deviceDesc.defaultQueue.nextInChain = nullptr;
     deviceDesc.defaultQueue.label = "The default queue";
 
+#ifdef WEBGPU_BACKEND_DAWN
+    blobCache.attachTo(deviceDesc);
+#endif
+
     auto onDeviceLost = [](wgpu::DeviceLostReason reason, char const * message)
     {
-        std::map<wgpu::DeviceLostReason, std::string> reasonNames =
-        {
-            {wgpu::DeviceLostReason::Undefined, "Undefined"},
-            {wgpu::DeviceLostReason::Destroyed, "Destroyed"},
-
-            {wgpu::DeviceLostReason::Force32,   "Force32"}
-        };
-
-        std::string rs;
-        if (reasonNames.count(reason))
-        {
-            rs = reasonNames.at(reason);
-        }
-        else
-        {
-            rs = std::to_string(reason);
-        }
-
-        std::cout << "Device is lost: reason " << rs;
+        std::cout << "Device is lost: reason ";
+        writeEnumName(std::cout, deviceLostReasonNames, reason);
         if (message)
         {
             std::cout << " (" << message << ")";
@@ -238,11 +387,28 @@ int main (int /* argc */, char** /* argv */)
     deviceDesc.deviceLostUserdata = reinterpret_cast<void*>(deviceLostHandle.get());
 #endif
 
-    wgpu::Device device = requestDevice(adapter, deviceDesc);
+    Owned<wgpu::Device> device;
+    {
+        ScopedPhase phase(profiler, "device request");
+        try
+        {
+            device.reset(requestDeviceAsync(instance, adapter, deviceDesc).get(requestTimeout));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    if (!device)
+    {
+        std::cerr << "Could not request a device!" << std::endl;
+        return 1;
+    }
 
-    std::cout << "Got device: " << device << std::endl;
+    std::cout << "Got device: " << device.get() << std::endl;
 
-    device.setUncapturedErrorCallback([](wgpu::ErrorType type, char const* message)
+    device->setUncapturedErrorCallback([](wgpu::ErrorType type, char const* message)
     {
         std::cout << "Uncaptured device error: type " << type;
         if (message)
@@ -253,30 +419,12 @@ int main (int /* argc */, char** /* argv */)
     });
 
 #ifdef WEBGPU_BACKEND_DAWN
-    device.setDeviceLostCallback(onDeviceLost);
+    device->setDeviceLostCallback(onDeviceLost);
 
-    device.setLoggingCallback([](wgpu::LoggingType type, char const *message)
+    device->setLoggingCallback([](wgpu::LoggingType type, char const *message)
     {
-        const std::map<wgpu::LoggingType, std::string> logTypeNames =
-        {
-            {wgpu::LoggingType::Verbose, "Verbose"},
-            {wgpu::LoggingType::Info,    "Info"},
-            {wgpu::LoggingType::Warning, "Warning"},
-            {wgpu::LoggingType::Error,   "Error"},
-
-            {wgpu::LoggingType::Force32, "Force32"}
-        };
-        std::string mt;
-        if (logTypeNames.count(type))
-        {
-            mt = logTypeNames.at(type);
-        }
-        else
-        {
-            mt = std::to_string(type);
-        }
-
-        std::cout << "Device log: type " << mt;
+        std::cout << "Device log: type ";
+        writeEnumName(std::cout, loggingTypeNames, type);
 
         if (message)
         {
@@ -289,144 +437,595 @@ int main (int /* argc */, char** /* argv */)
 
     std::vector<wgpu::FeatureName> deviceFeatures;
 
-    int nDeviceFeatures = device.enumerateFeatures(nullptr);
+    int nDeviceFeatures = device->enumerateFeatures(nullptr);
     deviceFeatures.resize(nDeviceFeatures, wgpu::FeatureName::Undefined);
-    device.enumerateFeatures(deviceFeatures.data());
+    device->enumerateFeatures(deviceFeatures.data());
 
     std::cout << "Adapter features:" << std::endl;
     for (const auto& f : features)
     {
-        std::string fs;
-        if (featuresNames.count(f))
-            fs = featuresNames.at(f);
-        else
-            fs = std::to_string(f);
-
-        std::cout << " - " << fs << std::endl;
+        std::cout << " - ";
+        writeEnumName(std::cout, featureNames, f);
+        std::cout << std::endl;
     }
 
-    wgpu::Queue queue = device.getQueue();
+    size_t queuePhase = profiler.begin("queue setup");
+    Owned<wgpu::Queue> queue(device->getQueue());
 
-    auto onQueueWorkDone = [](wgpu::QueueWorkDoneStatus status)
+    std::cout << "Queue: " << queue.get() << std::endl;
+
+    // Every frame registers its own completion callback, see FramesInFlight
+    auto framesInFlight = std::make_unique<FramesInFlight>(device, queue, options.framesInFlight);
+    std::cout << "Frames in flight: " << framesInFlight->slotCount() << std::endl;
+    // Per-frame handles are freed in one batch once the GPU has finished their frame
+    auto deferredRelease = std::make_unique<DeferredRelease>();
+    profiler.end(queuePhase);
+
+    // GPGPU only, the same device without a frame loop
+    if (options.computeTest)
     {
-        std::string st;
-        std::map<wgpu::QueueWorkDoneStatus, std::string> queueWdsNames =
-        {
-            {wgpu::QueueWorkDoneStatus::Success,    "Success"},
-            {wgpu::QueueWorkDoneStatus::Error,      "Error"},
-            {wgpu::QueueWorkDoneStatus::Unknown,    "Unknown"},
-            {wgpu::QueueWorkDoneStatus::DeviceLost, "DeviceLost"},
-            
-            {wgpu::QueueWorkDoneStatus::Force32,    "Force32"}
-        };
-        if (queueWdsNames.count(status))
+        return runComputeSelfTest(device, queue, &blobCache) ? 0 : 1;
+    }
+
+    size_t targetPhase = profiler.begin(options.headless ? "offscreen target creation" : "swap chain creation");
+    std::unique_ptr<RenderTarget> target;
+    // Same object as the target, null in headless mode
+    SwapChainTarget* swapChainTarget = nullptr;
+    try
+    {
+        if (options.headless)
         {
-            st = queueWdsNames.at(status);
+            target = std::make_unique<OffscreenTarget>(device, options.width, options.height, options.format);
         }
         else
         {
-            st = std::to_string(status);
+            auto sct = std::make_unique<SwapChainTarget>(adapter, device, surface,
+                                                         windowEvents.framebufferWidth, windowEvents.framebufferHeight,
+                                                         wgpu::TextureFormat::BGRA8Unorm, options.presentMode,
+                                                         true);
+            swapChainTarget = sct.get();
+            target = std::move(sct);
         }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    profiler.end(targetPhase);
 
-        std::cout << "Queued work finished with status: " << st << std::endl;
-    };
+    AttachmentPool attachmentPool(device);
+
+    std::unique_ptr<GpuProfiler> gpuProfiler;
+    if (options.gpuProfiler)
+    {
+        gpuProfiler = std::make_unique<GpuProfiler>(device, queue);
+    }
+
+    std::unique_ptr<GoldenTest> golden;
+    if (!options.goldenDir.empty())
+    {
+        golden = std::make_unique<GoldenTest>(options.goldenDir, options.captureDir, options.goldenUpdate,
+                                              options.goldenTolerance, options.goldenPsnr, adapterKey,
+                                              gpuProfiler.get());
+    }
 
+    // A window can always capture by the hotkey, headless runs only when asked to
+    std::unique_ptr<FrameCapture> frameCapture;
+    if (golden)
+    {
+        // Frames are compared instead of written, the golden test decides which ones
+        frameCapture = std::make_unique<FrameCapture>(device, options.captureDir);
+        frameCapture->setImageHandler([&golden](const FrameCapture::Image& image) { golden->compare(image); });
+    }
+    else if (!options.headless || !options.captureFrames.empty() || options.captureEvery)
+    {
+        frameCapture = std::make_unique<FrameCapture>(device, options.captureDir);
+        frameCapture->captureEvery(options.captureEvery);
+        frameCapture->captureFrames(options.captureFrames);
+    }
+
+    uint32_t encoderThreads = options.encoderThreads;
 #ifdef WEBGPU_BACKEND_DAWN
-    queue.onSubmittedWorkDone(/* signalValue -- no idea what it is */ 0, onQueueWorkDone);
-#elif defined(WEBGPU_BACKEND_WGPU)
-    queue.onSubmittedWorkDone(onQueueWorkDone);
+    if (encoderThreads > 0 && !device->hasFeature(wgpu::FeatureName::ImplicitDeviceSynchronization))
+    {
+        std::cout << "No ImplicitDeviceSynchronization, recording on the main thread" << std::endl;
+        encoderThreads = 0;
+    }
 #endif
+    ParallelEncoder parallelEncoder(device, encoderThreads);
+    std::vector<WGPUCommandBuffer> commandBuffers;
+
+    // Bind groups are looked up every frame and only created when what they bind changes
+    auto bindGroupCache = std::make_unique<BindGroupCache>(device);
+    // Objects never share a 256-byte aligned slot, this is enough for a frame without growing.
+    // The GPU-driven scene pushes only the camera. The golden test's scenes share the ring.
+    uint32_t uniformSlots = options.gpuDriven ? 1 : std::max(options.objectCount, 1u);
+    if (golden)
+    {
+        uniformSlots = GoldenTest::maxUniformSlots();
+    }
+    auto uniformRing = std::make_unique<UniformRing>(device, queue, framesInFlight->slotCount(),
+                                                     uniformSlots * 256, bindGroupCache.get());
+    // Bulk uploads are written straight into mapped staging memory
+    auto stagingBelt = std::make_unique<StagingBelt>(device);
+    // Pipelines are compiled in the background, draws are skipped until they are ready
+    auto pipelineCache = std::make_unique<PipelineCache>(device);
+    std::unique_ptr<GridScene> scene;
+    std::unique_ptr<GpuDrivenScene> gpuScene;
+    FrameContext frame;
+    // One of the two scenes exists at a time
+    auto createScene = [&](uint32_t objectCount, bool gpuDriven, bool renderBundles)
+    {
+        scene.reset();
+        gpuScene.reset();
+        if (gpuDriven)
+        {
+            gpuScene = std::make_unique<GpuDrivenScene>(device, queue, &blobCache, *pipelineCache, *bindGroupCache,
+                                                        target->format(), wgpu::TextureFormat::Depth24Plus,
+                                                        objectCount);
+        }
+        else
+        {
+            scene = std::make_unique<GridScene>(device, &blobCache, *pipelineCache, *bindGroupCache, target->format(),
+                                                wgpu::TextureFormat::Depth24Plus, objectCount, renderBundles);
+        }
+        frame.scene = scene.get();
+        frame.gpuScene = gpuScene.get();
+    };
+    if (golden)
+    {
+        createScene(golden->scene().objectCount, golden->scene().gpuDriven, golden->scene().renderBundles);
+    }
+    else
+    {
+        createScene(options.objectCount, options.gpuDriven, options.renderBundles);
+    }
 
-    std::cout << "Queue: " << queue << std::endl;
+    frame.profiler = gpuProfiler.get();
+    frame.uniforms = uniformRing.get();
+    frame.stagingBelt = stagingBelt.get();
 
-    wgpu::SwapChainDescriptor swapChainDesc;
-    swapChainDesc.setDefault();
+    // Passes are declared every frame, the graph decides what runs and in which order
+    RenderGraph graph(attachmentPool);
 
-    swapChainDesc.width = 640;
-    swapChainDesc.height = 480;
-    swapChainDesc.format = wgpu::TextureFormat::BGRA8Unorm;
-    swapChainDesc.usage = wgpu::TextureUsage::RenderAttachment;
-    swapChainDesc.presentMode = wgpu::PresentMode::Fifo;
-    swapChainDesc.label = "Our swap chain";
-    wgpu::SwapChain swapChain = device.createSwapChain(surface, swapChainDesc);
+    wgpu::CommandEncoderDescriptor encoderDesc;
+    encoderDesc.label = "My command encoder";
+    wgpu::CommandBufferDescriptor cmdBufferDescriptor;
+    cmdBufferDescriptor.label = "Command buffer";
 
-    std::cout << "Swapchain: " << swapChain << std::endl;
+    // Only the frame loop itself is checked, everything above may allocate freely
+    uint64_t warmFrames = 0;
+    uint64_t warmFramesAllocating = 0;
+    uint64_t warmAllocations = 0;
+    // Owned handles alive when the loop gets warm, see --check-handles
+    LiveHandleCounts warmHandles {};
 
     std::cout << "Running frame loop..." << std::endl;
 
-    int nFrame = 0;
-    while (!glfwWindowShouldClose(window))
+    size_t firstFramePhase = profiler.begin("first frame");
+
+    auto loopStart = std::chrono::steady_clock::now();
+
+    uint32_t nFrame = 0;
+    while (options.headless || !glfwWindowShouldClose(window))
     {
-        // Check whether the user clicked on the close button (and any other
-        // mouse/key event, which we don't use so far)
-        glfwPollEvents();
+        if (options.frameCount && nFrame >= options.frameCount)
+        {
+            break;
+        }
+
+        // Scenes are switched on an idle GPU, so their frames never overlap
+        if (golden && golden->sceneDone())
+        {
+            if (!framesInFlight->waitIdle(frameTimeout))
+            {
+                std::cerr << "GPU did not finish the scene " << golden->scene().name << " in time" << std::endl;
+                break;
+            }
+            if (!golden->nextScene())
+            {
+                break;
+            }
+            const GoldenTest::Scene& next = golden->scene();
+            createScene(next.objectCount, next.gpuDriven, next.renderBundles);
+        }
+
+        uint64_t frameAllocationsStart = allocationCount();
+        // A capture allocates the image and its PNG encoder, such frames are not checked either
+        bool capturing = frameCapture && !frameCapture->idle();
+        if (nFrame == allocationWarmupFrames)
+        {
+            warmHandles = liveHandleCounts();
+        }
+        // Recreating the swap chain allocates, such frames are not checked
+        bool targetChanged = false;
+
+        if (!options.headless)
+        {
+            // Check whether the user clicked on the close button (and any other
+            // mouse/key event)
+            glfwPollEvents();
+        }
+
+        if (windowEvents.cyclePresentMode)
+        {
+            windowEvents.cyclePresentMode = false;
+            targetChanged = true;
+            swapChainTarget->setPresentMode(nextPresentMode(swapChainTarget->presentMode()));
+        }
+
+        if (windowEvents.captureFrame)
+        {
+            windowEvents.captureFrame = false;
+            if (frameCapture)
+            {
+                frameCapture->requestCapture();
+            }
+        }
+        capturing = capturing || (frameCapture && frameCapture->wants(nFrame));
+
+        if (windowEvents.resizePending &&
+            std::chrono::steady_clock::now() - windowEvents.lastResize >= resizeDebounce)
+        {
+            windowEvents.resizePending = false;
+            targetChanged = true;
+            if (windowEvents.framebufferWidth > 0 && windowEvents.framebufferHeight > 0)
+            {
+                swapChainTarget->resize(windowEvents.framebufferWidth, windowEvents.framebufferHeight);
+            }
+        }
 
-        wgpu::TextureView nextTexture = swapChain.getCurrentTextureView();
+        // Minimized window has nothing to render to
+        if (swapChainTarget && (windowEvents.framebufferWidth == 0 || windowEvents.framebufferHeight == 0))
+        {
+            glfwWaitEventsTimeout(0.1);
+            continue;
+        }
+
+        // Waiting before the acquire keeps the swap chain image free while the GPU catches up
+        if (!framesInFlight->beginFrame(frameTimeout))
+        {
+            std::cerr << "GPU did not finish frame " << framesInFlight->frameSerial() - framesInFlight->slotCount()
+                      << " in time" << std::endl;
+            break;
+        }
+        deferredRelease->collect(framesInFlight->completedSerial());
+        // CPU time of the frame, what the golden test measures, leaves out the wait for the GPU
+        auto cpuStart = std::chrono::steady_clock::now();
+
+        if (gpuProfiler)
+        {
+            gpuProfiler->beginFrame();
+        }
+
+        Owned<wgpu::TextureView> nextTexture(target->acquire());
 
         if (!nextTexture)
         {
-            std::cerr << "Cannot acquire next swap chain texture" << std::endl;
+            std::cerr << "Cannot acquire next frame texture" << std::endl;
             break;
         }
 
         // Turn it on if you need it
         //std::cout << "frame #" << nFrame << std::endl;
 
-        wgpu::CommandEncoderDescriptor encoderDesc;
-        encoderDesc.label = "My command encoder";
-        wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+        // Reallocated by the pool only when the target size has actually changed
+        AttachmentKey depthKey;
+        depthKey.width = target->width();
+        depthKey.height = target->height();
+        depthKey.format = wgpu::TextureFormat::Depth24Plus;
+        depthKey.usage = wgpu::TextureUsage::RenderAttachment;
+        depthKey.sampleCount = 1;
+        // Cleared on load and discarded on store, may stay in tile memory
+        depthKey.transient = true;
+        // All uniforms of the frame go to the GPU in one upload
+        uniformRing->beginFrame(framesInFlight->slot());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+        if (golden)
+        {
+            seconds = golden->scene().seconds;
+        }
+        if (scene)
+        {
+            scene->update(*uniformRing, seconds);
+        }
+        else
+        {
+            gpuScene->update(*uniformRing, seconds);
+        }
+        uniformRing->endFrame();
+
+        frame.slot = framesInFlight->slot();
+
+        graph.beginFrame();
+        RenderGraph::ResourceId backbuffer = graph.importTexture("Backbuffer", nextTexture.get());
+        RenderGraph::ResourceId depth = graph.createTexture("Depth attachment", depthKey);
+        RenderGraph::ResourceId uniforms = graph.importBuffer("Uniform ring", uniformRing->buffer(frame.slot));
+
+        if (scene)
+        {
+            RenderGraph::ResourceId vertices = graph.importBuffer("Grid vertices", scene->vertices());
+
+            if (scene->needsUpload())
+            {
+                graph.addPass("Uploads", [&frame](wgpu::CommandEncoder encoder)
+                {
+                    frame.scene->upload(*frame.stagingBelt, encoder);
+                })
+                .write(vertices);
+            }
+
+            graph.addRenderPass("Main pass", [&frame](wgpu::RenderPassEncoder renderPass)
+            {
+                auto start = std::chrono::steady_clock::now();
+                frame.scene->draw(renderPass, *frame.uniforms, frame.slot);
+                frame.encodeMs.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            })
+            .color(backbuffer, wgpu::LoadOp::Clear, wgpu::StoreOp::Store, wgpu::Color{ 0.9, 0.1, 0.2, 1.0 })
+            .depth(depth, wgpu::LoadOp::Clear, wgpu::StoreOp::Discard)
+            .read(vertices)
+            .read(uniforms);
+        }
+        else
+        {
+            RenderGraph::ResourceId instances = graph.importBuffer("Instances", gpuScene->instances());
+            RenderGraph::ResourceId visible = graph.importBuffer("Visible instances", gpuScene->visibleList());
+            RenderGraph::ResourceId drawArgs = graph.importBuffer("Draw arguments", gpuScene->drawArguments());
+
+            if (gpuScene->needsUpload())
+            {
+                graph.addPass("Uploads", [&frame](wgpu::CommandEncoder encoder)
+                {
+                    frame.gpuScene->upload(*frame.stagingBelt, encoder);
+                })
+                .write(instances);
+            }
+
+            graph.addPass("GPU culling", [&frame](wgpu::CommandEncoder encoder)
+            {
+                frame.gpuScene->cull(encoder, *frame.uniforms, frame.slot, frame.profiler);
+            })
+            .read(instances)
+            .read(uniforms)
+            .write(visible)
+            .write(drawArgs);
+
+            graph.addRenderPass("Main pass", [&frame](wgpu::RenderPassEncoder renderPass)
+            {
+                auto start = std::chrono::steady_clock::now();
+                frame.gpuScene->draw(renderPass, *frame.uniforms, frame.slot);
+                frame.encodeMs.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            })
+            .color(backbuffer, wgpu::LoadOp::Clear, wgpu::StoreOp::Store, wgpu::Color{ 0.9, 0.1, 0.2, 1.0 })
+            .depth(depth, wgpu::LoadOp::Clear, wgpu::StoreOp::Discard)
+            .read(instances)
+            .read(visible)
+            .read(drawArgs)
+            .read(uniforms);
+        }
+
+        graph.compile();
+        // Each job has its own encoder and possibly runs on a worker thread; they are submitted
+        // in the compiled order, so uploads land before the passes use them
+        graph.execute(parallelEncoder, gpuProfiler.get());
+
+        if (nFrame == 0 && !options.renderGraphPath.empty())
+        {
+            std::ofstream dot(options.renderGraphPath);
+            graph.writeDot(dot);
+            std::cout << "Render graph: " << graph.passCount() << " passes, " << graph.culledCount() << " culled, "
+                      << graph.renderPassCount() << " render passes, written to " << options.renderGraphPath
+                      << std::endl;
+        }
+
+        commandBuffers.clear();
+        parallelEncoder.record(commandBuffers);
+        if (golden)
+        {
+            golden->frameRecorded(scene ? scene->ready() : gpuScene->ready());
+            if (golden->wantsCapture())
+            {
+                frameCapture->requestCapture();
+            }
+        }
+        // Staging memory must be unmapped before the copies are submitted
+        stagingBelt->finish();
 
-        // encoder.insertDebugMarker("Do one thing");
-        // encoder.insertDebugMarker("Do another thing");
+        deferredRelease->release(std::move(nextTexture));
 
-        wgpu::RenderPassDescriptor renderPassDesc;
-        wgpu::RenderPassColorAttachment renderPassColorAttachment;
-        renderPassColorAttachment.view = nextTexture;
-        renderPassColorAttachment.resolveTarget = nullptr;
-        renderPassColorAttachment.loadOp = wgpu::LoadOp::Clear;
-        renderPassColorAttachment.storeOp = wgpu::StoreOp::Store;
-        renderPassColorAttachment.clearValue = wgpu::Color{ 0.9, 0.1, 0.2, 1.0 };
+        // The main thread's encoder goes last, it resolves what the passes have written
+        Owned<wgpu::CommandEncoder> encoder(device->createCommandEncoder(encoderDesc));
 
-        renderPassDesc.colorAttachmentCount = 1;
-        renderPassDesc.colorAttachments = &renderPassColorAttachment;
-        renderPassDesc.depthStencilAttachment = nullptr;
-        renderPassDesc.timestampWriteCount = 0;
-        renderPassDesc.timestampWrites = nullptr;
-        renderPassDesc.nextInChain = nullptr;
+        if (gpuProfiler)
+        {
+            gpuProfiler->resolve(encoder);
+        }
 
-        wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-        renderPass.end();
+        // Copied last, after everything the frame draws
+        if (frameCapture && frameCapture->wants(nFrame))
+        {
+            capturing = true;
+            bool captured = frameCapture->capture(encoder, target->copySource(), target->format(), target->width(),
+                                                  target->height(), nFrame);
+            if (captured && golden)
+            {
+                golden->captured(nFrame);
+            }
+        }
 
-        nextTexture.release();
+        Owned<wgpu::CommandBuffer> commandBuffer(encoder->finish(cmdBufferDescriptor));
+        commandBuffers.push_back(commandBuffer.get());
+
+        // All command buffers of the frame go in one submit, in the order their jobs were added
+        wgpuQueueSubmit(queue.get(), commandBuffers.size(), commandBuffers.data());
+        deferredRelease->release(std::move(commandBuffer));
+        deferredRelease->release(std::move(encoder));
+        deferredRelease->endFrame(framesInFlight->frameSerial());
+        stagingBelt->recall();
+        framesInFlight->endFrame();
+        if (gpuProfiler)
+        {
+            gpuProfiler->endFrame();
+        }
+        if (frameCapture)
+        {
+            frameCapture->endFrame();
+        }
+        attachmentPool.endFrame();
+        bindGroupCache->endFrame();
 
-        wgpu::CommandBufferDescriptor cmdBufferDescriptor;
-        cmdBufferDescriptor.label = "Command buffer";
+        target->present();
 
-        wgpu::CommandBuffer commandBuffer = encoder.finish(cmdBufferDescriptor);
-        // as an option, a vector of commandBuffers can be submitted
-        queue.submit(commandBuffer);
+        if (golden && golden->measuring())
+        {
+            auto cpuTime = std::chrono::steady_clock::now() - cpuStart;
+            golden->addCpuTime(std::chrono::duration<double, std::milli>(cpuTime).count());
+        }
 
-        //commandBuffer.release();
-        //encoder.release();
+        // A golden test's scene allocates until it is warm, like the first frames
+        if (nFrame >= allocationWarmupFrames && !targetChanged && !capturing && (!golden || golden->measuring()))
+        {
+            uint64_t frameAllocations = allocationCount() - frameAllocationsStart;
+            warmFrames++;
+            if (frameAllocations)
+            {
+                warmFramesAllocating++;
+                warmAllocations += frameAllocations;
+            }
+        }
 
-        swapChain.present();
+        if (nFrame == 0)
+        {
+            profiler.end(firstFramePhase);
+            if (!options.startupReportPath.empty())
+            {
+                profiler.print();
+                profiler.writeJson(options.startupReportPath);
+            }
+        }
 
         nFrame++;
     }
 
-    swapChain.release();
+    double loopSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+    std::cout << nFrame << " frames in " << loopSeconds << " s";
+    if (loopSeconds > 0)
+    {
+        std::cout << " (" << nFrame / loopSeconds << " fps)";
+    }
+    std::cout << std::endl;
 
-    surface.release();
+    if (!frame.encodeMs.empty())
+    {
+        if (gpuScene)
+        {
+            std::cout << "Scene encoding, " << gpuScene->objectCount() << " objects, GPU-driven";
+        }
+        else if (options.renderBundles)
+        {
+            std::cout << "Scene encoding, " << scene->objectCount() << " draws, render bundles recorded "
+                      << scene->bundleRecordCount() << " times";
+        }
+        else
+        {
+            std::cout << "Scene encoding, " << scene->objectCount() << " draws, no render bundles";
+        }
+        std::cout << ", ms (min / avg / p99 / max): " << std::fixed << std::setprecision(3)
+                  << frame.encodeMs.min() << " / " << frame.encodeMs.avg() << " / " << frame.encodeMs.percentile(99)
+                  << " / " << frame.encodeMs.max() << std::defaultfloat << std::endl;
+    }
 
-    queue.release();
+    int exitCode = 0;
+    if (options.checkAllocations)
+    {
+        std::cout << warmAllocations << " heap allocations in " << warmFramesAllocating << " of "
+                  << warmFrames << " warm frames" << std::endl;
+#ifdef WEBGPU_BACKEND_DAWN
+        // Dawn allocates with the same operator new, its own per-frame allocations cannot be told apart
+        std::cout << "Dawn's internal allocations are counted too, not failing on them" << std::endl;
+#else
+        if (warmAllocations)
+        {
+            std::cerr << "Frame loop is expected not to allocate once warm" << std::endl;
+            exitCode = 1;
+        }
+#endif
+    }
 
-    device.release();
+    if (options.checkHandles)
+    {
+        // A check that cannot run fails, so that a CI job asking for it does not pass silently
+#ifdef NDEBUG
+        std::cerr << "Live handles are counted in debug builds only" << std::endl;
+        exitCode = 1;
+#else
+        if (nFrame <= allocationWarmupFrames)
+        {
+            std::cerr << "Live handles need more than " << allocationWarmupFrames << " frames to be compared"
+                      << std::endl;
+            exitCode = 1;
+        }
+        else
+        {
+            std::cout << "Live handle counts after frame " << allocationWarmupFrames << " and on exit:" << std::endl;
+            // Frames recreating the swap chain are part of the run, so the counts must come back
+            if (!compareLiveHandles(warmHandles, liveHandleCounts(), std::cout))
+            {
+                std::cerr << "Live handle count has grown in the frame loop" << std::endl;
+                exitCode = 1;
+            }
+        }
+#endif
+    }
+
+    if (!framesInFlight->waitIdle(frameTimeout))
+    {
+        std::cerr << "GPU did not finish the last frames in time" << std::endl;
+    }
+    deferredRelease->printStats();
+    deferredRelease.reset();
+    framesInFlight.reset();
+    gpuProfiler.reset();
+    if (frameCapture)
+    {
+        frameCapture->printStats();
+    }
+    // Joins the writer, so every capture has been compared
+    frameCapture.reset();
+    if (golden && !golden->report())
+    {
+        exitCode = 1;
+    }
+    scene.reset();
+    gpuScene.reset();
+    pipelineCache->printStats();
+    pipelineCache.reset();
+    uniformRing.reset();
+    bindGroupCache->printStats();
+    if (!options.startupReportPath.empty())
+    {
+        // The report written after the first frame is updated with the counters of the whole run
+        BindGroupCache::Stats bindGroupStats = bindGroupCache->stats();
+        profiler.setCounter("bind_group_cache_hits", bindGroupStats.hits);
+        profiler.setCounter("bind_group_cache_misses", bindGroupStats.misses);
+        profiler.setCounter("bind_group_cache_evictions", bindGroupStats.evictions);
+        profiler.setCounter("bind_group_cache_invalidations", bindGroupStats.invalidations);
+        profiler.writeJson(options.startupReportPath);
+    }
+    attachmentPool.printStats();
+    bindGroupCache.reset();
+    stagingBelt.reset();
 
-    adapter.release();
+    target.reset();
 
-    glfwDestroyWindow(window);
+    // The surface goes before its window, queue, device, adapter and instance follow on return
+    surface.reset();
 
-    instance.release();
+    if (window)
+    {
+        glfwDestroyWindow(window);
+    }
 
-    return 0;
+    return exitCode;
 }
\ No newline at end of file
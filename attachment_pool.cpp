@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "attachment_pool.hpp"
+
+
+// Good enough for the memory estimate, compressed and exotic formats are not attachments anyway
+static uint32_t bytesPerTexel(WGPUTextureFormat format)
+{
+    switch (format)
+    {
+    case WGPUTextureFormat_R8Unorm:
+    case WGPUTextureFormat_Stencil8:
+        return 1;
+    case WGPUTextureFormat_RG8Unorm:
+    case WGPUTextureFormat_R16Float:
+    case WGPUTextureFormat_Depth16Unorm:
+        return 2;
+    case WGPUTextureFormat_RGBA16Float:
+    case WGPUTextureFormat_RG32Float:
+    case WGPUTextureFormat_Depth32FloatStencil8:
+        return 8;
+    case WGPUTextureFormat_RGBA32Float:
+        return 16;
+    default:
+        return 4;
+    }
+}
+
+
+AttachmentPool::AttachmentPool(wgpu::Device device) :
+    device(device)
+{
+#ifdef WEBGPU_BACKEND_DAWN
+    if (device.hasFeature(wgpu::FeatureName::TransientAttachments))
+    {
+        transientUsage = wgpu::TextureUsage::TransientAttachment;
+    }
+#endif
+}
+
+
+AttachmentPool::~AttachmentPool()
+{
+    for (auto& e : entries)
+    {
+        destroy(e);
+    }
+}
+
+
+void AttachmentPool::destroy(Entry& e)
+{
+    // Frames in flight may still use the texture, so it is not destroyed explicitly,
+    // the implementation frees it when the last reference is gone
+    e.view.reset();
+    e.texture.reset();
+}
+
+
+wgpu::TextureView AttachmentPool::acquire(const AttachmentKey& key, const char* label)
+{
+    auto it = std::find_if(entries.begin(), entries.end(), [&key](const Entry& e)
+    {
+        return !e.leased && e.key == key;
+    });
+    if (it != entries.end())
+    {
+        it->leased = true;
+        it->lastUsed = frame;
+        frameLeasedBytes += it->bytes;
+        return it->view;
+    }
+
+    WGPUTextureUsageFlags usage = key.usage;
+    // Transient attachments can have no other usage
+    if (key.transient && key.usage == wgpu::TextureUsage::RenderAttachment)
+    {
+        usage |= transientUsage;
+    }
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.label = label;
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.size = { key.width, key.height, 1 };
+    textureDesc.format = key.format;
+    textureDesc.usage = usage;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = key.sampleCount;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+
+    Entry e;
+    e.key = key;
+    e.lastUsed = frame;
+    e.leased = true;
+    e.texture.reset(device.createTexture(textureDesc));
+    // Tile memory only, nothing to count
+    e.bytes = (usage != key.usage) ? 0 :
+              (uint64_t)key.width * key.height * key.sampleCount * bytesPerTexel(key.format);
+
+    wgpu::TextureViewDescriptor viewDesc;
+    viewDesc.label = label;
+    viewDesc.format = key.format;
+    viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = 1;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.aspect = wgpu::TextureAspect::All;
+    e.view.reset(e.texture->createView(viewDesc));
+
+    std::cout << "Attachment " << label << " allocated: " << key.width << "x" << key.height
+              << (usage != key.usage ? ", transient" : "") << std::endl;
+
+    allocatedBytes += e.bytes;
+    peakAllocatedBytes = std::max(peakAllocatedBytes, allocatedBytes);
+    frameLeasedBytes += e.bytes;
+
+    entries.push_back(std::move(e));
+    return entries.back().view;
+}
+
+
+void AttachmentPool::release(wgpu::TextureView view)
+{
+    for (auto& e : entries)
+    {
+        if ((WGPUTextureView)e.view.get() == (WGPUTextureView)view)
+        {
+            e.leased = false;
+            return;
+        }
+    }
+}
+
+
+void AttachmentPool::endFrame()
+{
+    peakLeasedBytes = std::max(peakLeasedBytes, frameLeasedBytes);
+    frameLeasedBytes = 0;
+
+    auto stale = std::remove_if(entries.begin(), entries.end(), [this](Entry& e)
+    {
+        e.leased = false;
+        if (frame - e.lastUsed > maxIdleFrames)
+        {
+            allocatedBytes -= e.bytes;
+            destroy(e);
+            return true;
+        }
+        return false;
+    });
+    entries.erase(stale, entries.end());
+
+    frame++;
+}
+
+
+void AttachmentPool::printStats() const
+{
+    constexpr double mb = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(1)
+              << "Attachment pool: " << entries.size() << " textures, " << allocatedBytes / mb << " MB, "
+              << "peak " << peakAllocatedBytes / mb << " MB, busiest frame leased "
+              << std::max(peakLeasedBytes, frameLeasedBytes) / mb << " MB"
+              << (transientSupported() ? ", transient attachments on" : "") << std::defaultfloat << std::endl;
+}
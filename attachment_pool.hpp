@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "gpu_handle.hpp"
+
+struct AttachmentKey
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    WGPUTextureFormat format = WGPUTextureFormat_Undefined;
+    WGPUTextureUsageFlags usage = 0;
+    uint32_t sampleCount = 1;
+    // Contents never leave the pass: cleared on load, discarded on store, only used as an attachment.
+    // On Dawn with TransientAttachments such a texture may live in tile memory only.
+    bool transient = false;
+
+    bool operator==(const AttachmentKey& other) const
+    {
+        return width == other.width && height == other.height && format == other.format &&
+               usage == other.usage && sampleCount == other.sampleCount && transient == other.transient;
+    }
+};
+
+// Size-dependent attachments (depth, HDR color, MSAA, post-process ping-pong, etc.).
+// A texture is leased with acquire() and goes back to the pool at the end of the frame, or earlier
+// with release() once the last pass using it has been added. A later acquire() with the same key
+// in the same frame gets the returned texture, so attachments whose lifetimes do not overlap share
+// memory. WebGPU has no placed resources, so only textures of the same key are shared.
+// A texture is created lazily when there is no free one for the key, so a resize reallocates
+// only the attachments that are actually used at the new size. Textures unused for a while are released.
+// Not thread-safe, attachments are picked before recording starts.
+class AttachmentPool
+{
+public:
+    // Long enough to survive a few frames in flight and a resize back and forth
+    static constexpr uint64_t maxIdleFrames = 120;
+
+    explicit AttachmentPool(wgpu::Device device);
+    ~AttachmentPool();
+
+    AttachmentPool(const AttachmentPool&) = delete;
+    AttachmentPool& operator=(const AttachmentPool&) = delete;
+
+    // The view stays owned by the pool and valid at least until the next endFrame()
+    wgpu::TextureView acquire(const AttachmentKey& key, const char* label);
+    // Gives the texture back before the end of the frame; passes added after that must not use it
+    void release(wgpu::TextureView view);
+
+    // Returns all leases and drops textures that were not asked for during the last maxIdleFrames frames
+    void endFrame();
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    // Whether transient keys get tile-memory-only textures
+    bool transientSupported() const
+    {
+        return transientUsage != 0;
+    }
+
+    // Memory held by the pool and what the leases of the busiest frame would take without sharing
+    void printStats() const;
+
+private:
+    struct Entry
+    {
+        AttachmentKey key;
+        Owned<wgpu::Texture> texture;
+        Owned<wgpu::TextureView> view;
+        uint64_t lastUsed = 0;
+        uint64_t bytes = 0;
+        bool leased = false;
+    };
+
+    static void destroy(Entry& e);
+
+    wgpu::Device device;
+    WGPUTextureUsageFlags transientUsage = 0;
+    std::vector<Entry> entries;
+    uint64_t frame = 0;
+
+    uint64_t allocatedBytes = 0;
+    uint64_t peakAllocatedBytes = 0;
+    uint64_t frameLeasedBytes = 0;
+    uint64_t peakLeasedBytes = 0;
+};
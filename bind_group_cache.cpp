@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "bind_group_cache.hpp"
+#include "hash.hpp"
+
+
+BindGroupCache::BindGroupCache(wgpu::Device device, size_t capacity) :
+    device(device),
+    capacity(capacity)
+{ }
+
+
+BindGroupCache::~BindGroupCache()
+{
+    for (auto& [hash, layout] : layouts)
+    {
+        layout.release();
+    }
+}
+
+
+wgpu::BindGroupLayout BindGroupCache::getLayout(const wgpu::BindGroupLayoutDescriptor& desc)
+{
+    // Fields one by one: padding bytes in the structures are not initialized
+    uint64_t h = fnvOffsetBasis;
+    hashCombine(h, desc.entryCount);
+    for (size_t i = 0; i < desc.entryCount; i++)
+    {
+        const auto& e = desc.entries[i];
+        hashCombine(h, e.binding);
+        hashCombine(h, e.visibility);
+        hashCombine(h, e.buffer.type);
+        hashCombine(h, e.buffer.hasDynamicOffset);
+        hashCombine(h, e.buffer.minBindingSize);
+        hashCombine(h, e.sampler.type);
+        hashCombine(h, e.texture.sampleType);
+        hashCombine(h, e.texture.viewDimension);
+        hashCombine(h, e.texture.multisampled);
+        hashCombine(h, e.storageTexture.access);
+        hashCombine(h, e.storageTexture.format);
+        hashCombine(h, e.storageTexture.viewDimension);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = layouts.find(h);
+    if (it != layouts.end())
+    {
+        return it->second;
+    }
+
+    wgpu::BindGroupLayout layout = device.createBindGroupLayout(desc);
+    layouts.emplace(h, layout);
+    return layout;
+}
+
+
+uint64_t BindGroupCache::generationOf(const void* resource) const
+{
+    auto it = generations.find(resource);
+    return it == generations.end() ? 0 : it->second;
+}
+
+
+wgpu::BindGroup BindGroupCache::get(wgpu::BindGroupLayout layout, size_t entryCount,
+                                    const wgpu::BindGroupEntry* entries, const char* label)
+{
+    const void* layoutHandle = (WGPUBindGroupLayout)layout;
+
+    auto sameEntries = [entryCount, entries](const CachedBindGroup& c)
+    {
+        if (c.entries.size() != entryCount)
+            return false;
+        for (size_t i = 0; i < entryCount; i++)
+        {
+            EntryKey k { entries[i].binding, entries[i].buffer, entries[i].offset, entries[i].size,
+                         entries[i].sampler, entries[i].textureView };
+            if (!(c.entries[i] == k))
+                return false;
+        }
+        return true;
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t h = fnvOffsetBasis;
+    hashCombine(h, layoutHandle);
+    hashCombine(h, entryCount);
+    for (size_t i = 0; i < entryCount; i++)
+    {
+        const auto& e = entries[i];
+        hashCombine(h, e.binding);
+        hashCombine(h, (const void*)e.buffer);
+        hashCombine(h, e.offset);
+        hashCombine(h, e.size);
+        hashCombine(h, (const void*)e.sampler);
+        hashCombine(h, (const void*)e.textureView);
+        // A new resource with the handle of a destroyed one gets a different key
+        hashCombine(h, generationOf(e.buffer ? (const void*)e.buffer :
+                                    e.sampler ? (const void*)e.sampler : (const void*)e.textureView));
+    }
+
+    auto range = index.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        CachedBindGroup& c = *it->second;
+        if (c.layout == layoutHandle && sameEntries(c))
+        {
+            hits++;
+            c.lastUsed = frame;
+            lru.splice(lru.begin(), lru, it->second);
+            return c.bindGroup;
+        }
+    }
+
+    misses++;
+    wgpu::BindGroupDescriptor desc;
+    desc.label = label;
+    desc.layout = layout;
+    desc.entryCount = entryCount;
+    desc.entries = entries;
+
+    CachedBindGroup c;
+    c.hash = h;
+    c.layout = layoutHandle;
+    c.lastUsed = frame;
+    for (size_t i = 0; i < entryCount; i++)
+    {
+        c.entries.push_back({ entries[i].binding, entries[i].buffer, entries[i].offset, entries[i].size,
+                              entries[i].sampler, entries[i].textureView });
+    }
+    c.bindGroup.reset(device.createBindGroup(desc));
+
+    lru.push_front(std::move(c));
+    index.emplace(h, lru.begin());
+    return lru.front().bindGroup;
+}
+
+
+bool BindGroupCache::referenced(const void* resource) const
+{
+    return std::any_of(lru.begin(), lru.end(), [resource](const CachedBindGroup& c)
+    {
+        return std::any_of(c.entries.begin(), c.entries.end(), [resource](const EntryKey& e)
+        {
+            return e.buffer == resource || e.sampler == resource || e.textureView == resource;
+        });
+    });
+}
+
+
+void BindGroupCache::erase(Lru::iterator it)
+{
+    auto range = index.equal_range(it->hash);
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        if (i->second == it)
+        {
+            index.erase(i);
+            break;
+        }
+    }
+    // Passes that have set it keep their own reference
+    lru.erase(it);
+}
+
+
+void BindGroupCache::invalidate(const void* resource)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    generations[resource]++;
+
+    for (auto it = lru.begin(); it != lru.end(); )
+    {
+        auto next = std::next(it);
+        bool uses = std::any_of(it->entries.begin(), it->entries.end(), [resource](const EntryKey& e)
+        {
+            return e.buffer == resource || e.sampler == resource || e.textureView == resource;
+        });
+        if (uses)
+        {
+            invalidations++;
+            erase(it);
+        }
+        it = next;
+    }
+}
+
+
+void BindGroupCache::endFrame()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // The tail is the least recently used, stop at the first one used this frame
+    while (lru.size() > capacity && lru.back().lastUsed != frame)
+    {
+        evictions++;
+        erase(std::prev(lru.end()));
+    }
+
+    // A generation only tells apart the bind groups made before and after an invalidation; with none
+    // of them left, a handle reused for a new resource starts again from zero
+    for (auto it = generations.begin(); it != generations.end(); )
+    {
+        it = referenced(it->first) ? std::next(it) : generations.erase(it);
+    }
+    frame++;
+}
+
+
+void BindGroupCache::printStats() const
+{
+    uint64_t lookups = hits + misses;
+    std::cout << "Bind group cache: " << lru.size() << " bind groups, " << layouts.size() << " layouts, "
+              << lookups << " lookups";
+    if (lookups)
+    {
+        std::cout << ", " << std::fixed << std::setprecision(1) << 100.0 * hits / lookups << "% hits"
+                  << std::defaultfloat;
+    }
+    std::cout << ", " << evictions << " evicted, " << invalidations << " invalidated" << std::endl;
+}
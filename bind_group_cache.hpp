@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "gpu_handle.hpp"
+
+// Deduplicates bind group layouts and bind groups.
+// A bind group is keyed by its layout and by the handles, offsets and sizes it binds.
+// Handles may be reused by the implementation after a resource is freed, so whoever destroys
+// a bound resource calls invalidate() first: that bumps the resource's generation, which is
+// a part of the key, and drops the bind groups using it.
+// Least recently used bind groups are released in endFrame() when there are more than the capacity;
+// those used in the current frame are kept. Lookups can come from several encoding threads.
+class BindGroupCache
+{
+public:
+    // Counted since the cache was created
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+    };
+
+    explicit BindGroupCache(wgpu::Device device, size_t capacity = 1024);
+    ~BindGroupCache();
+
+    BindGroupCache(const BindGroupCache&) = delete;
+    BindGroupCache& operator=(const BindGroupCache&) = delete;
+
+    // Layouts are owned by the cache and live as long as it does
+    wgpu::BindGroupLayout getLayout(const wgpu::BindGroupLayoutDescriptor& desc);
+    // The bind group is owned by the cache and valid at least until the next endFrame()
+    wgpu::BindGroup get(wgpu::BindGroupLayout layout, size_t entryCount, const wgpu::BindGroupEntry* entries,
+                        const char* label = nullptr);
+
+    // Call before a bound buffer, texture view or sampler is released
+    void invalidate(const void* resource);
+
+    // Applies the capacity and forgets the generations no cached bind group depends on
+    void endFrame();
+
+    size_t size() const
+    {
+        return lru.size();
+    }
+
+    Stats stats() const
+    {
+        return { hits, misses, evictions, invalidations };
+    }
+
+    // Lookups since start, evictions and the hit rate
+    void printStats() const;
+
+private:
+    struct EntryKey
+    {
+        uint32_t binding;
+        const void* buffer;
+        uint64_t offset;
+        uint64_t size;
+        const void* sampler;
+        const void* textureView;
+
+        bool operator==(const EntryKey& other) const
+        {
+            return binding == other.binding && buffer == other.buffer && offset == other.offset &&
+                   size == other.size && sampler == other.sampler && textureView == other.textureView;
+        }
+    };
+
+    struct CachedBindGroup
+    {
+        uint64_t hash = 0;
+        const void* layout = nullptr;
+        std::vector<EntryKey> entries;
+        Owned<wgpu::BindGroup> bindGroup;
+        uint64_t lastUsed = 0;
+    };
+
+    using Lru = std::list<CachedBindGroup>;
+
+    uint64_t generationOf(const void* resource) const;
+    // Whether a cached bind group binds the buffer, sampler or texture view
+    bool referenced(const void* resource) const;
+    void erase(Lru::iterator it);
+
+    wgpu::Device device;
+    size_t capacity;
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, wgpu::BindGroupLayout> layouts;
+    // Most recently used first
+    Lru lru;
+    std::unordered_multimap<uint64_t, Lru::iterator> index;
+    // Invalidated resources still bound by a cached bind group, the others are dropped in endFrame()
+    std::unordered_map<const void*, uint64_t> generations;
+    uint64_t frame = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+};
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "blob_cache.hpp"
+#include "hash.hpp"
+
+namespace fs = std::filesystem;
+
+// Entry layout: magic, version, key size, key, value size, value
+static const char entryMagic[4] = { 'W', 'G', 'B', 'C' };
+// Created under the root, nothing outside it is touched
+static const char* ownedDirName = "webgpu-demo-cache";
+
+
+// Only v followed by digits is a cache version, anything else is left alone
+static bool isVersionDirName(const std::string& name)
+{
+    return name.size() > 1 && name[0] == 'v' &&
+           std::all_of(name.begin() + 1, name.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+
+BlobCache::BlobCache(const fs::path& root, const std::string& adapterKey, uint64_t maxBytes) :
+    dir(root / ownedDirName / ("v" + std::to_string(version)) / adapterKey),
+    maxBytes(maxBytes)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+    {
+        std::cout << "Cannot create cache directory " << dir << ": " << ec.message() << std::endl;
+        return;
+    }
+
+    removeStaleVersions(root / ownedDirName);
+
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+    {
+        if (entry.is_regular_file(ec))
+        {
+            totalBytes += entry.file_size(ec);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    trim();
+}
+
+
+BlobCache::~BlobCache()
+{
+    printStats();
+}
+
+
+void BlobCache::removeStaleVersions(const fs::path& owned)
+{
+    const std::string current = "v" + std::to_string(version);
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(owned, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (entry.is_directory(ec) && !entry.is_symlink(ec) && isVersionDirName(name) && name != current)
+        {
+            std::cout << "Removing stale cache " << entry.path() << std::endl;
+            fs::remove_all(entry.path(), ec);
+        }
+    }
+}
+
+
+fs::path BlobCache::entryPath(const void* key, size_t keySize) const
+{
+    return dir / (toHex(fnv1a(key, keySize)) + ".bin");
+}
+
+
+bool BlobCache::readEntry(const fs::path& path, const void* key, size_t keySize, uint64_t& valueSize,
+                          std::vector<uint8_t>* value) const
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+
+    char magic[sizeof(entryMagic)];
+    uint32_t entryVersion = 0;
+    uint64_t storedKeySize = 0;
+    f.read(magic, sizeof(magic));
+    f.read(reinterpret_cast<char*>(&entryVersion), sizeof(entryVersion));
+    f.read(reinterpret_cast<char*>(&storedKeySize), sizeof(storedKeySize));
+
+    if (!f || std::memcmp(magic, entryMagic, sizeof(magic)) != 0 || entryVersion != version ||
+        storedKeySize != keySize)
+        return false;
+
+    // The file name is just a hash of the key, the full key is compared to rule out collisions
+    std::vector<uint8_t> storedKey(storedKeySize);
+    f.read(reinterpret_cast<char*>(storedKey.data()), storedKeySize);
+    if (!f || std::memcmp(storedKey.data(), key, keySize) != 0)
+        return false;
+
+    f.read(reinterpret_cast<char*>(&valueSize), sizeof(valueSize));
+    if (value && f)
+    {
+        value->resize(valueSize);
+        f.read(reinterpret_cast<char*>(value->data()), valueSize);
+    }
+    return (bool)f;
+}
+
+
+bool BlobCache::load(const void* key, size_t keySize, std::vector<uint8_t>& value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    fs::path path = entryPath(key, keySize);
+    uint64_t valueSize = 0;
+    if (!readEntry(path, key, keySize, valueSize, &value))
+    {
+        misses++;
+        return false;
+    }
+
+    // Last write time serves as a last access time for LRU eviction
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+    hits++;
+    return true;
+}
+
+
+bool BlobCache::valueSize(const void* key, size_t keySize, uint64_t& size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!readEntry(entryPath(key, keySize), key, keySize, size, nullptr))
+    {
+        misses++;
+        return false;
+    }
+    return true;
+}
+
+
+void BlobCache::store(const void* key, size_t keySize, const void* value, size_t valueSize)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    fs::path path = entryPath(key, keySize);
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+
+    uint64_t storedKeySize = keySize;
+    uint64_t storedValueSize = valueSize;
+    {
+        std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+        f.write(entryMagic, sizeof(entryMagic));
+        f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        f.write(reinterpret_cast<const char*>(&storedKeySize), sizeof(storedKeySize));
+        f.write(reinterpret_cast<const char*>(key), keySize);
+        f.write(reinterpret_cast<const char*>(&storedValueSize), sizeof(storedValueSize));
+        f.write(reinterpret_cast<const char*>(value), valueSize);
+        if (!f)
+        {
+            std::cout << "Cannot write cache entry " << tmpPath << std::endl;
+            return;
+        }
+    }
+
+    std::error_code ec;
+    uint64_t oldSize = fs::exists(path, ec) ? fs::file_size(path, ec) : 0;
+    uint64_t newSize = fs::file_size(tmpPath, ec);
+
+    // Rename is atomic, a concurrent reader never sees a half-written entry
+    fs::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        std::cout << "Cannot store cache entry " << path << ": " << ec.message() << std::endl;
+        fs::remove(tmpPath, ec);
+        return;
+    }
+
+    totalBytes = totalBytes - std::min(oldSize, totalBytes) + newSize;
+    stores++;
+
+    trim();
+}
+
+
+void BlobCache::trim()
+{
+    if (totalBytes <= maxBytes)
+        return;
+
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type time;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+
+    std::error_code ec;
+    for (const auto& e : fs::directory_iterator(dir, ec))
+    {
+        if (e.is_regular_file(ec))
+        {
+            entries.push_back({ e.path(), e.last_write_time(ec), e.file_size(ec) });
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+
+    // Trim a bit deeper than the cap so that the next few stores don't trigger a rescan
+    uint64_t target = maxBytes - maxBytes / 8;
+    for (const auto& e : entries)
+    {
+        if (totalBytes <= target)
+            break;
+
+        if (fs::remove(e.path, ec))
+        {
+            totalBytes -= std::min(e.size, totalBytes);
+            evictions++;
+        }
+    }
+}
+
+
+void BlobCache::printStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "Blob cache " << dir << ": " << hits << " hits, " << misses << " misses, "
+              << stores << " stores, " << evictions << " evictions, "
+              << totalBytes << " of " << maxBytes << " bytes used" << std::endl;
+}
+
+
+#ifdef WEBGPU_BACKEND_DAWN
+
+static size_t dawnLoadCacheData(void const * key, size_t keySize, void * value, size_t valueSize, void * userdata)
+{
+    BlobCache* cache = reinterpret_cast<BlobCache*>(userdata);
+
+    // Dawn asks for the size first with a null value, then for the contents; the value is read and the
+    // hit counted only once
+    if (!value)
+    {
+        uint64_t size = 0;
+        return cache->valueSize(key, keySize, size) ? (size_t)size : 0;
+    }
+
+    std::vector<uint8_t> data;
+    if (!cache->load(key, keySize, data) || valueSize < data.size())
+    {
+        return 0;
+    }
+    std::memcpy(value, data.data(), data.size());
+    return data.size();
+}
+
+
+static void dawnStoreCacheData(void const * key, size_t keySize, void const * value, size_t valueSize, void * userdata)
+{
+    BlobCache* cache = reinterpret_cast<BlobCache*>(userdata);
+    cache->store(key, keySize, value, valueSize);
+}
+
+
+void BlobCache::attachTo(wgpu::DeviceDescriptor& deviceDesc)
+{
+    isolationKey = dir.filename().string();
+
+    dawnCacheDesc.chain.next = deviceDesc.nextInChain;
+    dawnCacheDesc.chain.sType = WGPUSType_DawnCacheDeviceDescriptor;
+    dawnCacheDesc.isolationKey = isolationKey.c_str();
+    dawnCacheDesc.loadDataFunction = dawnLoadCacheData;
+    dawnCacheDesc.storeDataFunction = dawnStoreCacheData;
+    dawnCacheDesc.functionUserdata = this;
+
+    deviceDesc.nextInChain = &dawnCacheDesc.chain;
+}
+
+#endif
+
+
+std::string makeAdapterCacheKey(wgpu::Adapter adapter)
+{
+    wgpu::AdapterProperties props;
+    adapter.getProperties(&props);
+
+#ifdef WEBGPU_BACKEND_DAWN
+    const std::string backendName = "dawn";
+#elif defined(WEBGPU_BACKEND_WGPU)
+    const std::string backendName = "wgpu";
+#endif
+
+    // Driver description and adapter name are free text, hash them to get a valid file name
+    std::string driver = props.driverDescription ? props.driverDescription : "";
+    std::string name = props.name ? props.name : "";
+
+    std::ostringstream ss;
+    ss << backendName << "-" << std::hex
+       << props.vendorID << "-" << props.deviceID << "-" << (uint32_t)props.backendType << "-"
+       << toHex(fnv1a(name, fnv1a(driver)));
+    return ss.str();
+}
+
+
+fs::path defaultCacheRoot()
+{
+    if (const char* env = std::getenv("WEBGPU_DEMO_CACHE_DIR"))
+    {
+        return fs::path(env);
+    }
+
+#ifdef _WIN32
+    const char* base = std::getenv("LOCALAPPDATA");
+    if (base)
+    {
+        return fs::path(base) / "webgpuxxdemo";
+    }
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"))
+    {
+        return fs::path(xdg) / "webgpuxxdemo";
+    }
+    if (const char* home = std::getenv("HOME"))
+    {
+        return fs::path(home) / ".cache" / "webgpuxxdemo";
+    }
+#endif
+
+    return fs::temp_directory_path() / "webgpuxxdemo";
+}
+
+
+uint64_t defaultCacheMaxBytes()
+{
+    constexpr uint64_t defaultMb = 64;
+    constexpr uint64_t maxMb = UINT64_MAX / (1024 * 1024);
+
+    uint64_t mb = defaultMb;
+    if (const char* env = std::getenv("WEBGPU_DEMO_CACHE_MAX_MB"))
+    {
+        // strtoull() takes an empty or malformed value for 0, which would evict every store
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long value = std::strtoull(env, &end, 10);
+        if (env[0] >= '0' && env[0] <= '9' && *end == '\0' && errno == 0 && value > 0 && value <= maxMb)
+        {
+            mb = value;
+        }
+        else
+        {
+            std::cout << "Ignoring WEBGPU_DEMO_CACHE_MAX_MB=\"" << env << "\", expected a positive number of MB; using "
+                      << defaultMb << " MB" << std::endl;
+        }
+    }
+    return mb * 1024 * 1024;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+// Persistent key-value storage for compiled shaders and pipelines.
+// Entries live in <root>/webgpu-demo-cache/v<version>/<adapter key>/, one file per entry.
+// Only that subdirectory is ever cleaned up, the root itself may be any directory the user has chosen.
+// The total size is capped, least recently used entries are evicted first.
+class BlobCache
+{
+public:
+    // Bump it when the entry format or the meaning of the keys changes
+    static constexpr uint32_t version = 1;
+
+    BlobCache(const std::filesystem::path& root, const std::string& adapterKey, uint64_t maxBytes);
+    ~BlobCache();
+
+    // Returns false on a miss
+    bool load(const void* key, size_t keySize, std::vector<uint8_t>& value);
+    // Size of the stored value without reading it; counts a miss, a hit is counted by the load() that follows
+    bool valueSize(const void* key, size_t keySize, uint64_t& size);
+    void store(const void* key, size_t keySize, const void* value, size_t valueSize);
+
+    bool load(const std::string& key, std::vector<uint8_t>& value)
+    {
+        return load(key.data(), key.size(), value);
+    }
+
+    void store(const std::string& key, const void* value, size_t valueSize)
+    {
+        store(key.data(), key.size(), value, valueSize);
+    }
+
+    const std::filesystem::path& directory() const
+    {
+        return dir;
+    }
+
+    void printStats() const;
+
+#ifdef WEBGPU_BACKEND_DAWN
+    // Chains Dawn's blob cache hooks into the device descriptor.
+    // The cache should outlive the device.
+    void attachTo(wgpu::DeviceDescriptor& deviceDesc);
+#endif
+
+private:
+    std::filesystem::path entryPath(const void* key, size_t keySize) const;
+    // Checks the header and the key, then reads the value if it is not null
+    bool readEntry(const std::filesystem::path& path, const void* key, size_t keySize, uint64_t& valueSize,
+                   std::vector<uint8_t>* value) const;
+    // Removes v<N> directories of other versions from the directory the cache owns
+    void removeStaleVersions(const std::filesystem::path& owned);
+    // Evicts oldest entries until the total size fits into the cap
+    void trim();
+
+    std::filesystem::path dir;
+    uint64_t maxBytes;
+    uint64_t totalBytes = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+    uint64_t evictions = 0;
+
+    mutable std::mutex mutex;
+
+#ifdef WEBGPU_BACKEND_DAWN
+    std::string isolationKey;
+    WGPUDawnCacheDeviceDescriptor dawnCacheDesc {};
+#endif
+};
+
+// Identifies an adapter, a driver and a WebGPU implementation;
+// blobs compiled for one key are not valid for another
+std::string makeAdapterCacheKey(wgpu::Adapter adapter);
+
+// Cache location: $WEBGPU_DEMO_CACHE_DIR, or the user cache dir otherwise
+std::filesystem::path defaultCacheRoot();
+// Cache size cap: $WEBGPU_DEMO_CACHE_MAX_MB, 64 MB by default
+uint64_t defaultCacheMaxBytes();
@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <regex>
+#include <stdexcept>
+#include <thread>
+
+#include "compute_runtime.hpp"
+#include "shader_module.hpp"
+
+static constexpr auto compileTimeout = std::chrono::seconds(30);
+// Longest a readback may take before the runtime gives up on its buffer
+static constexpr auto readbackTimeout = std::chrono::seconds(10);
+
+// @group(G) @binding(B) var<space[, access]> name, with the two attributes in either order
+static const char* bindingPattern =
+    R"(@(group|binding)\s*\(\s*(\d+)\s*\)\s*@(group|binding)\s*\(\s*(\d+)\s*\)\s*)"
+    R"(var\s*<\s*(storage|uniform)\s*(?:,\s*(read_write|read)\s*)?>\s*([A-Za-z_]\w*))";
+
+
+void ComputeKernel::bind(const char* bindingName, wgpu::Buffer buffer, uint64_t offset, uint64_t size)
+{
+    for (size_t i = 0; i < bindings.size(); i++)
+    {
+        if (bindings[i].name == bindingName)
+        {
+            entries[i].buffer = buffer;
+            entries[i].offset = offset;
+            entries[i].size = size;
+            return;
+        }
+    }
+    throw std::runtime_error("Kernel " + name + " has no binding " + bindingName);
+}
+
+
+bool ComputeKernel::hasBinding(const char* bindingName) const
+{
+    for (const auto& b : bindings)
+    {
+        if (b.name == bindingName)
+            return true;
+    }
+    return false;
+}
+
+
+ComputeRuntime::ComputeRuntime(wgpu::Device device, wgpu::Queue queue, BlobCache* cache) :
+    device(device),
+    queue(queue),
+    cache(cache),
+    pipelines(device),
+    bindGroups(device)
+{
+    wgpu::SupportedLimits supported;
+    if (device.getLimits(&supported) && supported.limits.maxComputeWorkgroupsPerDimension)
+    {
+        maxWorkgroups = supported.limits.maxComputeWorkgroupsPerDimension;
+        maxStorageBinding = supported.limits.maxStorageBufferBindingSize;
+    }
+
+    for (uint32_t i = 0; i < readbackSlots; i++)
+    {
+        readbacks[i].owner = this;
+        readbacks[i].index = i;
+    }
+}
+
+
+ComputeRuntime::~ComputeRuntime()
+{
+    // Map callbacks point to this object and write to caller memory, let them finish
+    if (!waitIdle(std::chrono::milliseconds(5000)))
+    {
+        std::cout << "Compute runtime: readbacks still running on exit" << std::endl;
+    }
+
+    // Destroying a buffer cancels its pending map, the callback fires before the object is gone
+    for (auto& r : readbacks)
+    {
+        if (r.buffer)
+        {
+            r.buffer.destroy();
+            r.buffer.release();
+        }
+    }
+    for (auto& layout : pipelineLayouts)
+    {
+        layout.release();
+    }
+    for (auto& module : modules)
+    {
+        module.release();
+    }
+}
+
+
+std::unique_ptr<ComputeKernel> ComputeRuntime::createKernel(const char* label, const std::string& wgsl,
+                                                            const char* entryPoint)
+{
+    std::unique_ptr<ComputeKernel> kernel(new ComputeKernel());
+    kernel->name = label;
+
+    const std::regex pattern(bindingPattern);
+    for (auto it = std::sregex_iterator(wgsl.begin(), wgsl.end(), pattern); it != std::sregex_iterator(); ++it)
+    {
+        const std::smatch& m = *it;
+        uint32_t group = (uint32_t)std::stoul(m[1] == "group" ? m[2].str() : m[4].str());
+        uint32_t binding = (uint32_t)std::stoul(m[1] == "binding" ? m[2].str() : m[4].str());
+        if (group != 0)
+        {
+            throw std::runtime_error(std::string("Kernel ") + label + ": only bind group 0 is supported");
+        }
+
+        ComputeKernel::Binding b;
+        b.name = m[7].str();
+        b.binding = binding;
+        if (m[5] == "uniform")
+        {
+            b.type = wgpu::BufferBindingType::Uniform;
+        }
+        else
+        {
+            // Storage is read-only unless declared otherwise
+            b.type = (m[6] == "read_write") ? wgpu::BufferBindingType::Storage
+                                            : wgpu::BufferBindingType::ReadOnlyStorage;
+        }
+        kernel->bindings.push_back(b);
+    }
+
+    std::sort(kernel->bindings.begin(), kernel->bindings.end(),
+              [](const ComputeKernel::Binding& a, const ComputeKernel::Binding& b) { return a.binding < b.binding; });
+
+    std::vector<wgpu::BindGroupLayoutEntry> layoutEntries(kernel->bindings.size());
+    kernel->entries.resize(kernel->bindings.size());
+    for (size_t i = 0; i < kernel->bindings.size(); i++)
+    {
+        wgpu::BindGroupLayoutEntry& entry = layoutEntries[i];
+        entry.setDefault();
+        entry.binding = kernel->bindings[i].binding;
+        entry.visibility = wgpu::ShaderStage::Compute;
+        entry.buffer.type = kernel->bindings[i].type;
+        entry.buffer.hasDynamicOffset = false;
+        entry.buffer.minBindingSize = 0;
+
+        wgpu::BindGroupEntry& bound = kernel->entries[i];
+        bound.binding = kernel->bindings[i].binding;
+        bound.buffer = nullptr;
+        bound.offset = 0;
+        bound.size = WGPU_WHOLE_SIZE;
+    }
+
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+    bindGroupLayoutDesc.label = label;
+    bindGroupLayoutDesc.entryCount = layoutEntries.size();
+    bindGroupLayoutDesc.entries = layoutEntries.data();
+    kernel->bindGroupLayout = bindGroups.getLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = label;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&kernel->bindGroupLayout;
+    wgpu::PipelineLayout pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+    pipelineLayouts.push_back(pipelineLayout);
+
+    wgpu::ShaderModule module = createShaderModule(device, label, wgsl, cache);
+    modules.push_back(module);
+
+    wgpu::ComputePipelineDescriptor pipelineDesc;
+    pipelineDesc.label = label;
+    pipelineDesc.layout = pipelineLayout;
+    pipelineDesc.compute.module = module;
+    pipelineDesc.compute.entryPoint = entryPoint;
+    pipelineDesc.compute.constantCount = 0;
+    pipelineDesc.compute.constants = nullptr;
+
+    // Kernels are loaded up front, there is nothing to do meanwhile but wait
+    kernel->pipeline = pipelines.getComputePipeline(pipelineDesc);
+    if (!kernel->pipeline && pipelines.waitIdle(compileTimeout))
+    {
+        kernel->pipeline = pipelines.getComputePipeline(pipelineDesc);
+    }
+    if (!kernel->pipeline)
+    {
+        throw std::runtime_error(std::string("Could not compile kernel ") + label);
+    }
+
+    return kernel;
+}
+
+
+wgpu::Buffer ComputeRuntime::createBuffer(const char* label, uint64_t size, WGPUBufferUsageFlags extraUsage)
+{
+    wgpu::BufferDescriptor desc;
+    desc.label = label;
+    desc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst | extraUsage;
+    desc.size = std::max<uint64_t>((size + 3) & ~uint64_t(3), 4);
+    desc.mappedAtCreation = false;
+    return device.createBuffer(desc);
+}
+
+
+void ComputeRuntime::destroyBuffer(wgpu::Buffer buffer)
+{
+    // Recorded dispatches may use it; submitted ones keep it alive until they are done
+    submit();
+    bindGroups.invalidate((WGPUBuffer)buffer);
+    buffer.destroy();
+    buffer.release();
+}
+
+
+wgpu::CommandEncoder ComputeRuntime::currentEncoder()
+{
+    if (!encoder)
+    {
+        wgpu::CommandEncoderDescriptor desc;
+        desc.label = "Compute runtime";
+        encoder = device.createCommandEncoder(desc);
+    }
+    return encoder;
+}
+
+
+void ComputeRuntime::write(wgpu::Buffer buffer, uint64_t offset, const void* data, uint64_t size)
+{
+    // queue.writeBuffer() runs before any later submit, the dispatches recorded so far must go first
+    submit();
+    queue.writeBuffer(buffer, offset, data, size);
+}
+
+
+void ComputeRuntime::copy(wgpu::Buffer src, uint64_t srcOffset, wgpu::Buffer dst, uint64_t dstOffset, uint64_t size)
+{
+    currentEncoder().copyBufferToBuffer(src, srcOffset, dst, dstOffset, size);
+}
+
+
+void ComputeRuntime::dispatch(const ComputeKernel& kernel, uint32_t x, uint32_t y, uint32_t z)
+{
+    for (size_t i = 0; i < kernel.entries.size(); i++)
+    {
+        if (!kernel.entries[i].buffer)
+        {
+            throw std::runtime_error("Kernel " + kernel.name + ": " + kernel.bindings[i].name + " is not bound");
+        }
+    }
+    if (x > maxWorkgroups || y > maxWorkgroups || z > maxWorkgroups)
+    {
+        throw std::runtime_error("Kernel " + kernel.name + ": too many workgroups for one dispatch");
+    }
+    if (x == 0 || y == 0 || z == 0)
+        return;
+
+    wgpu::BindGroup bindGroup = bindGroups.get(kernel.bindGroupLayout, kernel.entries.size(),
+                                               kernel.entries.data(), kernel.name.c_str());
+
+    wgpu::ComputePassDescriptor passDesc;
+    passDesc.label = kernel.name.c_str();
+    passDesc.timestampWriteCount = 0;
+    passDesc.timestampWrites = nullptr;
+
+    wgpu::ComputePassEncoder pass = currentEncoder().beginComputePass(passDesc);
+    pass.setPipeline(kernel.pipeline);
+    pass.setBindGroup(0, bindGroup, 0, nullptr);
+    pass.dispatchWorkgroups(x, y, z);
+    pass.end();
+    pass.release();
+
+    nDispatches++;
+}
+
+
+void ComputeRuntime::submit()
+{
+    if (!encoder)
+        return;
+
+    wgpu::CommandBufferDescriptor cmdBufferDescriptor;
+    cmdBufferDescriptor.label = "Compute runtime";
+    WGPUCommandBuffer commandBuffer = encoder.finish(cmdBufferDescriptor);
+    wgpuQueueSubmit(queue, 1, &commandBuffer);
+    wgpuCommandBufferRelease(commandBuffer);
+    encoder.release();
+    encoder = nullptr;
+
+    // The bind groups of the submitted dispatches are not needed by the runtime anymore
+    bindGroups.endFrame();
+    nSubmits++;
+}
+
+
+GpuFuture<bool> ComputeRuntime::readback(wgpu::Buffer buffer, uint64_t offset, uint64_t size, void* dst)
+{
+    if (size == 0 || size % 4 != 0 || offset % 4 != 0)
+    {
+        throw std::runtime_error("Readback size and offset must be non-zero multiples of 4");
+    }
+
+    Readback& r = readbacks[nextReadback];
+    nextReadback = (nextReadback + 1) % readbackSlots;
+
+    if (r.busy)
+    {
+        // Both buffers are on their way back, the caller runs ahead of the GPU
+        nReadbackStalls++;
+        submit();
+        auto start = std::chrono::steady_clock::now();
+        while (r.busy)
+        {
+            if (std::chrono::steady_clock::now() - start > readbackTimeout)
+            {
+                throw std::runtime_error("Timed out waiting for a readback buffer");
+            }
+            processEvents(device);
+            std::this_thread::yield();
+        }
+    }
+
+    if (r.capacity < size)
+    {
+        if (r.buffer)
+        {
+            r.buffer.destroy();
+            r.buffer.release();
+        }
+
+        wgpu::BufferDescriptor desc;
+        desc.label = "Compute readback";
+        desc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        desc.size = size;
+        desc.mappedAtCreation = false;
+        r.buffer = device.createBuffer(desc);
+        r.capacity = size;
+    }
+
+    currentEncoder().copyBufferToBuffer(buffer, offset, r.buffer, 0, size);
+    submit();
+
+    r.busy = true;
+    r.size = size;
+    r.dst = dst;
+    r.state = std::make_shared<GpuFuture<bool>::State>();
+    wgpuBufferMapAsync(r.buffer, wgpu::MapMode::Read, 0, size, mapCallback, &r);
+
+    nReadbacks++;
+    bytesRead += size;
+
+    wgpu::Device d = device;
+    return GpuFuture<bool>(r.state, [d]() { processEvents(d); });
+}
+
+
+void ComputeRuntime::mapCallback(WGPUBufferMapAsyncStatus status, void* userdata)
+{
+    Readback& r = *reinterpret_cast<Readback*>(userdata);
+    r.owner->onMapped(r.index, status);
+}
+
+
+void ComputeRuntime::onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status)
+{
+    Readback& r = readbacks[slot];
+    bool mapped = (status == wgpu::BufferMapAsyncStatus::Success);
+    if (mapped)
+    {
+        const void* data = r.buffer.getConstMappedRange(0, r.size);
+        std::memcpy(r.dst, data, r.size);
+        r.buffer.unmap();
+    }
+
+    // The slot may be reused as soon as it is not busy, the future keeps the state
+    std::shared_ptr<GpuFuture<bool>::State> state = std::move(r.state);
+    r.busy = false;
+    r.dst = nullptr;
+
+    state->value = mapped;
+    state->ready = true;
+}
+
+
+bool ComputeRuntime::waitIdle(std::chrono::milliseconds timeout)
+{
+    submit();
+
+    auto start = std::chrono::steady_clock::now();
+    while (std::any_of(readbacks.begin(), readbacks.end(), [](const Readback& r) { return r.busy; }))
+    {
+        if (std::chrono::steady_clock::now() - start > timeout)
+        {
+            return false;
+        }
+        processEvents(device);
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+
+void ComputeRuntime::printStats() const
+{
+    std::cout << "Compute runtime: " << nDispatches << " dispatches in " << nSubmits << " submits, "
+              << nReadbacks << " readbacks (" << bytesRead << " bytes), " << nReadbackStalls
+              << " waited for a free readback buffer" << std::endl;
+}
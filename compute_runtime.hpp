@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "bind_group_cache.hpp"
+#include "gpu_future.hpp"
+#include "pipeline_cache.hpp"
+
+class BlobCache;
+class ComputeRuntime;
+
+// A WGSL compute entry point with its buffers bound by the names they have in the source.
+// The bindings of group 0 are found in the source itself, e.g.
+//     @group(0) @binding(1) var<storage, read_write> values: array<u32>;
+// is bound by bind("values", buffer). Storage and uniform buffers are supported.
+class ComputeKernel
+{
+public:
+    ComputeKernel(const ComputeKernel&) = delete;
+    ComputeKernel& operator=(const ComputeKernel&) = delete;
+
+    // Throws if the kernel has no such binding. The whole buffer is bound if size is WGPU_WHOLE_SIZE.
+    void bind(const char* name, wgpu::Buffer buffer, uint64_t offset = 0, uint64_t size = WGPU_WHOLE_SIZE);
+    bool hasBinding(const char* name) const;
+
+    const std::string& label() const
+    {
+        return name;
+    }
+
+private:
+    friend class ComputeRuntime;
+
+    struct Binding
+    {
+        std::string name;
+        uint32_t binding = 0;
+        wgpu::BufferBindingType type = wgpu::BufferBindingType::Undefined;
+    };
+
+    ComputeKernel() = default;
+
+    std::string name;
+    std::vector<Binding> bindings;
+    // Same order as bindings, what bind() has set
+    std::vector<wgpu::BindGroupEntry> entries;
+    // Owned by the runtime's caches
+    wgpu::BindGroupLayout bindGroupLayout = nullptr;
+    wgpu::ComputePipeline pipeline = nullptr;
+};
+
+
+// Runs compute kernels on the application's device, for GPGPU work outside of the frame loop.
+// Dispatches are recorded into one command encoder which is submitted when the results are
+// needed: by readback(), by write() and by submit().
+// Readbacks go through a pair of MapRead buffers, so the kernels of the next step can be
+// dispatched while the results of the previous one are still being mapped; a third readback
+// in flight waits for the oldest one to land. The results are copied into caller memory.
+// Not thread-safe.
+class ComputeRuntime
+{
+public:
+    static constexpr uint32_t readbackSlots = 2;
+
+    ComputeRuntime(wgpu::Device device, wgpu::Queue queue, BlobCache* cache);
+    ~ComputeRuntime();
+
+    ComputeRuntime(const ComputeRuntime&) = delete;
+    ComputeRuntime& operator=(const ComputeRuntime&) = delete;
+
+    // Compiles the kernel and waits for it, throws std::runtime_error if it does not compile
+    std::unique_ptr<ComputeKernel> createKernel(const char* label, const std::string& wgsl,
+                                                const char* entryPoint = "main");
+
+    // Storage buffer usable as a copy source and destination; size is rounded up to a multiple of 4
+    wgpu::Buffer createBuffer(const char* label, uint64_t size,
+                              WGPUBufferUsageFlags extraUsage = 0);
+    // Forgets the bind groups using the buffer and frees it
+    void destroyBuffer(wgpu::Buffer buffer);
+
+    // Submits what is recorded so far, then queues the write, so it lands between the dispatches
+    // before and after it. Size and offset must be multiples of 4.
+    void write(wgpu::Buffer buffer, uint64_t offset, const void* data, uint64_t size);
+    // Records a buffer to buffer copy between the dispatches; size and offsets must be multiples of 4
+    void copy(wgpu::Buffer src, uint64_t srcOffset, wgpu::Buffer dst, uint64_t dstOffset, uint64_t size);
+    // Records a dispatch of the kernel with its current bindings; every binding must be bound
+    void dispatch(const ComputeKernel& kernel, uint32_t x, uint32_t y = 1, uint32_t z = 1);
+    // Workgroups covering n items
+    static uint32_t groupCount(uint64_t n, uint32_t workgroupSize)
+    {
+        return (uint32_t)((n + workgroupSize - 1) / workgroupSize);
+    }
+
+    // Submits the dispatches recorded so far and copies size bytes of the buffer into dst once the GPU
+    // has written them. dst must stay valid until the future is ready; the value is false if mapping failed.
+    // Size and offset must be multiples of 4.
+    GpuFuture<bool> readback(wgpu::Buffer buffer, uint64_t offset, uint64_t size, void* dst);
+    void submit();
+    // Waits for all readbacks in flight
+    bool waitIdle(std::chrono::milliseconds timeout);
+
+    wgpu::Device getDevice() const
+    {
+        return device;
+    }
+
+    uint32_t maxWorkgroupsPerDimension() const
+    {
+        return maxWorkgroups;
+    }
+
+    // Largest storage buffer a kernel can bind
+    uint64_t maxStorageBindingSize() const
+    {
+        return maxStorageBinding;
+    }
+
+    // Dispatch, submit and readback counts, readbacks that had to wait for a free buffer
+    void printStats() const;
+
+private:
+    struct Readback
+    {
+        // Map callback userdata, the C API is used so that no callback object is allocated
+        ComputeRuntime* owner = nullptr;
+        uint32_t index = 0;
+        wgpu::Buffer buffer = nullptr;
+        uint64_t capacity = 0;
+        uint64_t size = 0;
+        void* dst = nullptr;
+        bool busy = false;
+        std::shared_ptr<GpuFuture<bool>::State> state;
+    };
+
+    wgpu::CommandEncoder currentEncoder();
+    static void mapCallback(WGPUBufferMapAsyncStatus status, void* userdata);
+    void onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status);
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    BlobCache* cache;
+    PipelineCache pipelines;
+    BindGroupCache bindGroups;
+    uint32_t maxWorkgroups = 65535;
+    uint64_t maxStorageBinding = 128 << 20;
+
+    // Null when nothing is recorded
+    wgpu::CommandEncoder encoder = nullptr;
+    std::array<Readback, readbackSlots> readbacks;
+    uint32_t nextReadback = 0;
+
+    // Kernels keep pointing to them, they are released with the runtime
+    std::vector<wgpu::ShaderModule> modules;
+    std::vector<wgpu::PipelineLayout> pipelineLayouts;
+
+    uint64_t nDispatches = 0;
+    uint64_t nSubmits = 0;
+    uint64_t nReadbacks = 0;
+    uint64_t nReadbackStalls = 0;
+    uint64_t bytesRead = 0;
+};
@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "compute_runtime.hpp"
+#include "compute_selftest.hpp"
+#include "gpu_primitives.hpp"
+#include "gpu_radix_sort.hpp"
+
+static const char* scaleShaderSource = R"(
+struct Params
+{
+    scale : f32,
+    count : u32,
+};
+
+@group(0) @binding(0) var<uniform> params : Params;
+@group(0) @binding(1) var<storage, read> input : array<f32>;
+@group(0) @binding(2) var<storage, read_write> output : array<f32>;
+
+@compute @workgroup_size(64)
+fn main(@builtin(global_invocation_id) id : vec3<u32>)
+{
+    let i = id.x;
+    if (i >= params.count)
+    {
+        return;
+    }
+    output[i] = params.scale * input[i] + f32(i);
+}
+)";
+
+static constexpr auto resultTimeout = std::chrono::seconds(10);
+
+
+static float inputValue(uint32_t i)
+{
+    return (float)(i % 1000) * 0.001f;
+}
+
+
+static float scaleOf(uint32_t step)
+{
+    return (float)(step + 1);
+}
+
+
+// Returns the number of wrong values
+static uint32_t checkScale(const std::vector<float>& result, uint32_t step)
+{
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < (uint32_t)result.size(); i++)
+    {
+        float expected = scaleOf(step) * inputValue(i) + (float)i;
+        // The GPU may fuse the multiply and the add
+        if (std::fabs(result[i] - expected) > 1e-5f * std::fabs(expected) + 1e-5f)
+        {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+
+// Dispatches a step while the result of the previous one is mapped, so the readbacks overlap the kernels
+static bool testScale(ComputeRuntime& runtime)
+{
+    struct Params
+    {
+        float scale;
+        uint32_t count;
+    };
+
+    constexpr uint32_t count = 1 << 20;
+    constexpr uint32_t steps = 16;
+    constexpr uint32_t workgroupSize = 64;
+
+    auto kernel = runtime.createKernel("Scale", scaleShaderSource);
+
+    std::vector<float> input(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        input[i] = inputValue(i);
+    }
+
+    wgpu::Buffer params = runtime.createBuffer("Scale params", sizeof(Params), wgpu::BufferUsage::Uniform);
+    wgpu::Buffer inputBuffer = runtime.createBuffer("Scale input", count * sizeof(float));
+    wgpu::Buffer outputBuffer = runtime.createBuffer("Scale output", count * sizeof(float));
+    runtime.write(inputBuffer, 0, input.data(), count * sizeof(float));
+
+    kernel->bind("params", params);
+    kernel->bind("input", inputBuffer);
+    kernel->bind("output", outputBuffer);
+
+    // One result per readback buffer
+    std::vector<float> results[ComputeRuntime::readbackSlots];
+    GpuFuture<bool> futures[ComputeRuntime::readbackSlots];
+    for (auto& r : results)
+    {
+        r.resize(count);
+    }
+
+    uint32_t errors = 0;
+    auto collect = [&](uint32_t step)
+    {
+        uint32_t slot = step % ComputeRuntime::readbackSlots;
+        if (!futures[slot].get(resultTimeout))
+        {
+            std::cout << " step " << step << ": readback failed" << std::endl;
+            errors++;
+            return;
+        }
+        errors += checkScale(results[slot], step);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        uint32_t slot = step % ComputeRuntime::readbackSlots;
+        if (futures[slot].valid())
+        {
+            collect(step - ComputeRuntime::readbackSlots);
+        }
+
+        Params p = { scaleOf(step), count };
+        runtime.write(params, 0, &p, sizeof(p));
+        runtime.dispatch(*kernel, ComputeRuntime::groupCount(count, workgroupSize));
+        futures[slot] = runtime.readback(outputBuffer, 0, count * sizeof(float), results[slot].data());
+    }
+    for (uint32_t step = steps - ComputeRuntime::readbackSlots; step < steps; step++)
+    {
+        collect(step);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << " scale, " << count << " floats x " << steps << " steps: " << std::fixed << std::setprecision(3)
+              << ms << " ms, " << std::setprecision(2) << (double)count * sizeof(float) * steps / ms * 1e-6
+              << " GB/s read back" << std::defaultfloat;
+    if (errors)
+    {
+        std::cout << ", " << errors << " wrong values";
+    }
+    std::cout << std::endl;
+
+    runtime.destroyBuffer(outputBuffer);
+    runtime.destroyBuffer(inputBuffer);
+    runtime.destroyBuffer(params);
+    return errors == 0;
+}
+
+
+template<typename T>
+static std::vector<T> download(ComputeRuntime& runtime, wgpu::Buffer buffer, uint32_t count)
+{
+    std::vector<T> values(count);
+    if (count && !runtime.readback(buffer, 0, count * sizeof(T), values.data()).get(resultTimeout))
+    {
+        throw std::runtime_error("Readback failed");
+    }
+    return values;
+}
+
+
+static uint32_t testHash(uint32_t i)
+{
+    uint32_t h = i * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+
+// Floats are small integers, so that sums are exact in any order and can be compared with ==
+template<typename T>
+static std::vector<T> testValues(uint32_t count)
+{
+    std::vector<T> values(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            values[i] = (float)(testHash(i) & 15);
+        }
+        else
+        {
+            values[i] = testHash(i);
+        }
+    }
+    return values;
+}
+
+
+static std::vector<uint32_t> testFlags(uint32_t count)
+{
+    std::vector<uint32_t> flags(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // Any non-zero value counts
+        flags[i] = (testHash(i + 12345) >> 7) % 3 == 0 ? testHash(i) | 1 : 0;
+    }
+    return flags;
+}
+
+
+// Returns the number of primitives whose results differ from the CPU references
+template<typename T>
+static uint32_t checkPrimitives(ComputeRuntime& runtime, GpuPrimitives& primitives, GpuPrimitives::Type type,
+                                uint32_t count)
+{
+    const char* name = (type == GpuPrimitives::Type::U32) ? "u32" : "f32";
+    std::vector<T> values = testValues<T>(count);
+    std::vector<uint32_t> flags = testFlags(count);
+
+    wgpu::Buffer input = runtime.createBuffer("Test input", count * sizeof(T));
+    wgpu::Buffer output = runtime.createBuffer("Test output", count * sizeof(T));
+    wgpu::Buffer flagBuffer = runtime.createBuffer("Test flags", count * sizeof(uint32_t));
+    wgpu::Buffer result = runtime.createBuffer("Test result", sizeof(uint32_t));
+    if (count)
+    {
+        runtime.write(input, 0, values.data(), count * sizeof(T));
+        runtime.write(flagBuffer, 0, flags.data(), count * sizeof(uint32_t));
+    }
+
+    uint32_t failures = 0;
+    auto report = [&](const char* what, bool ok)
+    {
+        if (!ok)
+        {
+            std::cout << " " << what << " " << name << ", " << count << " elements: wrong result" << std::endl;
+            failures++;
+        }
+    };
+
+    const GpuPrimitives::ReduceOp ops[] = { GpuPrimitives::ReduceOp::Sum, GpuPrimitives::ReduceOp::Min,
+                                            GpuPrimitives::ReduceOp::Max };
+    const char* opNames[] = { "reduce sum", "reduce min", "reduce max" };
+    for (int i = 0; i < 3; i++)
+    {
+        primitives.reduce(type, ops[i], input, count, result);
+        report(opNames[i], download<T>(runtime, result, 1)[0] == referenceReduce(values, ops[i]));
+    }
+
+    for (bool inclusive : { false, true })
+    {
+        primitives.scan(type, input, output, count, inclusive);
+        report(inclusive ? "inclusive scan" : "exclusive scan",
+               download<T>(runtime, output, count) == referenceScan(values, inclusive));
+    }
+
+    primitives.compact(type, input, flagBuffer, count, output, result);
+    uint32_t kept = download<uint32_t>(runtime, result, 1)[0];
+    std::vector<T> expected = referenceCompact(values, flags);
+    report("compaction", kept == expected.size() && download<T>(runtime, output, kept) == expected);
+
+    runtime.destroyBuffer(result);
+    runtime.destroyBuffer(flagBuffer);
+    runtime.destroyBuffer(output);
+    runtime.destroyBuffer(input);
+    return failures;
+}
+
+
+// Average milliseconds of a primitive, once the kernels are compiled
+template<typename F>
+static double timePrimitive(ComputeRuntime& runtime, wgpu::Buffer fence, uint32_t iterations, F&& run)
+{
+    // Reading anything back waits for all the work submitted before it
+    uint32_t unused = 0;
+    run();
+    runtime.readback(fence, 0, sizeof(unused), &unused).get(resultTimeout);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        run();
+    }
+    runtime.readback(fence, 0, sizeof(unused), &unused).get(resultTimeout);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+
+// Checks the primitives on sizes around the block and level boundaries, then measures their throughput
+static bool testPrimitives(ComputeRuntime& runtime, GpuPrimitives& primitives)
+{
+    uint32_t failures = 0;
+    const uint32_t counts[] = { 0, 1, 1000, GpuPrimitives::blockSize, GpuPrimitives::blockSize + 1,
+                                GpuPrimitives::blockSize * GpuPrimitives::blockSize + 3, (1 << 21) + 17 };
+    for (uint32_t count : counts)
+    {
+        failures += checkPrimitives<uint32_t>(runtime, primitives, GpuPrimitives::Type::U32, count);
+        failures += checkPrimitives<float>(runtime, primitives, GpuPrimitives::Type::F32, count);
+    }
+    std::cout << " primitives: " << std::size(counts) << " sizes checked";
+    if (failures)
+    {
+        std::cout << ", " << failures << " wrong";
+    }
+    std::cout << std::endl;
+
+    constexpr uint32_t count = 1 << 22;
+    constexpr uint32_t iterations = 20;
+    std::vector<uint32_t> values = testValues<uint32_t>(count);
+    std::vector<uint32_t> flags = testFlags(count);
+    wgpu::Buffer input = runtime.createBuffer("Benchmark input", count * sizeof(uint32_t));
+    wgpu::Buffer output = runtime.createBuffer("Benchmark output", count * sizeof(uint32_t));
+    wgpu::Buffer flagBuffer = runtime.createBuffer("Benchmark flags", count * sizeof(uint32_t));
+    wgpu::Buffer result = runtime.createBuffer("Benchmark result", sizeof(uint32_t));
+    runtime.write(input, 0, values.data(), count * sizeof(uint32_t));
+    runtime.write(flagBuffer, 0, flags.data(), count * sizeof(uint32_t));
+
+    auto print = [](const char* what, double ms)
+    {
+        // Throughput in input elements, 4 bytes each
+        std::cout << " " << std::left << std::setw(16) << what << std::right << std::fixed << std::setprecision(3)
+                  << ms << " ms, " << std::setprecision(2) << (double)count * sizeof(uint32_t) / ms * 1e-6
+                  << " GB/s" << std::defaultfloat << std::endl;
+    };
+
+    std::cout << " " << count << " u32 elements, average of " << iterations << " runs:" << std::endl;
+    print("reduce sum", timePrimitive(runtime, result, iterations, [&]()
+    {
+        primitives.reduce(GpuPrimitives::Type::U32, GpuPrimitives::ReduceOp::Sum, input, count, result);
+    }));
+    print("exclusive scan", timePrimitive(runtime, result, iterations, [&]()
+    {
+        primitives.scan(GpuPrimitives::Type::U32, input, output, count, false);
+    }));
+    print("compaction", timePrimitive(runtime, result, iterations, [&]()
+    {
+        primitives.compact(GpuPrimitives::Type::U32, input, flagBuffer, count, output, result);
+    }));
+
+    runtime.destroyBuffer(result);
+    runtime.destroyBuffer(flagBuffer);
+    runtime.destroyBuffer(output);
+    runtime.destroyBuffer(input);
+    return failures == 0;
+}
+
+
+// Positions of the keys after a stable sort by their lowest keyBits bits
+static std::vector<uint32_t> referenceOrder(const std::vector<uint32_t>& keys, uint32_t keyBits, bool descending)
+{
+    uint32_t mask = keyBits >= 32 ? ~0u : (1u << keyBits) - 1;
+    std::vector<uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        uint32_t ka = keys[a] & mask;
+        uint32_t kb = keys[b] & mask;
+        return descending ? ka > kb : ka < kb;
+    });
+    return order;
+}
+
+
+// Keys alone are compared with std::sort; pairs carry their index, so that stability is checked too
+static bool checkRadixSort(ComputeRuntime& runtime, GpuRadixSort& sorter, uint32_t count, bool withValues,
+                           uint32_t keyBits, bool descending)
+{
+    std::vector<uint32_t> keys = testValues<uint32_t>(count);
+    std::vector<uint32_t> values(count);
+    std::iota(values.begin(), values.end(), 0u);
+
+    wgpu::Buffer keyBuffer = runtime.createBuffer("Test keys", count * sizeof(uint32_t));
+    wgpu::Buffer valueBuffer = runtime.createBuffer("Test values", count * sizeof(uint32_t));
+    if (count)
+    {
+        runtime.write(keyBuffer, 0, keys.data(), count * sizeof(uint32_t));
+        runtime.write(valueBuffer, 0, values.data(), count * sizeof(uint32_t));
+    }
+
+    sorter.sort(keyBuffer, withValues ? valueBuffer : nullptr, count, keyBits, descending);
+    std::vector<uint32_t> sortedKeys = download<uint32_t>(runtime, keyBuffer, count);
+    std::vector<uint32_t> sortedValues = download<uint32_t>(runtime, valueBuffer, count);
+
+    bool ok = true;
+    if (!withValues && keyBits == 32 && !descending)
+    {
+        std::vector<uint32_t> expected = keys;
+        std::sort(expected.begin(), expected.end());
+        ok = (sortedKeys == expected);
+    }
+    else
+    {
+        std::vector<uint32_t> order = referenceOrder(keys, keyBits, descending);
+        for (uint32_t i = 0; i < count && ok; i++)
+        {
+            ok = (sortedKeys[i] == keys[order[i]]) && (!withValues || sortedValues[i] == order[i]);
+        }
+    }
+
+    if (!ok)
+    {
+        std::cout << " radix sort of " << count << (withValues ? " pairs, " : " keys, ") << keyBits << " bits"
+                  << (descending ? " descending" : "") << ": wrong order" << std::endl;
+    }
+
+    runtime.destroyBuffer(valueBuffer);
+    runtime.destroyBuffer(keyBuffer);
+    return ok;
+}
+
+
+// Checks the sort against the CPU, then measures it on 1M to 64M keys
+static bool testRadixSort(ComputeRuntime& runtime, GpuPrimitives& primitives)
+{
+    GpuRadixSort sorter(runtime, primitives);
+
+    uint32_t failures = 0;
+    const uint32_t counts[] = { 0, 1, 2, 1000, GpuRadixSort::blockSize + 1, (1 << 20) + 7 };
+    for (uint32_t count : counts)
+    {
+        failures += checkRadixSort(runtime, sorter, count, false, 32, false) ? 0 : 1;
+        failures += checkRadixSort(runtime, sorter, count, true, 32, false) ? 0 : 1;
+        // An odd number of passes, and many equal keys
+        failures += checkRadixSort(runtime, sorter, count, true, 12, true) ? 0 : 1;
+    }
+    std::cout << " radix sort: " << std::size(counts) << " sizes checked";
+    if (failures)
+    {
+        std::cout << ", " << failures << " wrong";
+    }
+    std::cout << std::endl;
+
+    constexpr uint32_t iterations = 3;
+    std::cout << " radix sort, average of " << iterations << " runs, each with a copy of the input:" << std::endl;
+    for (uint32_t count = 1 << 20; count <= (1 << 26); count <<= 2)
+    {
+        uint64_t bytes = (uint64_t)count * sizeof(uint32_t);
+        if (bytes > runtime.maxStorageBindingSize())
+        {
+            std::cout << " " << std::setw(9) << count << " keys: over the adapter's storage binding size, skipped"
+                      << std::endl;
+            continue;
+        }
+
+        std::vector<uint32_t> keys = testValues<uint32_t>(count);
+        wgpu::Buffer original = runtime.createBuffer("Benchmark keys", bytes);
+        wgpu::Buffer keyBuffer = runtime.createBuffer("Benchmark sorted keys", bytes);
+        wgpu::Buffer valueBuffer = runtime.createBuffer("Benchmark values", bytes);
+        runtime.write(original, 0, keys.data(), bytes);
+
+        double keysMs = timePrimitive(runtime, keyBuffer, iterations, [&]()
+        {
+            runtime.copy(original, 0, keyBuffer, 0, bytes);
+            sorter.sort(keyBuffer, nullptr, count);
+        });
+        double pairsMs = timePrimitive(runtime, keyBuffer, iterations, [&]()
+        {
+            runtime.copy(original, 0, keyBuffer, 0, bytes);
+            sorter.sort(keyBuffer, valueBuffer, count);
+        });
+
+        std::cout << " " << std::setw(9) << count << " keys: " << std::fixed << std::setprecision(3) << keysMs
+                  << " ms, " << std::setprecision(1) << count / keysMs * 1e-3 << " Mkeys/s; pairs: "
+                  << std::setprecision(3) << pairsMs << " ms, " << std::setprecision(1)
+                  << count / pairsMs * 1e-3 << " Mkeys/s" << std::defaultfloat << std::endl;
+
+        runtime.destroyBuffer(valueBuffer);
+        runtime.destroyBuffer(keyBuffer);
+        runtime.destroyBuffer(original);
+    }
+
+    return failures == 0;
+}
+
+
+bool runComputeSelfTest(wgpu::Device device, wgpu::Queue queue, BlobCache* cache)
+{
+    std::cout << "Compute self-test:" << std::endl;
+
+    bool passed = true;
+    try
+    {
+        ComputeRuntime runtime(device, queue, cache);
+        passed = testScale(runtime) && passed;
+        GpuPrimitives primitives(runtime);
+        passed = testPrimitives(runtime, primitives) && passed;
+        passed = testRadixSort(runtime, primitives) && passed;
+        runtime.printStats();
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << " " << e.what() << std::endl;
+        passed = false;
+    }
+
+    std::cout << "Compute self-test " << (passed ? "passed" : "FAILED") << std::endl;
+    return passed;
+}
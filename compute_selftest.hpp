@@ -0,0 +1,9 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+class BlobCache;
+
+// Runs kernels of the compute runtime on the device and checks their results against the CPU.
+// Needs no window or surface, so it runs on the fallback adapter too. Returns false on a mismatch.
+bool runComputeSelfTest(wgpu::Device device, wgpu::Queue queue, BlobCache* cache);
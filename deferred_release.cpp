@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <iostream>
+
+#include "deferred_release.hpp"
+
+
+DeferredRelease::~DeferredRelease()
+{
+    flush();
+}
+
+
+void DeferredRelease::releaseBatch(Batch& batch)
+{
+    for (const Entry& e : batch.entries)
+    {
+        e.release(e.handle);
+    }
+    released += batch.entries.size();
+    batch.entries.clear();
+    batch.submitted = false;
+}
+
+
+void DeferredRelease::endFrame(uint64_t serial)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t total = 0;
+    for (const Batch& b : batches)
+    {
+        total += b.entries.size();
+    }
+    maxPending = std::max(maxPending, total);
+
+    Batch& batch = batches[current];
+    if (batch.entries.empty())
+        return;
+
+    batch.serial = serial;
+    batch.submitted = true;
+
+    // If the next batch is still waiting for the GPU, the frames were not bounded by FramesInFlight.
+    // This batch then stays current and is tagged again with the next frame: freeing later is always safe.
+    size_t next = (current + 1) % batches.size();
+    if (batches[next].submitted)
+    {
+        batch.submitted = false;
+        return;
+    }
+    current = next;
+}
+
+
+void DeferredRelease::collect(uint64_t completedSerial)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Batch& b : batches)
+    {
+        if (b.submitted && b.serial <= completedSerial)
+        {
+            releaseBatch(b);
+        }
+    }
+}
+
+
+void DeferredRelease::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Batch& b : batches)
+    {
+        releaseBatch(b);
+    }
+}
+
+
+size_t DeferredRelease::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t total = 0;
+    for (const Batch& b : batches)
+    {
+        total += b.entries.size();
+    }
+    return total;
+}
+
+
+void DeferredRelease::printStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "Deferred release: " << released << " handles released, at most " << maxPending
+              << " pending at once" << std::endl;
+}
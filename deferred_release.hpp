@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "frames_in_flight.hpp"
+#include "gpu_handle.hpp"
+
+// Releases handles only after the GPU has finished the frame that may still use them.
+// Handles released during a frame are collected into one batch which is tagged with the frame's
+// submission serial in endFrame(); collect() frees whole batches once FramesInFlight reports them
+// completed through onSubmittedWorkDone. Batches keep their capacity, so a warm frame does not allocate.
+// release() may be called from encoding threads.
+class DeferredRelease
+{
+public:
+    DeferredRelease() = default;
+    // Frees everything left, call only when the GPU is idle
+    ~DeferredRelease();
+
+    DeferredRelease(const DeferredRelease&) = delete;
+    DeferredRelease& operator=(const DeferredRelease&) = delete;
+
+    // Any wgpu handle: buffer, texture, view, encoder, command buffer, bind group, etc.
+    template<typename Handle>
+    void release(Handle handle)
+    {
+        if (!handle)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        batches[current].entries.push_back({ (void*)(typename Handle::W)handle, &releaseHandle<Handle> });
+    }
+
+    // The handle is counted as live until its batch is freed
+    template<typename Handle>
+    void release(Owned<Handle>&& owned)
+    {
+        Handle handle = owned.detach();
+        if (!handle)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        batches[current].entries.push_back({ (void*)(typename Handle::W)handle, &releaseOwnedHandle<Handle> });
+    }
+
+    // Tags the current batch with the serial of the frame being submitted, call right after the submit
+    // and before FramesInFlight::endFrame()
+    void endFrame(uint64_t serial);
+    // Frees the batches of frames up to completedSerial, e.g. FramesInFlight::completedSerial()
+    void collect(uint64_t completedSerial);
+    // Frees everything at once, call only when the GPU is idle
+    void flush();
+
+    // Handles waiting for their frame to complete
+    size_t pending() const;
+
+    // Number of handles freed and the largest backlog seen
+    void printStats() const;
+
+private:
+    struct Entry
+    {
+        void* handle;
+        void (*release)(void*);
+    };
+
+    struct Batch
+    {
+        uint64_t serial = 0;
+        bool submitted = false;
+        std::vector<Entry> entries;
+    };
+
+    template<typename Handle>
+    static void releaseHandle(void* raw)
+    {
+        Handle((typename Handle::W)raw).release();
+    }
+
+    template<typename Handle>
+    static void releaseOwnedHandle(void* raw)
+    {
+        releaseHandle<Handle>(raw);
+        untrackHandle<Handle>();
+    }
+
+    void releaseBatch(Batch& batch);
+
+    mutable std::mutex mutex;
+    // One batch per frame in flight and one for the frame being recorded
+    std::array<Batch, FramesInFlight::maxSlots + 1> batches;
+    size_t current = 0;
+
+    uint64_t released = 0;
+    size_t maxPending = 0;
+};
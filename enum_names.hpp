@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+// Name tables for WebGPU enums, plain constant arrays so that looking a name up never allocates
+template<typename E>
+struct EnumName
+{
+    E value;
+    const char* name;
+};
+
+// Returns nullptr for values missing from the table
+template<typename E, size_t N, typename V>
+constexpr const char* enumName(const EnumName<E> (&table)[N], V value)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        if (table[i].value == static_cast<E>(value))
+            return table[i].name;
+    }
+    return nullptr;
+}
+
+// Writes the name, or the numeric value if the table has no such entry
+template<typename E, size_t N, typename V>
+void writeEnumName(std::ostream& out, const EnumName<E> (&table)[N], V value)
+{
+    const char* name = enumName(table, value);
+    if (name)
+    {
+        out << name;
+    }
+    else
+    {
+        out << static_cast<long long>(static_cast<E>(value));
+    }
+}
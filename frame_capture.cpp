@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <stb_image_write.h>
+
+#include "frame_capture.hpp"
+#include "gpu_future.hpp"
+
+// copyTextureToBuffer() needs rows aligned to this
+static constexpr uint32_t rowAlignment = 256;
+
+
+static bool isCapturable(wgpu::TextureFormat format, bool& bgra)
+{
+    switch (format)
+    {
+    case wgpu::TextureFormat::BGRA8Unorm:
+    case wgpu::TextureFormat::BGRA8UnormSrgb:
+        bgra = true;
+        return true;
+    case wgpu::TextureFormat::RGBA8Unorm:
+    case wgpu::TextureFormat::RGBA8UnormSrgb:
+        bgra = false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+FrameCapture::FrameCapture(wgpu::Device device, std::filesystem::path directory) :
+    device(device),
+    directory(std::move(directory))
+{
+    for (uint32_t i = 0; i < readbackRingSize; i++)
+    {
+        ring[i].owner = this;
+        ring[i].index = i;
+    }
+
+    writer = std::thread([this]() { writerLoop(); });
+}
+
+
+FrameCapture::~FrameCapture()
+{
+    // Map callbacks point to this object, let them finish
+    auto start = std::chrono::steady_clock::now();
+    auto mapping = [this]()
+    {
+        return std::any_of(ring.begin(), ring.end(),
+                           [](const Readback& r) { return r.state == ReadbackState::Mapping; });
+    };
+    while (mapping() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        processEvents(device);
+        std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    // Destroying a buffer cancels its pending map, the callback fires before the object is gone
+    for (auto& r : ring)
+    {
+        if (r.buffer)
+        {
+            r.buffer.destroy();
+            r.buffer.release();
+        }
+    }
+}
+
+
+void FrameCapture::captureFrames(std::vector<uint64_t> indices)
+{
+    frames = std::move(indices);
+    std::sort(frames.begin(), frames.end());
+}
+
+
+bool FrameCapture::wants(uint64_t frame) const
+{
+    return requested || (every && frame % every == 0) || std::binary_search(frames.begin(), frames.end(), frame);
+}
+
+
+void FrameCapture::setImageHandler(ImageHandler imageHandler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    handler = std::move(imageHandler);
+}
+
+
+bool FrameCapture::idle() const
+{
+    bool busy = std::any_of(ring.begin(), ring.end(), [](const Readback& r) { return r.state != ReadbackState::Free; });
+    std::lock_guard<std::mutex> lock(mutex);
+    return !busy && queue.empty() && !writing;
+}
+
+
+bool FrameCapture::capture(wgpu::CommandEncoder encoder, wgpu::Texture texture, wgpu::TextureFormat format,
+                           uint32_t width, uint32_t height, uint64_t frame)
+{
+    requested = false;
+
+    bool bgra = false;
+    if (!texture || !isCapturable(format, bgra))
+    {
+        if (nUnsupported++ == 0)
+        {
+            std::cout << "Frame capture: this render target cannot be captured, "
+                         "it needs a copyable 8-bit RGBA or BGRA texture" << std::endl;
+        }
+        return false;
+    }
+
+    auto it = std::find_if(ring.begin(), ring.end(), [](const Readback& r) { return r.state == ReadbackState::Free; });
+    if (it == ring.end())
+    {
+        nSkipped++;
+        return false;
+    }
+    Readback& r = *it;
+
+    r.width = width;
+    r.height = height;
+    r.bytesPerRow = (width * 4 + rowAlignment - 1) / rowAlignment * rowAlignment;
+    r.bgra = bgra;
+    r.frame = frame;
+
+    uint64_t size = (uint64_t)r.bytesPerRow * height;
+    if (r.capacity < size)
+    {
+        if (r.buffer)
+        {
+            r.buffer.destroy();
+            r.buffer.release();
+        }
+
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Frame capture readback";
+        bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        bufferDesc.size = size;
+        bufferDesc.mappedAtCreation = false;
+        r.buffer = device.createBuffer(bufferDesc);
+        r.capacity = size;
+    }
+
+    wgpu::ImageCopyTexture src;
+    src.texture = texture;
+    src.mipLevel = 0;
+    src.origin = { 0, 0, 0 };
+    src.aspect = wgpu::TextureAspect::All;
+
+    wgpu::ImageCopyBuffer dst;
+    dst.buffer = r.buffer;
+    dst.layout.offset = 0;
+    dst.layout.bytesPerRow = r.bytesPerRow;
+    dst.layout.rowsPerImage = height;
+    encoder.copyTextureToBuffer(src, dst, { width, height, 1 });
+
+    r.state = ReadbackState::Copied;
+    nCaptured++;
+    return true;
+}
+
+
+void FrameCapture::endFrame()
+{
+    for (auto& r : ring)
+    {
+        if (r.state == ReadbackState::Copied)
+        {
+            r.state = ReadbackState::Mapping;
+            wgpuBufferMapAsync(r.buffer, wgpu::MapMode::Read, 0, (uint64_t)r.bytesPerRow * r.height,
+                               mapCallback, &r);
+        }
+    }
+}
+
+
+void FrameCapture::mapCallback(WGPUBufferMapAsyncStatus status, void* userdata)
+{
+    Readback& r = *reinterpret_cast<Readback*>(userdata);
+    r.owner->onMapped(r.index, status);
+}
+
+
+void FrameCapture::onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status)
+{
+    Readback& r = ring[slot];
+    if (status == wgpu::BufferMapAsyncStatus::Success)
+    {
+        Image image;
+        image.frame = r.frame;
+        image.width = r.width;
+        image.height = r.height;
+        image.bgra = r.bgra;
+        image.pixels.resize((size_t)r.width * 4 * r.height);
+
+        // Only the padding is dropped here, the rest of the work is the writer's
+        uint64_t size = (uint64_t)r.bytesPerRow * r.height;
+        const uint8_t* data = static_cast<const uint8_t*>(r.buffer.getConstMappedRange(0, size));
+        size_t rowBytes = (size_t)r.width * 4;
+        for (uint32_t y = 0; y < r.height; y++)
+        {
+            std::memcpy(image.pixels.data() + y * rowBytes, data + (size_t)y * r.bytesPerRow, rowBytes);
+        }
+        r.buffer.unmap();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(image));
+        }
+        wake.notify_one();
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nFailed++;
+    }
+
+    r.state = ReadbackState::Free;
+}
+
+
+void FrameCapture::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+        // Whatever is queued is written before stopping
+        if (queue.empty())
+            break;
+
+        Image image = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+        bool handled = (bool)handler;
+        lock.unlock();
+
+        // Created with the first file, a run which captures nothing leaves no directory behind
+        if (!directoryCreated)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            if (error)
+            {
+                std::cout << "Frame capture: cannot create " << directory << ": " << error.message() << std::endl;
+            }
+            directoryCreated = true;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint8_t* p = image.pixels.data();
+        for (size_t i = 0; i < (size_t)image.width * image.height; i++, p += 4)
+        {
+            if (image.bgra)
+            {
+                std::swap(p[0], p[2]);
+            }
+            // What was presented is opaque, whatever the passes have left in alpha
+            p[3] = 255;
+        }
+        image.bgra = false;
+
+        if (handled)
+        {
+            // Not changed once captures have started, so it is safe to call without the lock
+            handler(image);
+            lock.lock();
+            writing = false;
+            nWritten++;
+            continue;
+        }
+
+        std::ostringstream name;
+        name << "frame_" << std::setw(6) << std::setfill('0') << image.frame << ".png";
+        std::string path = (directory / name.str()).string();
+        bool written = stbi_write_png(path.c_str(), (int)image.width, (int)image.height, 4,
+                                      image.pixels.data(), (int)image.width * 4) != 0;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        writing = false;
+        if (written)
+        {
+            nWritten++;
+            encodeMs.add(ms);
+        }
+        else
+        {
+            nFailed++;
+            std::cout << "Frame capture: could not write " << path << std::endl;
+        }
+    }
+}
+
+
+void FrameCapture::printStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!nCaptured && !nSkipped && !nUnsupported)
+        return;
+
+    std::cout << "Frame capture: " << nWritten << " frames written to " << directory.string() << ", " << nSkipped
+              << " skipped with no free readback buffer";
+    if (nFailed)
+    {
+        std::cout << ", " << nFailed << " failed";
+    }
+    if (nUnsupported)
+    {
+        std::cout << ", " << nUnsupported << " not capturable";
+    }
+    std::cout << std::endl;
+
+    if (!encodeMs.empty())
+    {
+        std::cout << " PNG encoding, ms (min / avg / max): " << std::fixed << std::setprecision(3) << encodeMs.min()
+                  << " / " << encodeMs.avg() << " / " << encodeMs.max() << std::defaultfloat << std::endl;
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "sliding_stats.hpp"
+
+// Writes rendered frames to PNG files without stalling the frame loop.
+// The texture is copied into a MapRead buffer by the frame's last encoder, with rows padded to
+// the 256 bytes copyTextureToBuffer() needs; after the submit the buffer is mapped asynchronously,
+// the map callback takes the rows out and a writer thread swizzles BGRA to RGBA and encodes the PNG.
+// A frame which finds every buffer still on its way back is not captured rather than waited for.
+// 8-bit RGBA and BGRA formats are supported, sRGB or not.
+class FrameCapture
+{
+public:
+    static constexpr uint32_t readbackRingSize = 3;
+
+    // A captured frame, rows are tightly packed
+    struct Image
+    {
+        uint64_t frame = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool bgra = false;
+        std::vector<uint8_t> pixels;
+    };
+    // Called on the writer thread with every image, already RGBA, instead of writing a PNG
+    using ImageHandler = std::function<void(const Image&)>;
+
+    // Files go to directory/frame_<index>.png, the directory is created with the first one
+    FrameCapture(wgpu::Device device, std::filesystem::path directory);
+    // Waits for the captures in flight and for the writer to finish
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Triggers, any of them captures a frame
+    void captureEvery(uint32_t n)
+    {
+        every = n;
+    }
+    // Frame indices, in any order
+    void captureFrames(std::vector<uint64_t> frames);
+    // The next frame, e.g. from a hotkey
+    void requestCapture()
+    {
+        requested = true;
+    }
+
+    bool wants(uint64_t frame) const;
+    // Set before the first capture
+    void setImageHandler(ImageHandler handler);
+
+    // Records the copy of the texture into the encoder, call before the encoder is finished.
+    // Returns false if the frame is skipped.
+    bool capture(wgpu::CommandEncoder encoder, wgpu::Texture texture, wgpu::TextureFormat format,
+                 uint32_t width, uint32_t height, uint64_t frame);
+    // Starts mapping the buffers copied into this frame, call after queue.submit()
+    void endFrame();
+    // Nothing in flight or being written; the frame loop doesn't count allocations while it isn't
+    bool idle() const;
+
+    // Written, skipped and failed frames, PNG encoding time
+    void printStats() const;
+
+private:
+    enum class ReadbackState
+    {
+        Free,
+        // Copy recorded, waiting for the submit
+        Copied,
+        Mapping,
+    };
+
+    struct Readback
+    {
+        // Map callback userdata, the C API is used so that no callback object is allocated
+        FrameCapture* owner = nullptr;
+        uint32_t index = 0;
+        wgpu::Buffer buffer = nullptr;
+        uint64_t capacity = 0;
+        ReadbackState state = ReadbackState::Free;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t bytesPerRow = 0;
+        bool bgra = false;
+        uint64_t frame = 0;
+    };
+
+    static void mapCallback(WGPUBufferMapAsyncStatus status, void* userdata);
+    void onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status);
+    void writerLoop();
+
+    wgpu::Device device;
+    std::filesystem::path directory;
+
+    uint32_t every = 0;
+    // Sorted
+    std::vector<uint64_t> frames;
+    bool requested = false;
+
+    std::array<Readback, readbackRingSize> ring;
+
+    // Guards the queue, stopping, writing, the handler and the writer's stats
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Image> queue;
+    bool stopping = false;
+    bool writing = false;
+    ImageHandler handler;
+    std::thread writer;
+    // Only touched by the writer
+    bool directoryCreated = false;
+
+    uint64_t nCaptured = 0;
+    uint64_t nSkipped = 0;
+    uint64_t nUnsupported = 0;
+    uint64_t nWritten = 0;
+    uint64_t nFailed = 0;
+    SlidingStats encodeMs;
+};
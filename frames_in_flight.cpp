@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "enum_names.hpp"
+#include "frames_in_flight.hpp"
+#include "gpu_future.hpp"
+
+
+static constexpr EnumName<WGPUQueueWorkDoneStatus> queueWorkDoneStatusNames[] =
+{
+    {wgpu::QueueWorkDoneStatus::Success,    "Success"},
+    {wgpu::QueueWorkDoneStatus::Error,      "Error"},
+    {wgpu::QueueWorkDoneStatus::Unknown,    "Unknown"},
+    {wgpu::QueueWorkDoneStatus::DeviceLost, "DeviceLost"},
+
+    {wgpu::QueueWorkDoneStatus::Force32,    "Force32"}
+};
+
+
+FramesInFlight::FramesInFlight(wgpu::Device device, wgpu::Queue queue, uint32_t slots) :
+    device(device),
+    queue(queue),
+    nSlots(std::clamp(slots, 1u, maxSlots)),
+    state(std::make_unique<State>())
+{
+    for (auto& s : state->slots)
+    {
+        s.state = state.get();
+    }
+
+    if (nSlots != slots)
+    {
+        std::cout << "Frames in flight clamped to " << nSlots << std::endl;
+    }
+}
+
+
+FramesInFlight::~FramesInFlight()
+{
+    // Callbacks point to this object, they must not fire after it's gone
+    if (!waitIdle(std::chrono::milliseconds(5000)))
+    {
+        std::cout << "GPU is still busy on exit, leaking frame callbacks" << std::endl;
+        state.release();
+    }
+}
+
+
+bool FramesInFlight::waitSlot(uint32_t index, std::chrono::milliseconds timeout)
+{
+    auto start = std::chrono::steady_clock::now();
+    while (state->slots[index].inFlight)
+    {
+        processEvents(device);
+        if (!state->slots[index].inFlight)
+            break;
+
+        if (std::chrono::steady_clock::now() - start > timeout)
+        {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+
+bool FramesInFlight::beginFrame(std::chrono::milliseconds timeout)
+{
+    currentSlot = (uint32_t)(nextSerial % nSlots);
+    return waitSlot(currentSlot, timeout);
+}
+
+
+bool FramesInFlight::tryBeginFrame()
+{
+    currentSlot = (uint32_t)(nextSerial % nSlots);
+    if (state->slots[currentSlot].inFlight)
+    {
+        processEvents(device);
+    }
+    return !state->slots[currentSlot].inFlight;
+}
+
+
+void FramesInFlight::endFrame()
+{
+    Slot& s = state->slots[currentSlot];
+    s.inFlight = true;
+    s.serial = nextSerial;
+
+#ifdef WEBGPU_BACKEND_DAWN
+    wgpuQueueOnSubmittedWorkDone(queue, /* signalValue -- no idea what it is */ 0, onWorkDone, &s);
+#elif defined(WEBGPU_BACKEND_WGPU)
+    wgpuQueueOnSubmittedWorkDone(queue, onWorkDone, &s);
+#endif
+
+    nextSerial++;
+}
+
+
+void FramesInFlight::onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata)
+{
+    Slot& s = *reinterpret_cast<Slot*>(userdata);
+    if (status != wgpu::QueueWorkDoneStatus::Success)
+    {
+        std::cout << "Queued work for frame " << s.serial << " finished with status: ";
+        writeEnumName(std::cout, queueWorkDoneStatusNames, status);
+        std::cout << std::endl;
+    }
+
+    s.inFlight = false;
+    // Queue work completes in submission order
+    s.state->lastCompleted = std::max(s.state->lastCompleted, s.serial);
+}
+
+
+bool FramesInFlight::waitIdle(std::chrono::milliseconds timeout)
+{
+    for (uint32_t i = 0; i < nSlots; i++)
+    {
+        if (!waitSlot(i, timeout))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <webgpu/webgpu.hpp>
+
+// Limits how many frames the CPU may run ahead of the GPU.
+// Each frame takes one of N slots; a slot is reused only after the GPU has finished
+// the frame submitted from it, so per-frame resources indexed by the slot can be safely overwritten.
+class FramesInFlight
+{
+public:
+    static constexpr uint32_t maxSlots = 3;
+
+    FramesInFlight(wgpu::Device device, wgpu::Queue queue, uint32_t slots);
+    ~FramesInFlight();
+
+    FramesInFlight(const FramesInFlight&) = delete;
+    FramesInFlight& operator=(const FramesInFlight&) = delete;
+
+    // Blocks until the next slot is free. Returns false if the GPU did not finish in time.
+    bool beginFrame(std::chrono::milliseconds timeout);
+    // Non-blocking variant: returns false if the next slot is still busy
+    bool tryBeginFrame();
+    // Call right after the frame's queue.submit()
+    void endFrame();
+
+    // Waits for all submitted frames
+    bool waitIdle(std::chrono::milliseconds timeout);
+
+    uint32_t slotCount() const
+    {
+        return nSlots;
+    }
+
+    // Slot of the current frame, valid between beginFrame() and endFrame()
+    uint32_t slot() const
+    {
+        return currentSlot;
+    }
+
+    // Serial of the frame being recorded, starts from 1
+    uint64_t frameSerial() const
+    {
+        return nextSerial;
+    }
+
+    // Serial of the latest frame finished by the GPU, 0 if none
+    uint64_t completedSerial() const
+    {
+        return state->lastCompleted;
+    }
+
+private:
+    struct State;
+
+    struct Slot
+    {
+        State* state = nullptr;
+        bool inFlight = false;
+        uint64_t serial = 0;
+    };
+
+    // Everything the completion callbacks touch; registered through the C API with a slot
+    // as userdata so that a frame does not allocate a callback object
+    struct State
+    {
+        std::array<Slot, maxSlots> slots;
+        uint64_t lastCompleted = 0;
+    };
+
+    bool waitSlot(uint32_t index, std::chrono::milliseconds timeout);
+    static void onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata);
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    uint32_t nSlots;
+    std::unique_ptr<State> state;
+    uint32_t currentSlot = 0;
+    uint64_t nextSerial = 1;
+};
@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <stb_image_write.h>
+
+#include "golden_test.hpp"
+#include "gpu_profiler.hpp"
+
+static const char* timingsFileName = "timings.txt";
+
+
+static std::string hostName()
+{
+#ifdef _WIN32
+    const char* name = std::getenv("COMPUTERNAME");
+    return name ? name : "unknown";
+#else
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0 || !name[0])
+        return "unknown";
+    return name;
+#endif
+}
+
+
+static bool readPpm(const std::filesystem::path& path, uint32_t& width, uint32_t& height, std::vector<uint8_t>& rgb)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::string magic;
+    uint32_t maxValue = 0;
+    f >> magic >> width >> height >> maxValue;
+    if (!f || magic != "P6" || maxValue != 255)
+        return false;
+
+    // A single whitespace character ends the header
+    f.get();
+    rgb.resize((size_t)width * height * 3);
+    f.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+    return (bool)f;
+}
+
+
+static bool writePpm(const std::filesystem::path& path, uint32_t width, uint32_t height,
+                     const std::vector<uint8_t>& rgb)
+{
+    std::ofstream f(path, std::ios::binary);
+    f << "P6\n" << width << " " << height << "\n255\n";
+    f.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    return (bool)f;
+}
+
+
+static bool createDirectory(const std::filesystem::path& dir)
+{
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error)
+    {
+        std::cout << "Golden test: cannot create " << dir << ": " << error.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+GoldenTest::GoldenTest(std::filesystem::path referenceDir, std::filesystem::path outputDir, bool updateReferences,
+                       uint32_t tolerance, uint32_t minPsnr, const std::string& adapterKey, GpuProfiler* profiler) :
+    referenceDir(std::move(referenceDir)),
+    outputDir(std::move(outputDir)),
+    update(updateReferences),
+    tolerance(tolerance),
+    minPsnr(minPsnr),
+    machine(hostName() + "/" + adapterKey),
+    profiler(profiler),
+    results(scenes().size())
+{
+}
+
+
+const std::vector<GoldenTest::Scene>& GoldenTest::scenes()
+{
+    // The two 64-object scenes draw the same frame, with and without render bundles
+    static const std::vector<Scene> list =
+    {
+        { "grid_64",            64,     false, true,  1.0 },
+        { "grid_64_no_bundles", 64,     false, false, 1.0 },
+        { "grid_4096",          4096,   false, true,  2.5 },
+        { "gpu_driven_4096",    4096,   true,  false, 2.5 },
+        { "gpu_driven_100000",  100000, true,  false, 4.0 },
+    };
+    return list;
+}
+
+
+uint32_t GoldenTest::maxUniformSlots()
+{
+    uint32_t slots = 1;
+    for (const Scene& s : scenes())
+    {
+        if (!s.gpuDriven)
+        {
+            slots = std::max(slots, s.objectCount);
+        }
+    }
+    return slots;
+}
+
+
+void GoldenTest::frameRecorded(bool ready)
+{
+    if (!ready || sceneCaptured)
+        return;
+
+    readyFrames++;
+    if (readyFrames == warmupFrames + 1)
+    {
+        // Frames of the warm-up still on their way back are counted, they look the same
+        cpuMs.clear();
+        if (profiler)
+        {
+            profiler->clearStats();
+        }
+    }
+}
+
+
+bool GoldenTest::measuring() const
+{
+    return readyFrames > warmupFrames && readyFrames <= warmupFrames + measuredFrames;
+}
+
+
+void GoldenTest::addCpuTime(double ms)
+{
+    cpuMs.add(ms);
+}
+
+
+void GoldenTest::captured(uint64_t frame)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    capturedFrames[frame] = current;
+    sceneCaptured = true;
+}
+
+
+bool GoldenTest::nextScene()
+{
+    Result& r = results[current];
+    if (!cpuMs.empty())
+    {
+        r.cpuMs = cpuMs.percentile(50);
+    }
+    if (profiler && profiler->enabled() && !profiler->frameStats().empty())
+    {
+        r.gpuMs = profiler->frameStats().percentile(50);
+    }
+
+    current++;
+    readyFrames = 0;
+    sceneCaptured = false;
+    cpuMs.clear();
+    return current < scenes().size();
+}
+
+
+void GoldenTest::compare(const FrameCapture::Image& image)
+{
+    size_t index = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = capturedFrames.find(image.frame);
+        if (it == capturedFrames.end())
+            return;
+        index = it->second;
+    }
+    const Scene& s = scenes()[index];
+
+    std::vector<uint8_t> rgb((size_t)image.width * image.height * 3);
+    for (size_t i = 0; i < (size_t)image.width * image.height; i++)
+    {
+        std::copy_n(&image.pixels[i * 4], 3, &rgb[i * 3]);
+    }
+
+    Result r;
+    r.compared = true;
+    std::filesystem::path referencePath = referenceDir / (std::string(s.name) + ".ppm");
+
+    if (update)
+    {
+        r.imageMatches = createDirectory(referenceDir) && writePpm(referencePath, image.width, image.height, rgb);
+        if (!r.imageMatches)
+        {
+            r.error = "cannot write " + referencePath.string();
+        }
+    }
+    else
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> reference;
+        if (!readPpm(referencePath, width, height, reference))
+        {
+            r.error = "no reference " + referencePath.string();
+            writeFailure(s, image, rgb, nullptr);
+        }
+        else if (width != image.width || height != image.height)
+        {
+            std::ostringstream message;
+            message << "reference is " << width << "x" << height << ", frame is " << image.width << "x" << image.height;
+            r.error = message.str();
+            writeFailure(s, image, rgb, nullptr);
+        }
+        else
+        {
+            // Differing pixels in red over a dimmed reference
+            std::vector<uint8_t> diff(rgb.size());
+            double squaredError = 0.0;
+            for (size_t i = 0; i < (size_t)width * height; i++)
+            {
+                uint32_t d = 0;
+                for (size_t c = 0; c < 3; c++)
+                {
+                    int e = (int)rgb[i * 3 + c] - (int)reference[i * 3 + c];
+                    squaredError += e * e;
+                    d = std::max(d, (uint32_t)std::abs(e));
+                }
+                r.maxDifference = std::max(r.maxDifference, d);
+
+                if (d > tolerance)
+                {
+                    r.differentPixels++;
+                    diff[i * 3 + 0] = (uint8_t)std::min(255u, 128 + d);
+                    diff[i * 3 + 1] = 0;
+                    diff[i * 3 + 2] = 0;
+                }
+                else
+                {
+                    uint8_t gray = (uint8_t)((reference[i * 3] + reference[i * 3 + 1] + reference[i * 3 + 2]) / 12);
+                    std::fill_n(&diff[i * 3], 3, gray);
+                }
+            }
+
+            double mse = squaredError / ((double)width * height * 3);
+            r.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+            r.imageMatches = r.differentPixels == 0 && r.psnr >= minPsnr;
+            if (!r.imageMatches)
+            {
+                writeFailure(s, image, rgb, &diff);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Result& stored = results[index];
+    stored.compared = r.compared;
+    stored.imageMatches = r.imageMatches;
+    stored.error = r.error;
+    stored.differentPixels = r.differentPixels;
+    stored.maxDifference = r.maxDifference;
+    stored.psnr = r.psnr;
+}
+
+
+bool GoldenTest::writeFailure(const Scene& s, const FrameCapture::Image& image, const std::vector<uint8_t>& rgb,
+                              const std::vector<uint8_t>* diff)
+{
+    if (!createDirectory(outputDir))
+        return false;
+
+    std::string base = (outputDir / s.name).string();
+    bool written = stbi_write_png((base + ".png").c_str(), (int)image.width, (int)image.height, 3, rgb.data(),
+                                  (int)image.width * 3) != 0;
+    if (diff)
+    {
+        written = stbi_write_png((base + "_diff.png").c_str(), (int)image.width, (int)image.height, 3,
+                                 diff->data(), (int)image.width * 3) != 0 && written;
+    }
+    // Can be copied over the reference once the change is intended
+    written = writePpm(base + ".ppm", image.width, image.height, rgb) && written;
+    if (!written)
+    {
+        std::cout << "Golden test: cannot write the images of " << s.name << " to " << outputDir << std::endl;
+    }
+    return written;
+}
+
+
+bool GoldenTest::report()
+{
+    // Scene name to CPU and GPU milliseconds
+    std::map<std::string, std::pair<double, double>> referenceTimes;
+    std::filesystem::path timingsPath = referenceDir / timingsFileName;
+    // Timings of another machine, or of a file without a machine line, are only printed
+    bool haveTimes = false;
+    std::string timingsMachine;
+    if (!update)
+    {
+        std::ifstream f(timingsPath);
+        std::string key;
+        haveTimes = (bool)(f >> key);
+        if (key == "machine" && f >> timingsMachine)
+        {
+            std::string name;
+            double cpu = 0.0;
+            double gpu = 0.0;
+            while (f >> name >> cpu >> gpu)
+            {
+                referenceTimes[name] = { cpu, gpu };
+            }
+        }
+    }
+    bool checkTimes = timingsMachine == machine;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto printMs = [](double ms)
+    {
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(3);
+        if (ms < 0.0)
+        {
+            s << "n/a";
+        }
+        else
+        {
+            s << ms;
+        }
+        return s.str();
+    };
+
+    std::cout << "Golden images in " << referenceDir.string() << ", tolerance " << tolerance << ", PSNR >= "
+              << minPsnr << " dB; median frame ms over " << measuredFrames << " frames:" << std::endl;
+    if (haveTimes && !checkTimes)
+    {
+        std::cout << "  Reference times are from " << (timingsMachine.empty() ? "an unknown machine" : timingsMachine)
+                  << ", this is " << machine << ": times are not checked" << std::endl;
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < scenes().size(); i++)
+    {
+        const Scene& s = scenes()[i];
+        const Result& r = results[i];
+
+        std::vector<std::string> problems;
+        if (!r.compared)
+        {
+            problems.push_back("not captured");
+        }
+        else if (!r.error.empty())
+        {
+            problems.push_back(r.error);
+        }
+        else if (!update && !r.imageMatches)
+        {
+            std::ostringstream message;
+            message << r.differentPixels << " pixels differ, up to " << r.maxDifference;
+            problems.push_back(message.str());
+        }
+
+        auto reference = referenceTimes.find(s.name);
+        if (checkTimes && reference != referenceTimes.end())
+        {
+            if (r.cpuMs >= 0.0 && reference->second.first > 0.0 && r.cpuMs > reference->second.first * maxSlowdown)
+            {
+                problems.push_back("CPU time was " + printMs(reference->second.first));
+            }
+            if (r.gpuMs >= 0.0 && reference->second.second > 0.0 && r.gpuMs > reference->second.second * maxSlowdown)
+            {
+                problems.push_back("GPU time was " + printMs(reference->second.second));
+            }
+        }
+
+        std::cout << "  " << std::left << std::setw(20) << s.name << std::right
+                  << (problems.empty() ? " ok    " : " FAILED");
+        if (r.compared && r.error.empty() && !update)
+        {
+            std::cout << " PSNR " << std::fixed << std::setprecision(1) << std::setw(5) << r.psnr << std::defaultfloat;
+        }
+        std::cout << "  CPU " << printMs(r.cpuMs) << "  GPU " << printMs(r.gpuMs);
+        for (const std::string& p : problems)
+        {
+            std::cout << "; " << p;
+        }
+        std::cout << std::endl;
+
+        if (!problems.empty())
+        {
+            failed++;
+        }
+    }
+
+    if (update)
+    {
+        createDirectory(referenceDir);
+        std::ofstream f(timingsPath);
+        f << "machine " << machine << "\n";
+        f << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < scenes().size(); i++)
+        {
+            f << scenes()[i].name << " " << results[i].cpuMs << " " << results[i].gpuMs << "\n";
+        }
+        if (!f)
+        {
+            std::cout << "Golden test: cannot write " << timingsPath << std::endl;
+            return false;
+        }
+        std::cout << "References updated" << std::endl;
+    }
+    else if (failed)
+    {
+        std::cout << failed << " of " << scenes().size() << " scenes failed, see " << outputDir.string() << std::endl;
+    }
+    return failed == 0;
+}
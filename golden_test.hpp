@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame_capture.hpp"
+#include "sliding_stats.hpp"
+
+class GpuProfiler;
+
+// Renders a fixed list of scenes and checks each one against a reference image and reference frame
+// times, so that rendering and performance regressions are caught by the same headless run.
+// A scene is drawn at a fixed animation time until it is ready, then for warmupFrames and for
+// measuredFrames whose CPU and GPU times are kept; the last one is captured. Captures are compared on
+// the frame capture's writer thread, the next scene does not wait for them.
+// References are binary PPM, there is no PNG decoder in the tree: <name>.ppm in the reference directory,
+// and the median frame times of all scenes in its timings.txt, along with the machine they were measured on.
+// A scene fails if a pixel differs from the reference by more than the tolerance in any channel, if the
+// PSNR of the frame is below the threshold or if a median frame time has grown over maxSlowdown times
+// the reference. Frame times only hold on the host and adapter that recorded them, on any other machine
+// they are printed but not checked. A failing frame leaves <name>.png, <name>_diff.png and <name>.ppm in
+// the output directory.
+class GoldenTest
+{
+public:
+    struct Scene
+    {
+        // Also the name of its reference image
+        const char* name;
+        uint32_t objectCount;
+        bool gpuDriven;
+        bool renderBundles;
+        // Animation time of every frame, so that they all look the same
+        double seconds;
+    };
+
+    static constexpr uint32_t warmupFrames = 10;
+    static constexpr uint32_t measuredFrames = 100;
+    // How much slower than the reference a median frame time may get
+    static constexpr double maxSlowdown = 1.5;
+
+    // With updateReferences the frames and times become the new references instead of being compared.
+    // The adapter key, see makeAdapterCacheKey(), and the host name tell the machine of the frame times.
+    // The profiler may be null or have no timestamp queries, GPU times are not checked then.
+    GoldenTest(std::filesystem::path referenceDir, std::filesystem::path outputDir, bool updateReferences,
+               uint32_t tolerance, uint32_t minPsnr, const std::string& adapterKey, GpuProfiler* profiler);
+
+    GoldenTest(const GoldenTest&) = delete;
+    GoldenTest& operator=(const GoldenTest&) = delete;
+
+    static const std::vector<Scene>& scenes();
+    // Uniform slots of the largest scene, one per object unless it is GPU-driven
+    static uint32_t maxUniformSlots();
+
+    const Scene& scene() const
+    {
+        return scenes()[current];
+    }
+
+    // Call once the frame's passes are recorded, ready tells whether the scene has drawn everything
+    void frameRecorded(bool ready);
+    // The frame is past the warm-up, its CPU time goes to addCpuTime()
+    bool measuring() const;
+    void addCpuTime(double ms);
+
+    // The frame is to be captured; captured() once its copy is recorded
+    bool wantsCapture() const
+    {
+        return !sceneCaptured && readyFrames >= warmupFrames + measuredFrames;
+    }
+    void captured(uint64_t frame);
+    // The loop lets the GPU finish and calls nextScene()
+    bool sceneDone() const
+    {
+        return sceneCaptured;
+    }
+    // Keeps the scene's frame times and starts the next scene, false after the last one
+    bool nextScene();
+
+    // The frame capture's image handler, runs on its writer thread
+    void compare(const FrameCapture::Image& image);
+
+    // Prints a line per scene and checks the frame times, call after the frame capture has finished.
+    // Returns false if any scene has failed.
+    bool report();
+
+private:
+    struct Result
+    {
+        // Filled by compare()
+        bool compared = false;
+        bool imageMatches = false;
+        std::string error;
+        uint64_t differentPixels = 0;
+        uint32_t maxDifference = 0;
+        double psnr = 0.0;
+
+        // Medians, negative when not measured
+        double cpuMs = -1.0;
+        double gpuMs = -1.0;
+    };
+
+    bool writeFailure(const Scene& s, const FrameCapture::Image& image, const std::vector<uint8_t>& rgb,
+                      const std::vector<uint8_t>* diff);
+
+    std::filesystem::path referenceDir;
+    std::filesystem::path outputDir;
+    bool update;
+    uint32_t tolerance;
+    uint32_t minPsnr;
+    // Host name and adapter key, written to timings.txt
+    std::string machine;
+    GpuProfiler* profiler;
+
+    size_t current = 0;
+    uint32_t readyFrames = 0;
+    bool sceneCaptured = false;
+    SlidingStats cpuMs;
+
+    // Guards the image fields of the results and the captured frames
+    std::mutex mutex;
+    // Frame index to scene index
+    std::map<uint64_t, size_t> capturedFrames;
+    std::vector<Result> results;
+};
@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "gpu_driven_scene.hpp"
+#include "gpu_handle.hpp"
+#include "gpu_profiler.hpp"
+#include "shader_module.hpp"
+
+static const char* commonShaderSource = R"(
+struct Frame
+{
+    camera : vec4<f32>,
+    count : u32,
+};
+
+struct Instance
+{
+    rect : vec4<f32>,
+    params : vec4<f32>,
+};
+
+fn toClip(p : vec2<f32>) -> vec2<f32>
+{
+    return (p - frame.camera.xy) * frame.camera.z;
+}
+)";
+
+static const char* cullShaderSource = R"(
+struct DrawArgs
+{
+    indexCount : u32,
+    instanceCount : atomic<u32>,
+    firstIndex : u32,
+    baseVertex : i32,
+    firstInstance : u32,
+};
+
+@group(0) @binding(0) var<uniform> frame : Frame;
+@group(0) @binding(1) var<storage, read> instances : array<Instance>;
+@group(0) @binding(2) var<storage, read_write> visible : array<u32>;
+@group(0) @binding(3) var<storage, read_write> args : DrawArgs;
+
+@compute @workgroup_size(64)
+fn cs_main(@builtin(global_invocation_id) id : vec3<u32>)
+{
+    let i = id.x;
+    if (i >= frame.count)
+    {
+        return;
+    }
+
+    // Bounds of the largest size the animation reaches
+    let inst = instances[i];
+    let lo = toClip(inst.rect.xy - inst.rect.zw * 0.45);
+    let hi = toClip(inst.rect.xy + inst.rect.zw * 0.45);
+    if (hi.x < -1.0 || lo.x > 1.0 || hi.y < -1.0 || lo.y > 1.0)
+    {
+        return;
+    }
+
+    visible[atomicAdd(&args.instanceCount, 1u)] = i;
+}
+)";
+
+static const char* drawShaderSource = R"(
+@group(0) @binding(0) var<uniform> frame : Frame;
+@group(0) @binding(1) var<storage, read> instances : array<Instance>;
+@group(0) @binding(2) var<storage, read> visible : array<u32>;
+
+struct VertexOut
+{
+    @builtin(position) position : vec4<f32>,
+    @location(0) color : vec4<f32>,
+};
+
+@vertex
+fn vs_main(@location(0) corner : vec2<f32>, @builtin(instance_index) instance : u32) -> VertexOut
+{
+    let inst = instances[visible[instance]];
+    let phase = frame.camera.w * 2.0 + inst.params.x;
+    let pulse = 0.35 + 0.1 * sin(phase);
+
+    var out : VertexOut;
+    out.position = vec4<f32>(toClip(inst.rect.xy + corner * inst.rect.zw * pulse), 0.5, 1.0);
+    out.color = vec4<f32>(0.5 + 0.5 * sin(phase), 0.5 + 0.5 * sin(phase + 2.1), 0.5 + 0.5 * sin(phase + 4.2), 1.0);
+    return out;
+}
+
+@fragment
+fn fs_main(in : VertexOut) -> @location(0) vec4<f32>
+{
+    return in.color;
+}
+)";
+
+// A quad as two indexed triangles
+static const float quadCorners[] =
+{
+    -1.0f, -1.0f,   1.0f, -1.0f,   1.0f, 1.0f,   -1.0f, 1.0f,
+};
+
+static const uint16_t quadIndices[] =
+{
+    0, 1, 2,   0, 2, 3,
+};
+
+// Arguments of drawIndexedIndirect: index count, instance count, first index, base vertex, first instance.
+// The instance count is reset every frame and counted up by the culling pass.
+static const uint32_t initialDrawArgs[] = { 6, 0, 0, 0, 0 };
+
+static constexpr uint32_t cullWorkgroupSize = 64;
+
+
+static wgpu::BindGroupLayoutEntry bufferLayoutEntry(uint32_t binding, WGPUShaderStageFlags visibility,
+                                                    wgpu::BufferBindingType type, uint64_t minBindingSize,
+                                                    bool hasDynamicOffset = false)
+{
+    wgpu::BindGroupLayoutEntry entry;
+    entry.setDefault();
+    entry.binding = binding;
+    entry.visibility = visibility;
+    entry.buffer.type = type;
+    entry.buffer.hasDynamicOffset = hasDynamicOffset;
+    entry.buffer.minBindingSize = minBindingSize;
+    return entry;
+}
+
+
+static wgpu::BindGroupEntry bufferEntry(uint32_t binding, wgpu::Buffer buffer, uint64_t size)
+{
+    wgpu::BindGroupEntry entry;
+    entry.binding = binding;
+    entry.buffer = buffer;
+    entry.offset = 0;
+    entry.size = size;
+    entry.sampler = nullptr;
+    entry.textureView = nullptr;
+    return entry;
+}
+
+
+GpuDrivenScene::GpuDrivenScene(wgpu::Device device, wgpu::Queue queue, BlobCache* cache, PipelineCache& pipelines,
+                               BindGroupCache& bindGroups, wgpu::TextureFormat colorFormat,
+                               wgpu::TextureFormat depthFormat, uint32_t objectCount) :
+    device(device),
+    queue(queue),
+    pipelines(pipelines),
+    bindGroups(bindGroups),
+    nObjects(std::max(objectCount, 1u))
+{
+    columns = std::max(1u, (uint32_t)std::ceil(std::sqrt((double)nObjects)));
+
+    cullModule = createShaderModule(device, "GPU culling shader",
+                                    std::string(commonShaderSource) + cullShaderSource, cache);
+    drawModule = createShaderModule(device, "GPU-driven draw shader",
+                                    std::string(commonShaderSource) + drawShaderSource, cache);
+
+    const uint64_t instanceBytes = (uint64_t)nObjects * sizeof(Instance);
+    const uint64_t visibleBytes = (uint64_t)nObjects * sizeof(uint32_t);
+
+    wgpu::BindGroupLayoutEntry cullEntries[] =
+    {
+        bufferLayoutEntry(0, wgpu::ShaderStage::Compute, wgpu::BufferBindingType::Uniform,
+                          sizeof(FrameUniforms), true),
+        bufferLayoutEntry(1, wgpu::ShaderStage::Compute, wgpu::BufferBindingType::ReadOnlyStorage, sizeof(Instance)),
+        bufferLayoutEntry(2, wgpu::ShaderStage::Compute, wgpu::BufferBindingType::Storage, sizeof(uint32_t)),
+        bufferLayoutEntry(3, wgpu::ShaderStage::Compute, wgpu::BufferBindingType::Storage, sizeof(initialDrawArgs)),
+    };
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+    bindGroupLayoutDesc.label = "GPU culling";
+    bindGroupLayoutDesc.entryCount = 4;
+    bindGroupLayoutDesc.entries = cullEntries;
+    cullBindGroupLayout = bindGroups.getLayout(bindGroupLayoutDesc);
+
+    wgpu::BindGroupLayoutEntry drawEntries[] =
+    {
+        bufferLayoutEntry(0, wgpu::ShaderStage::Vertex, wgpu::BufferBindingType::Uniform,
+                          sizeof(FrameUniforms), true),
+        bufferLayoutEntry(1, wgpu::ShaderStage::Vertex, wgpu::BufferBindingType::ReadOnlyStorage, sizeof(Instance)),
+        bufferLayoutEntry(2, wgpu::ShaderStage::Vertex, wgpu::BufferBindingType::ReadOnlyStorage, sizeof(uint32_t)),
+    };
+    bindGroupLayoutDesc.label = "GPU-driven draw";
+    bindGroupLayoutDesc.entryCount = 3;
+    bindGroupLayoutDesc.entries = drawEntries;
+    drawBindGroupLayout = bindGroups.getLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "GPU culling";
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&cullBindGroupLayout;
+    cullPipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    pipelineLayoutDesc.label = "GPU-driven draw";
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&drawBindGroupLayout;
+    drawPipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    cullPipelineDesc.label = "GPU culling";
+    cullPipelineDesc.layout = cullPipelineLayout;
+    cullPipelineDesc.compute.module = cullModule;
+    cullPipelineDesc.compute.entryPoint = "cs_main";
+    cullPipelineDesc.compute.constantCount = 0;
+    cullPipelineDesc.compute.constants = nullptr;
+
+    colorTarget.format = colorFormat;
+    colorTarget.blend = nullptr;
+    colorTarget.writeMask = wgpu::ColorWriteMask::All;
+
+    fragment.module = drawModule;
+    fragment.entryPoint = "fs_main";
+    fragment.constantCount = 0;
+    fragment.constants = nullptr;
+    fragment.targetCount = 1;
+    fragment.targets = &colorTarget;
+
+    depthStencil.setDefault();
+    depthStencil.format = depthFormat;
+    depthStencil.depthWriteEnabled = true;
+    depthStencil.depthCompare = wgpu::CompareFunction::Less;
+    depthStencil.stencilReadMask = 0;
+    depthStencil.stencilWriteMask = 0;
+
+    cornerAttribute.format = wgpu::VertexFormat::Float32x2;
+    cornerAttribute.offset = 0;
+    cornerAttribute.shaderLocation = 0;
+
+    vertexLayout.arrayStride = 2 * sizeof(float);
+    vertexLayout.stepMode = wgpu::VertexStepMode::Vertex;
+    vertexLayout.attributeCount = 1;
+    vertexLayout.attributes = &cornerAttribute;
+
+    drawPipelineDesc.label = "GPU-driven draw";
+    drawPipelineDesc.layout = drawPipelineLayout;
+    drawPipelineDesc.vertex.module = drawModule;
+    drawPipelineDesc.vertex.entryPoint = "vs_main";
+    drawPipelineDesc.vertex.constantCount = 0;
+    drawPipelineDesc.vertex.constants = nullptr;
+    drawPipelineDesc.vertex.bufferCount = 1;
+    drawPipelineDesc.vertex.buffers = &vertexLayout;
+    drawPipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+    drawPipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+    drawPipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+    drawPipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+    drawPipelineDesc.depthStencil = &depthStencil;
+    drawPipelineDesc.multisample.count = 1;
+    drawPipelineDesc.multisample.mask = ~0u;
+    drawPipelineDesc.multisample.alphaToCoverageEnabled = false;
+    drawPipelineDesc.fragment = &fragment;
+
+    // Compiled in the background, the first frames are drawn without the scene
+    pipelines.getComputePipeline(cullPipelineDesc);
+    pipelines.getRenderPipeline(drawPipelineDesc);
+
+    auto createBuffer = [&device](const char* label, WGPUBufferUsageFlags usage, uint64_t size)
+    {
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = label;
+        bufferDesc.usage = usage;
+        bufferDesc.size = size;
+        bufferDesc.mappedAtCreation = false;
+        return device.createBuffer(bufferDesc);
+    };
+    vertexBuffer = createBuffer("GPU-driven vertices", wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst,
+                                sizeof(quadCorners));
+    indexBuffer = createBuffer("GPU-driven indices", wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst,
+                               sizeof(quadIndices));
+    instanceBuffer = createBuffer("Instances", wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst,
+                                  instanceBytes);
+    visibleBuffer = createBuffer("Visible instances", wgpu::BufferUsage::Storage, visibleBytes);
+    argsBuffer = createBuffer("Draw arguments",
+                              wgpu::BufferUsage::Storage | wgpu::BufferUsage::Indirect | wgpu::BufferUsage::CopyDst,
+                              sizeof(initialDrawArgs));
+
+    std::cout << "GPU-driven scene: " << nObjects << " objects, "
+              << (instanceBytes + visibleBytes) / 1024 << " KB of instance data" << std::endl;
+}
+
+
+GpuDrivenScene::~GpuDrivenScene()
+{
+    for (wgpu::Buffer* b : { &vertexBuffer, &indexBuffer, &instanceBuffer, &visibleBuffer, &argsBuffer })
+    {
+        b->destroy();
+        b->release();
+    }
+    // A later scene may get the same addresses, its pipelines must not come from these
+    pipelines.forget(drawPipelineLayout);
+    pipelines.forget(cullPipelineLayout);
+    pipelines.forget(drawModule);
+    pipelines.forget(cullModule);
+    drawPipelineLayout.release();
+    cullPipelineLayout.release();
+    drawModule.release();
+    cullModule.release();
+}
+
+
+void GpuDrivenScene::upload(StagingBelt& belt, wgpu::CommandEncoder encoder)
+{
+    void* dst = belt.writeBuffer(encoder, vertexBuffer, 0, sizeof(quadCorners));
+    std::memcpy(dst, quadCorners, sizeof(quadCorners));
+    dst = belt.writeBuffer(encoder, indexBuffer, 0, sizeof(quadIndices));
+    std::memcpy(dst, quadIndices, sizeof(quadIndices));
+
+    // Same layout as GridScene: cells of a square grid over the whole clip space
+    const uint32_t rows = (nObjects + columns - 1) / columns;
+    const float cellWidth = 2.0f / (float)columns;
+    const float cellHeight = 2.0f / (float)std::max(rows, 1u);
+
+    // Generated straight into the staging memory
+    Instance* instances = reinterpret_cast<Instance*>(
+        belt.writeBuffer(encoder, instanceBuffer, 0, (uint64_t)nObjects * sizeof(Instance)));
+    for (uint32_t i = 0; i < nObjects; i++)
+    {
+        uint32_t col = i % columns;
+        uint32_t row = i / columns;
+        instances[i].rect = { -1.0f + cellWidth * ((float)col + 0.5f),
+                              -1.0f + cellHeight * ((float)row + 0.5f),
+                              cellWidth, cellHeight };
+        instances[i].params = { (float)i * 0.37f, 0.0f, 0.0f, 0.0f };
+    }
+
+    uploaded = true;
+}
+
+
+void GpuDrivenScene::update(UniformRing& ring, double seconds)
+{
+    // Hits on every frame after the first ones
+    cullPipeline = pipelines.getComputePipeline(cullPipelineDesc);
+    drawPipeline = pipelines.getRenderPipeline(drawPipelineDesc);
+
+    // Zooms in far enough for most of the grid to be culled, then back out to see all of it
+    float t = (float)seconds;
+    FrameUniforms u;
+    u.camera = { 0.3f * std::sin(t * 0.3f), 0.3f * std::cos(t * 0.23f), 1.25f + 0.75f * std::sin(t * 0.2f), t };
+    u.objectCount = nObjects;
+    u.padding[0] = u.padding[1] = u.padding[2] = 0;
+    frameOffset = ring.push(u);
+
+    // Runs before the frame's submit, after the previous frame's draw has read the arguments
+    queue.writeBuffer(argsBuffer, 0, initialDrawArgs, sizeof(initialDrawArgs));
+}
+
+
+wgpu::BindGroup GpuDrivenScene::cullBindGroup(const UniformRing& ring, uint32_t slot)
+{
+    wgpu::BindGroupEntry entries[] =
+    {
+        bufferEntry(0, ring.buffer(slot), sizeof(FrameUniforms)),
+        bufferEntry(1, instanceBuffer, (uint64_t)nObjects * sizeof(Instance)),
+        bufferEntry(2, visibleBuffer, (uint64_t)nObjects * sizeof(uint32_t)),
+        bufferEntry(3, argsBuffer, sizeof(initialDrawArgs)),
+    };
+    return bindGroups.get(cullBindGroupLayout, 4, entries, "GPU culling");
+}
+
+
+wgpu::BindGroup GpuDrivenScene::drawBindGroup(const UniformRing& ring, uint32_t slot)
+{
+    wgpu::BindGroupEntry entries[] =
+    {
+        bufferEntry(0, ring.buffer(slot), sizeof(FrameUniforms)),
+        bufferEntry(1, instanceBuffer, (uint64_t)nObjects * sizeof(Instance)),
+        bufferEntry(2, visibleBuffer, (uint64_t)nObjects * sizeof(uint32_t)),
+    };
+    return bindGroups.get(drawBindGroupLayout, 3, entries, "GPU-driven draw");
+}
+
+
+void GpuDrivenScene::cull(wgpu::CommandEncoder encoder, const UniformRing& ring, uint32_t slot,
+                          GpuProfiler* profiler)
+{
+    // Still compiling: nothing is culled, nothing is drawn
+    if (!cullPipeline || !drawPipeline)
+        return;
+
+    wgpu::ComputePassDescriptor passDesc;
+    passDesc.label = "GPU culling";
+    passDesc.timestampWriteCount = 0;
+    passDesc.timestampWrites = nullptr;
+    if (profiler)
+    {
+        profiler->instrument(passDesc, "GPU culling");
+    }
+
+    Owned<wgpu::ComputePassEncoder> pass(encoder.beginComputePass(passDesc));
+    pass->setPipeline(cullPipeline);
+    pass->setBindGroup(0, cullBindGroup(ring, slot), 1, &frameOffset);
+    pass->dispatchWorkgroups((nObjects + cullWorkgroupSize - 1) / cullWorkgroupSize, 1, 1);
+    pass->end();
+}
+
+
+void GpuDrivenScene::draw(wgpu::RenderPassEncoder pass, const UniformRing& ring, uint32_t slot)
+{
+    if (!cullPipeline || !drawPipeline)
+        return;
+
+    // The instance count comes from the culling pass, the CPU never learns it
+    pass.setPipeline(drawPipeline);
+    pass.setBindGroup(0, drawBindGroup(ring, slot), 1, &frameOffset);
+    pass.setVertexBuffer(0, vertexBuffer, 0, sizeof(quadCorners));
+    pass.setIndexBuffer(indexBuffer, wgpu::IndexFormat::Uint16, 0, sizeof(quadIndices));
+    pass.drawIndexedIndirect(argsBuffer, 0);
+}
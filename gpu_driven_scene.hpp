@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <webgpu/webgpu.hpp>
+
+#include "bind_group_cache.hpp"
+#include "pipeline_cache.hpp"
+#include "staging_belt.hpp"
+#include "uniform_ring.hpp"
+
+class BlobCache;
+class GpuProfiler;
+
+// The same animated grid as GridScene, but drawn without a CPU draw per object.
+// Instance data lives in a storage buffer uploaded once. Every frame a compute pass culls the
+// instances against the view of a moving camera, compacts the survivors into a list of indices and
+// counts them in the arguments of a single drawIndexedIndirect(). The animation is done in the vertex
+// shader, so the CPU cost of a frame does not depend on the number of objects.
+class GpuDrivenScene
+{
+public:
+    struct FrameUniforms
+    {
+        // xy is the camera center, z the zoom, w the time in seconds
+        std::array<float, 4> camera;
+        uint32_t objectCount;
+        uint32_t padding[3];
+    };
+
+    struct Instance
+    {
+        // xy is the center, zw the cell size, in world space
+        std::array<float, 4> rect;
+        // x is the animation phase
+        std::array<float, 4> params;
+    };
+
+    GpuDrivenScene(wgpu::Device device, wgpu::Queue queue, BlobCache* cache, PipelineCache& pipelines,
+                   BindGroupCache& bindGroups, wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat,
+                   uint32_t objectCount);
+    ~GpuDrivenScene();
+
+    GpuDrivenScene(const GpuDrivenScene&) = delete;
+    GpuDrivenScene& operator=(const GpuDrivenScene&) = delete;
+
+    // Instances and geometry go to the GPU on the first frame through the staging belt
+    bool needsUpload() const
+    {
+        return !uploaded;
+    }
+    void upload(StagingBelt& belt, wgpu::CommandEncoder encoder);
+
+    // Moves the camera and resets the draw arguments, call between ring.beginFrame() and ring.endFrame().
+    // Also picks up the pipelines once they are compiled.
+    void update(UniformRing& ring, double seconds);
+    // Records the culling compute pass; may run on any thread
+    void cull(wgpu::CommandEncoder encoder, const UniformRing& ring, uint32_t slot, GpuProfiler* profiler);
+    // Records the indirect draw of whatever has survived the culling; may run on any thread
+    void draw(wgpu::RenderPassEncoder pass, const UniformRing& ring, uint32_t slot);
+
+    uint32_t objectCount() const
+    {
+        return nObjects;
+    }
+
+    // Uploaded and both pipelines are compiled, so the frame shows every visible object
+    bool ready() const
+    {
+        return uploaded && cullPipeline && drawPipeline;
+    }
+
+    // For the render graph to track
+    wgpu::Buffer instances() const
+    {
+        return instanceBuffer;
+    }
+
+    wgpu::Buffer visibleList() const
+    {
+        return visibleBuffer;
+    }
+
+    wgpu::Buffer drawArguments() const
+    {
+        return argsBuffer;
+    }
+
+private:
+    // Both passes bind the slot's uniform ring buffer, so bind groups come from the cache every frame
+    wgpu::BindGroup cullBindGroup(const UniformRing& ring, uint32_t slot);
+    wgpu::BindGroup drawBindGroup(const UniformRing& ring, uint32_t slot);
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    PipelineCache& pipelines;
+    BindGroupCache& bindGroups;
+    uint32_t nObjects;
+
+    wgpu::ShaderModule cullModule = nullptr;
+    wgpu::ShaderModule drawModule = nullptr;
+    // Owned by the bind group cache
+    wgpu::BindGroupLayout cullBindGroupLayout = nullptr;
+    wgpu::BindGroupLayout drawBindGroupLayout = nullptr;
+    wgpu::PipelineLayout cullPipelineLayout = nullptr;
+    wgpu::PipelineLayout drawPipelineLayout = nullptr;
+    // Owned by the cache, null until compiled
+    wgpu::ComputePipeline cullPipeline = nullptr;
+    wgpu::RenderPipeline drawPipeline = nullptr;
+
+    // Looked up in the cache every frame, so they are kept with everything they point to
+    wgpu::ComputePipelineDescriptor cullPipelineDesc;
+    wgpu::VertexAttribute cornerAttribute;
+    wgpu::VertexBufferLayout vertexLayout;
+    wgpu::ColorTargetState colorTarget;
+    wgpu::FragmentState fragment;
+    wgpu::DepthStencilState depthStencil;
+    wgpu::RenderPipelineDescriptor drawPipelineDesc;
+
+    wgpu::Buffer vertexBuffer = nullptr;
+    wgpu::Buffer indexBuffer = nullptr;
+    wgpu::Buffer instanceBuffer = nullptr;
+    wgpu::Buffer visibleBuffer = nullptr;
+    wgpu::Buffer argsBuffer = nullptr;
+    bool uploaded = false;
+
+    uint32_t columns = 1;
+    // Dynamic offset of this frame's uniforms
+    uint32_t frameOffset = 0;
+};
@@ -0,0 +1,80 @@
+#include <iostream>
+
+#include "gpu_future.hpp"
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif
+
+
+void processEvents(wgpu::Instance instance)
+{
+#ifdef WEBGPU_BACKEND_DAWN
+    instance.processEvents();
+#elif defined(WEBGPU_BACKEND_WGPU)
+    // wgpu-native calls request callbacks before returning, nothing to pump
+    (void)instance;
+#endif
+}
+
+
+void processEvents(wgpu::Device device)
+{
+#ifdef WEBGPU_BACKEND_DAWN
+    device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+    wgpuDevicePoll(device, false, nullptr);
+#endif
+}
+
+
+GpuFuture<wgpu::Adapter> requestAdapterAsync(wgpu::Instance instance, const wgpu::RequestAdapterOptions& options)
+{
+    using State = GpuFuture<wgpu::Adapter>::State;
+    auto state = std::make_shared<State>();
+
+    state->callbackHandle = instance.requestAdapter(options, [state](wgpu::RequestAdapterStatus status, wgpu::Adapter adapter, char const * message) -> void
+    {
+        if (status == wgpu::RequestAdapterStatus::Success)
+        {
+            state->value = adapter;
+        }
+        else
+        {
+            std::cout << "Could not get WebGPU adapter: " << message << std::endl;
+        }
+        if (message)
+        {
+            state->message = message;
+        }
+        state->ready = true;
+    });
+
+    return GpuFuture<wgpu::Adapter>(state, [instance]() { processEvents(instance); });
+}
+
+
+GpuFuture<wgpu::Device> requestDeviceAsync(wgpu::Instance instance, wgpu::Adapter adapter, const wgpu::DeviceDescriptor& descriptor)
+{
+    using State = GpuFuture<wgpu::Device>::State;
+    auto state = std::make_shared<State>();
+
+    state->callbackHandle = adapter.requestDevice(descriptor, [state](wgpu::RequestDeviceStatus status, wgpu::Device device, char const * message) -> void
+    {
+        if (status == wgpu::RequestDeviceStatus::Success)
+        {
+            state->value = device;
+        }
+        else
+        {
+            std::cout << "Could not get WebGPU device: " << message << std::endl;
+        }
+        if (message)
+        {
+            state->message = message;
+        }
+        state->ready = true;
+    });
+
+    return GpuFuture<wgpu::Device>(state, [instance]() { processEvents(instance); });
+}
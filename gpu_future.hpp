@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <webgpu/webgpu.hpp>
+
+// Gives the implementation a chance to run pending callbacks.
+// Dawn needs it explicitly, wgpu-native fires request callbacks synchronously.
+void processEvents(wgpu::Instance instance);
+void processEvents(wgpu::Device device);
+
+// A result of an asynchronous WebGPU request.
+// Unlike std::future it does not wait passively: get() keeps pumping the event loop
+// of the implementation until the callback fires or the timeout expires.
+template<typename T>
+class GpuFuture
+{
+public:
+    struct State
+    {
+        T value {};
+        bool ready = false;
+        std::string message;
+        // Keeps the C++ callback alive while the C API still holds a pointer to it.
+        // The callback captures the state, so this makes a cycle which is broken in wait().
+        // An abandoned future leaks it on purpose: a late callback never touches freed memory.
+        std::shared_ptr<void> callbackHandle;
+    };
+
+    GpuFuture() = default;
+
+    GpuFuture(std::shared_ptr<State> state, std::function<void()> pump) :
+        state(std::move(state)),
+        pump(std::move(pump))
+    { }
+
+    bool valid() const
+    {
+        return (bool)state;
+    }
+
+    bool isReady() const
+    {
+        return state && state->ready;
+    }
+
+    // Returns false on timeout
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        if (!state)
+        {
+            throw std::runtime_error("Waiting for an empty future");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        while (!state->ready)
+        {
+            pump();
+            if (state->ready)
+                break;
+
+            if (std::chrono::steady_clock::now() - start > timeout)
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        state->callbackHandle.reset();
+        return true;
+    }
+
+    // Throws on timeout, returns a null handle if the request failed
+    T get(std::chrono::milliseconds timeout)
+    {
+        if (!wait(timeout))
+        {
+            throw std::runtime_error("Timed out waiting for a WebGPU callback");
+        }
+        return state->value;
+    }
+
+    const std::string& message() const
+    {
+        return state->message;
+    }
+
+private:
+    std::shared_ptr<State> state;
+    std::function<void()> pump;
+};
+
+
+GpuFuture<wgpu::Adapter> requestAdapterAsync(wgpu::Instance instance, const wgpu::RequestAdapterOptions& options);
+
+// Instance is needed to pump the events while the device is being created
+GpuFuture<wgpu::Device> requestDeviceAsync(wgpu::Instance instance, wgpu::Adapter adapter, const wgpu::DeviceDescriptor& descriptor);
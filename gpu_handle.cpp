@@ -0,0 +1,36 @@
+#include "gpu_handle.hpp"
+
+#define GPU_HANDLE_NAME(Type) #Type,
+static const char* const handleTypeNames[gpuHandleTypeCount] = { GPU_HANDLE_TYPES(GPU_HANDLE_NAME) };
+#undef GPU_HANDLE_NAME
+
+
+LiveHandleCounts liveHandleCounts()
+{
+    LiveHandleCounts counts {};
+#ifndef NDEBUG
+    size_t i = 0;
+#define GPU_HANDLE_LIVE(Type) counts[i++] = liveHandleCount<wgpu::Type>.load(std::memory_order_relaxed);
+    GPU_HANDLE_TYPES(GPU_HANDLE_LIVE)
+#undef GPU_HANDLE_LIVE
+#endif
+    return counts;
+}
+
+
+bool compareLiveHandles(const LiveHandleCounts& before, const LiveHandleCounts& after, std::ostream& out)
+{
+    bool ok = true;
+    for (size_t i = 0; i < gpuHandleTypeCount; i++)
+    {
+        if (after[i] != before[i])
+        {
+            out << " - " << handleTypeNames[i] << ": " << before[i] << " -> " << after[i] << std::endl;
+        }
+        if (after[i] > before[i])
+        {
+            ok = false;
+        }
+    }
+    return ok;
+}
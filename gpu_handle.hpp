@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include <webgpu/webgpu.hpp>
+
+// Handle types whose live objects are counted in debug builds
+#define GPU_HANDLE_TYPES(X) \
+    X(Instance) X(Adapter) X(Device) X(Queue) X(Surface) \
+    X(Buffer) X(Texture) X(TextureView) X(Sampler) X(QuerySet) \
+    X(ShaderModule) X(BindGroupLayout) X(BindGroup) X(PipelineLayout) \
+    X(RenderPipeline) X(ComputePipeline) X(RenderBundle) \
+    X(CommandEncoder) X(CommandBuffer) X(RenderPassEncoder) X(ComputePassEncoder)
+
+#define GPU_HANDLE_COUNT_ONE(Type) + 1
+constexpr size_t gpuHandleTypeCount = 0 GPU_HANDLE_TYPES(GPU_HANDLE_COUNT_ONE);
+#undef GPU_HANDLE_COUNT_ONE
+
+#ifndef NDEBUG
+// Live handles owned by Owned<> wrappers, per type
+template<typename Handle>
+inline std::atomic<int64_t> liveHandleCount { 0 };
+#endif
+
+// Sole owner of a wgpu handle, released when it goes out of scope.
+// Holds the raw pointer only: moving transfers it without touching the reference count,
+// so it costs the same as the plain handle. The plain wgpu:: handle is still used for calls
+// and for passing around without ownership, see get() and operator->.
+template<typename Handle>
+class Owned
+{
+public:
+    Owned() = default;
+
+    // Takes over the reference the handle came with
+    explicit Owned(Handle h) :
+        handle(h)
+    {
+        track(1);
+    }
+
+    ~Owned()
+    {
+        reset();
+    }
+
+    Owned(const Owned&) = delete;
+    Owned& operator=(const Owned&) = delete;
+
+    Owned(Owned&& other) noexcept :
+        handle(other.handle)
+    {
+        other.handle = nullptr;
+    }
+
+    Owned& operator=(Owned&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+
+    // Releases the current handle and takes over the new one; resetting to the held handle does nothing
+    void reset(Handle h = nullptr)
+    {
+        if ((typename Handle::W)h == (typename Handle::W)handle)
+            return;
+
+        if (handle)
+        {
+            track(-1);
+            handle.release();
+        }
+        handle = h;
+        track(1);
+    }
+
+    // Gives up the ownership without releasing, e.g. to a DeferredRelease. The handle stays in the live
+    // count, whoever takes it over untracks it once it is actually released, see untrackHandle()
+    Handle detach()
+    {
+        Handle h = handle;
+        handle = nullptr;
+        return h;
+    }
+
+    Handle get() const
+    {
+        return handle;
+    }
+
+    operator Handle() const
+    {
+        return handle;
+    }
+
+    Handle* operator->()
+    {
+        return &handle;
+    }
+
+    const Handle* operator->() const
+    {
+        return &handle;
+    }
+
+    explicit operator bool() const
+    {
+        return (bool)handle;
+    }
+
+private:
+    void track([[maybe_unused]] int64_t delta) const
+    {
+#ifndef NDEBUG
+        if (handle)
+        {
+            liveHandleCount<Handle>.fetch_add(delta, std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    Handle handle = nullptr;
+};
+
+// Takes a detached handle out of the live count once it has been released
+template<typename Handle>
+inline void untrackHandle()
+{
+#ifndef NDEBUG
+    liveHandleCount<Handle>.fetch_sub(1, std::memory_order_relaxed);
+#endif
+}
+
+// Live counts in the order of GPU_HANDLE_TYPES, all zeros in release builds
+using LiveHandleCounts = std::array<int64_t, gpuHandleTypeCount>;
+LiveHandleCounts liveHandleCounts();
+
+// Prints the types whose count has changed, returns false if any has grown
+bool compareLiveHandles(const LiveHandleCounts& before, const LiveHandleCounts& after, std::ostream& out);
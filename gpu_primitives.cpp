@@ -0,0 +1,545 @@
+#include <cstring>
+
+#include "gpu_primitives.hpp"
+
+// Every kernel gets these; the numbers are workgroupSize, itemsPerThread and blockSize
+static const char* commonShaderSource = R"(
+struct Params
+{
+    count : u32,
+    groupsPerRow : u32,
+    inclusive : u32,
+    padding : u32,
+};
+
+@group(0) @binding(0) var<uniform> params : Params;
+
+fn blockIndex(wid : vec3<u32>) -> u32
+{
+    return wid.y * params.groupsPerRow + wid.x;
+}
+)";
+
+// One level of a reduction: a block of 1024 elements to one value
+static const char* reduceShaderSource = R"(
+@group(0) @binding(1) var<storage, read> input : array<ELEMENT>;
+@group(0) @binding(2) var<storage, read_write> output : array<ELEMENT>;
+
+var<workgroup> partial : array<ELEMENT, 256>;
+
+fn combine(a : ELEMENT, b : ELEMENT) -> ELEMENT
+{
+    return COMBINE;
+}
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    let blockId = blockIndex(wid);
+    let base = blockId * 1024u;
+
+    // Neighbouring threads read neighbouring elements
+    var acc : ELEMENT = IDENTITY;
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let i = base + k * 256u + lid.x;
+        if (i < params.count)
+        {
+            acc = combine(acc, input[i]);
+        }
+    }
+    partial[lid.x] = acc;
+    workgroupBarrier();
+
+    for (var stride = 128u; stride > 0u; stride = stride >> 1u)
+    {
+        if (lid.x < stride)
+        {
+            partial[lid.x] = combine(partial[lid.x], partial[lid.x + stride]);
+        }
+        workgroupBarrier();
+    }
+
+    if (lid.x == 0u && base < params.count)
+    {
+        output[blockId] = partial[0];
+    }
+}
+)";
+
+// One level of a scan: prefix sums within a block of 1024 elements, the block's total to sums
+static const char* scanShaderSource = R"(
+@group(0) @binding(1) var<storage, read> input : array<ELEMENT>;
+@group(0) @binding(2) var<storage, read_write> output : array<ELEMENT>;
+@group(0) @binding(3) var<storage, read_write> sums : array<ELEMENT>;
+
+var<workgroup> items : array<ELEMENT, 1024>;
+var<workgroup> partial : array<ELEMENT, 256>;
+
+fn load(i : u32) -> ELEMENT
+{
+    if (i < params.count)
+    {
+        return LOAD;
+    }
+    return ZERO;
+}
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    let blockId = blockIndex(wid);
+    let base = blockId * 1024u;
+
+    // Coalesced loads through workgroup memory, then every thread takes 4 consecutive elements
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        items[k * 256u + lid.x] = load(base + k * 256u + lid.x);
+    }
+    workgroupBarrier();
+
+    let first = lid.x * 4u;
+    var total : ELEMENT = ZERO;
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        total = total + items[first + k];
+    }
+    partial[lid.x] = total;
+    workgroupBarrier();
+
+    // Inclusive scan of the threads' totals
+    for (var offset = 1u; offset < 256u; offset = offset << 1u)
+    {
+        var v = partial[lid.x];
+        if (lid.x >= offset)
+        {
+            v = v + partial[lid.x - offset];
+        }
+        workgroupBarrier();
+        partial[lid.x] = v;
+        workgroupBarrier();
+    }
+
+    var prefix : ELEMENT = ZERO;
+    if (lid.x > 0u)
+    {
+        prefix = partial[lid.x - 1u];
+    }
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let next = prefix + items[first + k];
+        items[first + k] = select(prefix, next, params.inclusive != 0u);
+        prefix = next;
+    }
+    workgroupBarrier();
+
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let i = base + k * 256u + lid.x;
+        if (i < params.count)
+        {
+            output[i] = items[k * 256u + lid.x];
+        }
+    }
+
+    if (lid.x == 255u && base < params.count)
+    {
+        sums[blockId] = partial[255];
+    }
+}
+)";
+
+// Adds the scanned totals of the level above to every element of their block
+static const char* addShaderSource = R"(
+@group(0) @binding(1) var<storage, read> offsets : array<ELEMENT>;
+@group(0) @binding(2) var<storage, read_write> data : array<ELEMENT>;
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    let blockId = blockIndex(wid);
+    let base = blockId * 1024u;
+    if (base >= params.count)
+    {
+        return;
+    }
+
+    let offset = offsets[blockId];
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let i = base + k * 256u + lid.x;
+        if (i < params.count)
+        {
+            data[i] = data[i] + offset;
+        }
+    }
+}
+)";
+
+// Moves the flagged values to the positions given by the exclusive scan of the flags
+static const char* scatterShaderSource = R"(
+@group(0) @binding(1) var<storage, read> values : array<ELEMENT>;
+@group(0) @binding(2) var<storage, read> flags : array<u32>;
+@group(0) @binding(3) var<storage, read> offsets : array<u32>;
+@group(0) @binding(4) var<storage, read_write> output : array<ELEMENT>;
+@group(0) @binding(5) var<storage, read_write> outputCount : array<u32>;
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    let i = blockIndex(wid) * 256u + lid.x;
+    if (i >= params.count)
+    {
+        return;
+    }
+
+    let keep = flags[i] != 0u;
+    if (keep)
+    {
+        output[offsets[i]] = values[i];
+    }
+    if (i == params.count - 1u)
+    {
+        outputCount[0] = offsets[i] + select(0u, 1u, keep);
+    }
+}
+)";
+
+
+static std::string replaceAll(std::string s, const std::string& from, const std::string& to)
+{
+    for (size_t pos = s.find(from); pos != std::string::npos; pos = s.find(from, pos + to.size()))
+    {
+        s.replace(pos, from.size(), to);
+    }
+    return s;
+}
+
+
+static const char* typeName(GpuPrimitives::Type type)
+{
+    return type == GpuPrimitives::Type::U32 ? "u32" : "f32";
+}
+
+
+static const char* zeroOf(GpuPrimitives::Type type)
+{
+    return type == GpuPrimitives::Type::U32 ? "0u" : "0.0";
+}
+
+
+static const char* opName(GpuPrimitives::ReduceOp op)
+{
+    switch (op)
+    {
+    case GpuPrimitives::ReduceOp::Sum:
+        return "sum";
+    case GpuPrimitives::ReduceOp::Min:
+        return "min";
+    case GpuPrimitives::ReduceOp::Max:
+        return "max";
+    }
+    return "";
+}
+
+
+// Same values as referenceReduce() starts from
+static const char* identityOf(GpuPrimitives::Type type, GpuPrimitives::ReduceOp op)
+{
+    bool u32 = (type == GpuPrimitives::Type::U32);
+    switch (op)
+    {
+    case GpuPrimitives::ReduceOp::Sum:
+        return zeroOf(type);
+    case GpuPrimitives::ReduceOp::Min:
+        return u32 ? "4294967295u" : "3.40282347e+38";
+    case GpuPrimitives::ReduceOp::Max:
+        return u32 ? "0u" : "-3.40282347e+38";
+    }
+    return "";
+}
+
+
+static uint32_t identityBits(GpuPrimitives::Type type, GpuPrimitives::ReduceOp op)
+{
+    if (type == GpuPrimitives::Type::U32)
+    {
+        return referenceReduce<uint32_t>({}, op);
+    }
+
+    float value = referenceReduce<float>({}, op);
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+
+static std::string shaderSource(const char* source, GpuPrimitives::Type type)
+{
+    std::string wgsl = replaceAll(source, "ELEMENT", typeName(type));
+    return commonShaderSource + replaceAll(wgsl, "ZERO", zeroOf(type));
+}
+
+
+GpuPrimitives::GpuPrimitives(ComputeRuntime& runtime) :
+    runtime(runtime)
+{
+    params = runtime.createBuffer("Primitive params", paramsSlots * paramsStride, wgpu::BufferUsage::Uniform);
+    unusedSum = runtime.createBuffer("Primitive unused sum", sizeof(uint32_t));
+}
+
+
+GpuPrimitives::~GpuPrimitives()
+{
+    for (auto& level : levels)
+    {
+        if (level.sums)
+        {
+            runtime.destroyBuffer(level.sums);
+            runtime.destroyBuffer(level.scanned);
+        }
+    }
+    if (compactOffsets)
+    {
+        runtime.destroyBuffer(compactOffsets);
+    }
+    runtime.destroyBuffer(unusedSum);
+    runtime.destroyBuffer(params);
+}
+
+
+ComputeKernel& GpuPrimitives::kernel(const std::string& key, const std::string& wgsl)
+{
+    auto it = kernels.find(key);
+    if (it == kernels.end())
+    {
+        it = kernels.emplace(key, runtime.createKernel(key.c_str(), wgsl)).first;
+    }
+    return *it->second;
+}
+
+
+ComputeKernel& GpuPrimitives::reduceKernel(Type type, ReduceOp op)
+{
+    std::string key = std::string("Reduce ") + typeName(type) + " " + opName(op);
+    auto it = kernels.find(key);
+    if (it != kernels.end())
+        return *it->second;
+
+    std::string combine = (op == ReduceOp::Sum) ? "a + b" : std::string(opName(op)) + "(a, b)";
+    std::string wgsl = replaceAll(shaderSource(reduceShaderSource, type), "IDENTITY", identityOf(type, op));
+    return kernel(key, replaceAll(wgsl, "COMBINE", combine));
+}
+
+
+ComputeKernel& GpuPrimitives::scanKernel(Type type, bool flags)
+{
+    // Flags are counted as 0 or 1 whatever their value
+    std::string key = flags ? "Scan flags" : std::string("Scan ") + typeName(type);
+    auto it = kernels.find(key);
+    if (it != kernels.end())
+        return *it->second;
+
+    const char* load = flags ? "select(0u, 1u, input[i] != 0u)" : "input[i]";
+    return kernel(key, replaceAll(shaderSource(scanShaderSource, type), "LOAD", load));
+}
+
+
+ComputeKernel& GpuPrimitives::addKernel(Type type)
+{
+    std::string key = std::string("Scan add ") + typeName(type);
+    auto it = kernels.find(key);
+    if (it != kernels.end())
+        return *it->second;
+
+    return kernel(key, shaderSource(addShaderSource, type));
+}
+
+
+ComputeKernel& GpuPrimitives::scatterKernel(Type type)
+{
+    std::string key = std::string("Compact ") + typeName(type);
+    auto it = kernels.find(key);
+    if (it != kernels.end())
+        return *it->second;
+
+    return kernel(key, shaderSource(scatterShaderSource, type));
+}
+
+
+void GpuPrimitives::planLevels(uint32_t count)
+{
+    levelSizes.clear();
+    levelSizes.push_back(count);
+    while (levelSizes.back() > blockSize)
+    {
+        levelSizes.push_back(ComputeRuntime::groupCount(levelSizes.back(), blockSize));
+    }
+}
+
+
+void GpuPrimitives::growLevels()
+{
+    if (levels.size() < levelSizes.size())
+    {
+        levels.resize(levelSizes.size());
+    }
+
+    // Level 0 is the caller's input
+    for (size_t i = 1; i < levelSizes.size(); i++)
+    {
+        Level& level = levels[i];
+        if (level.capacity >= levelSizes[i])
+            continue;
+
+        if (level.sums)
+        {
+            runtime.destroyBuffer(level.sums);
+            runtime.destroyBuffer(level.scanned);
+        }
+        level.sums = runtime.createBuffer("Primitive block sums", (uint64_t)levelSizes[i] * sizeof(uint32_t));
+        level.scanned = runtime.createBuffer("Primitive scanned sums", (uint64_t)levelSizes[i] * sizeof(uint32_t));
+        level.capacity = levelSizes[i];
+    }
+}
+
+
+void GpuPrimitives::writeParams(bool inclusive, bool scatter)
+{
+    uint32_t maxGroups = runtime.maxWorkgroupsPerDimension();
+    for (uint32_t i = 0; i < (uint32_t)levelSizes.size(); i++)
+    {
+        Params p;
+        p.count = levelSizes[i];
+        p.groupsPerRow = std::min(ComputeRuntime::groupCount(levelSizes[i], blockSize), maxGroups);
+        // The levels above hold block totals, their exclusive scan is what gets added back
+        p.inclusive = (i == 0 && inclusive) ? 1 : 0;
+        p.padding = 0;
+        runtime.write(params, i * paramsStride, &p, sizeof(p));
+    }
+
+    if (scatter)
+    {
+        Params p;
+        p.count = levelSizes[0];
+        p.groupsPerRow = std::min(ComputeRuntime::groupCount(levelSizes[0], workgroupSize), maxGroups);
+        p.inclusive = 0;
+        p.padding = 0;
+        runtime.write(params, (uint32_t)levelSizes.size() * paramsStride, &p, sizeof(p));
+    }
+}
+
+
+void GpuPrimitives::bindParams(ComputeKernel& k, uint32_t slot)
+{
+    k.bind("params", params, (uint64_t)slot * paramsStride, sizeof(Params));
+}
+
+
+void GpuPrimitives::dispatchBlocks(ComputeKernel& k, uint32_t groups)
+{
+    // Rows as wide as a dimension allows, the kernels skip the blocks past the end
+    uint32_t x = std::min(groups, runtime.maxWorkgroupsPerDimension());
+    runtime.dispatch(k, x, ComputeRuntime::groupCount(groups, x));
+}
+
+
+void GpuPrimitives::reduce(Type type, ReduceOp op, wgpu::Buffer input, uint32_t count, wgpu::Buffer result)
+{
+    if (count == 0)
+    {
+        uint32_t identity = identityBits(type, op);
+        runtime.write(result, 0, &identity, sizeof(identity));
+        return;
+    }
+
+    planLevels(count);
+    growLevels();
+    writeParams(false, false);
+
+    ComputeKernel& k = reduceKernel(type, op);
+    uint32_t nLevels = (uint32_t)levelSizes.size();
+    for (uint32_t i = 0; i < nLevels; i++)
+    {
+        bindParams(k, i);
+        k.bind("input", i == 0 ? input : levels[i].sums);
+        k.bind("output", i + 1 < nLevels ? levels[i + 1].sums : result);
+        dispatchBlocks(k, ComputeRuntime::groupCount(levelSizes[i], blockSize));
+    }
+}
+
+
+void GpuPrimitives::scanLevels(Type type, bool flags, wgpu::Buffer input, wgpu::Buffer output)
+{
+    uint32_t nLevels = (uint32_t)levelSizes.size();
+
+    // Up: scan every level within its blocks, block totals go to the level above
+    for (uint32_t i = 0; i < nLevels; i++)
+    {
+        ComputeKernel& k = scanKernel(type, flags && i == 0);
+        bindParams(k, i);
+        k.bind("input", i == 0 ? input : levels[i].sums);
+        k.bind("output", i == 0 ? output : levels[i].scanned);
+        k.bind("sums", i + 1 < nLevels ? levels[i + 1].sums : unusedSum);
+        dispatchBlocks(k, ComputeRuntime::groupCount(levelSizes[i], blockSize));
+    }
+
+    // Down: add the scanned totals of the level above to their blocks
+    ComputeKernel& add = addKernel(type);
+    for (uint32_t i = nLevels - 1; i-- > 0;)
+    {
+        bindParams(add, i);
+        add.bind("offsets", levels[i + 1].scanned);
+        add.bind("data", i == 0 ? output : levels[i].scanned);
+        dispatchBlocks(add, ComputeRuntime::groupCount(levelSizes[i], blockSize));
+    }
+}
+
+
+void GpuPrimitives::scan(Type type, wgpu::Buffer input, wgpu::Buffer output, uint32_t count, bool inclusive)
+{
+    if (count == 0)
+        return;
+
+    planLevels(count);
+    growLevels();
+    writeParams(inclusive, false);
+    scanLevels(type, false, input, output);
+}
+
+
+void GpuPrimitives::compact(Type type, wgpu::Buffer values, wgpu::Buffer flags, uint32_t count,
+                            wgpu::Buffer output, wgpu::Buffer outputCount)
+{
+    if (count == 0)
+    {
+        uint32_t zero = 0;
+        runtime.write(outputCount, 0, &zero, sizeof(zero));
+        return;
+    }
+
+    planLevels(count);
+    growLevels();
+    if (compactCapacity < count)
+    {
+        if (compactOffsets)
+        {
+            runtime.destroyBuffer(compactOffsets);
+        }
+        compactOffsets = runtime.createBuffer("Compaction offsets", (uint64_t)count * sizeof(uint32_t));
+        compactCapacity = count;
+    }
+    writeParams(false, true);
+
+    // Where every flagged value goes: the exclusive scan of the flags
+    scanLevels(Type::U32, true, flags, compactOffsets);
+
+    ComputeKernel& k = scatterKernel(type);
+    bindParams(k, (uint32_t)levelSizes.size());
+    k.bind("values", values);
+    k.bind("flags", flags);
+    k.bind("offsets", compactOffsets);
+    k.bind("output", output);
+    k.bind("outputCount", outputCount);
+    dispatchBlocks(k, ComputeRuntime::groupCount(count, workgroupSize));
+}
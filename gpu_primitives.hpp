@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "compute_runtime.hpp"
+
+// Reduction, prefix scan and stream compaction over u32 and f32 storage buffers.
+// Large inputs go through a multi-level reduce-then-scan: every workgroup handles a block of
+// blockSize elements and writes its total to the level above, which is processed the same way
+// until it fits into one block; scanned totals are then added back down level by level.
+// WebGPU gives no forward progress guarantee between workgroups, so a single-pass decoupled
+// look-back could spin forever on some adapters (the fallback one included) and is not used.
+// Kernels are compiled on first use, scratch buffers grow to the largest input seen.
+// The work is recorded into the runtime's encoder; results are read back through the runtime.
+// Not thread-safe.
+class GpuPrimitives
+{
+public:
+    enum class Type
+    {
+        U32,
+        F32,
+    };
+
+    enum class ReduceOp
+    {
+        Sum,
+        Min,
+        Max,
+    };
+
+    // Must match the kernels
+    static constexpr uint32_t workgroupSize = 256;
+    static constexpr uint32_t itemsPerThread = 4;
+    static constexpr uint32_t blockSize = workgroupSize * itemsPerThread;
+
+    explicit GpuPrimitives(ComputeRuntime& runtime);
+    ~GpuPrimitives();
+
+    GpuPrimitives(const GpuPrimitives&) = delete;
+    GpuPrimitives& operator=(const GpuPrimitives&) = delete;
+
+    // Writes the sum, minimum or maximum of the first count elements to the first element of result.
+    // Sums of u32 wrap around.
+    void reduce(Type type, ReduceOp op, wgpu::Buffer input, uint32_t count, wgpu::Buffer result);
+    // Prefix sums of the first count elements; output must be another buffer than input
+    void scan(Type type, wgpu::Buffer input, wgpu::Buffer output, uint32_t count, bool inclusive);
+    // Copies the values whose u32 flag is non-zero to the front of output, keeping their order,
+    // and writes how many there are to the first u32 of outputCount
+    void compact(Type type, wgpu::Buffer values, wgpu::Buffer flags, uint32_t count,
+                 wgpu::Buffer output, wgpu::Buffer outputCount);
+
+private:
+    struct Params
+    {
+        uint32_t count;
+        // Workgroups per row of a 2D dispatch, when there are more than a dimension takes
+        uint32_t groupsPerRow;
+        uint32_t inclusive;
+        uint32_t padding;
+    };
+
+    // Uniform offsets must be aligned to minUniformBufferOffsetAlignment, 256 is the largest it can be
+    static constexpr uint32_t paramsStride = 256;
+    // Enough for the levels of 2^32 elements and a scatter
+    static constexpr uint32_t paramsSlots = 8;
+
+    // Per level above the first: block totals and their scan
+    struct Level
+    {
+        wgpu::Buffer sums = nullptr;
+        wgpu::Buffer scanned = nullptr;
+        uint32_t capacity = 0;
+    };
+
+    ComputeKernel& kernel(const std::string& key, const std::string& wgsl);
+    ComputeKernel& reduceKernel(Type type, ReduceOp op);
+    ComputeKernel& scanKernel(Type type, bool flags);
+    ComputeKernel& addKernel(Type type);
+    ComputeKernel& scatterKernel(Type type);
+
+    // Sizes of the levels for count elements, down to one that fits into a block
+    void planLevels(uint32_t count);
+    void growLevels();
+    // Writes the params of every level, and the scatter's in the slot after them
+    void writeParams(bool inclusive, bool scatter);
+    void bindParams(ComputeKernel& k, uint32_t slot);
+    void dispatchBlocks(ComputeKernel& k, uint32_t groups);
+    // Scans levelSizes[0] elements of input into output, exclusively at the levels above the first
+    void scanLevels(Type type, bool flags, wgpu::Buffer input, wgpu::Buffer output);
+
+    ComputeRuntime& runtime;
+    std::unordered_map<std::string, std::unique_ptr<ComputeKernel>> kernels;
+
+    wgpu::Buffer params = nullptr;
+    std::vector<uint32_t> levelSizes;
+    std::vector<Level> levels;
+    // Where the last level writes its total, nobody reads it
+    wgpu::Buffer unusedSum = nullptr;
+    wgpu::Buffer compactOffsets = nullptr;
+    uint32_t compactCapacity = 0;
+};
+
+
+// CPU references of the primitives, the GPU results are checked against them
+
+template<typename T>
+T referenceReduce(const std::vector<T>& values, GpuPrimitives::ReduceOp op)
+{
+    T result = 0;
+    if (op == GpuPrimitives::ReduceOp::Min)
+    {
+        result = std::numeric_limits<T>::max();
+    }
+    else if (op == GpuPrimitives::ReduceOp::Max)
+    {
+        result = std::numeric_limits<T>::lowest();
+    }
+
+    for (T v : values)
+    {
+        switch (op)
+        {
+        case GpuPrimitives::ReduceOp::Sum:
+            result += v;
+            break;
+        case GpuPrimitives::ReduceOp::Min:
+            result = std::min(result, v);
+            break;
+        case GpuPrimitives::ReduceOp::Max:
+            result = std::max(result, v);
+            break;
+        }
+    }
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> referenceScan(const std::vector<T>& values, bool inclusive)
+{
+    std::vector<T> result(values.size());
+    T sum = 0;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (inclusive)
+        {
+            sum += values[i];
+            result[i] = sum;
+        }
+        else
+        {
+            result[i] = sum;
+            sum += values[i];
+        }
+    }
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> referenceCompact(const std::vector<T>& values, const std::vector<uint32_t>& flags)
+{
+    std::vector<T> result;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (flags[i] != 0)
+        {
+            result.push_back(values[i]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,279 @@
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "gpu_profiler.hpp"
+#include "gpu_future.hpp"
+
+constexpr uint64_t timestampSize = sizeof(uint64_t);
+constexpr uint64_t queriesSize = GpuProfiler::maxPassesPerFrame * 2 * timestampSize;
+
+
+GpuProfiler::GpuProfiler(wgpu::Device device, wgpu::Queue queue) :
+    device(device),
+    queue(queue)
+{
+    supported = device.hasFeature(wgpu::FeatureName::TimestampQuery);
+    if (!supported)
+    {
+        std::cout << "GPU profiler: no TimestampQuery feature, pass timings are disabled" << std::endl;
+        return;
+    }
+#ifdef WEBGPU_BACKEND_WGPU
+    // wgpu-native resolves raw ticks whose period depends on the GPU and does not report that period,
+    // taking them for nanoseconds gives wrong milliseconds on many devices
+    supported = false;
+    std::cout << "GPU profiler: wgpu-native does not report the timestamp period, pass timings are disabled"
+              << std::endl;
+    return;
+#endif
+
+    wgpu::QuerySetDescriptor querySetDesc;
+    querySetDesc.setDefault();
+    querySetDesc.label = "GPU profiler timestamps";
+    querySetDesc.type = wgpu::QueryType::Timestamp;
+    querySetDesc.count = maxPassesPerFrame * 2;
+    querySet = device.createQuerySet(querySetDesc);
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "GPU profiler resolve";
+    bufferDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+    bufferDesc.size = queriesSize;
+    bufferDesc.mappedAtCreation = false;
+    resolveBuffer = device.createBuffer(bufferDesc);
+
+    for (uint32_t i = 0; i < readbackRingSize; i++)
+    {
+        Readback& r = ring[i];
+        r.owner = this;
+        r.index = i;
+        bufferDesc.label = "GPU profiler readback";
+        bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        r.buffer = device.createBuffer(bufferDesc);
+    }
+}
+
+
+GpuProfiler::~GpuProfiler()
+{
+    if (!supported)
+        return;
+
+    printStats();
+
+    // Map callbacks point to this object, let them finish
+    auto start = std::chrono::steady_clock::now();
+    bool pending = true;
+    while (pending && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        pending = false;
+        for (const auto& r : ring)
+        {
+            pending = pending || r.busy;
+        }
+        if (pending)
+        {
+            processEvents(device);
+            std::this_thread::yield();
+        }
+    }
+
+    // Destroying a buffer cancels its pending map, the callback fires before the object is gone
+    for (auto& r : ring)
+    {
+        r.buffer.destroy();
+        r.buffer.release();
+    }
+    resolveBuffer.destroy();
+    resolveBuffer.release();
+    querySet.destroy();
+    querySet.release();
+}
+
+
+void GpuProfiler::beginFrame()
+{
+    currentSlot = -1;
+    currentPasses = 0;
+    if (!supported)
+        return;
+
+    for (uint32_t i = 0; i < readbackRingSize; i++)
+    {
+        if (!ring[i].busy)
+        {
+            currentSlot = (int)i;
+            break;
+        }
+    }
+
+    if (currentSlot < 0)
+    {
+        skippedFrames++;
+    }
+}
+
+
+uint32_t GpuProfiler::passId(const char* name)
+{
+    for (uint32_t i = 0; i < stats.size(); i++)
+    {
+        if (stats[i].name == name)
+            return i;
+    }
+    stats.push_back({ name, SlidingStats(256) });
+    return (uint32_t)stats.size() - 1;
+}
+
+
+int GpuProfiler::addPass(const char* name)
+{
+    std::lock_guard<std::mutex> lock(passMutex);
+    if (currentSlot < 0 || currentPasses >= maxPassesPerFrame)
+        return -1;
+
+    ring[currentSlot].passIds[currentPasses] = passId(name);
+    return (int)(currentPasses++);
+}
+
+
+void GpuProfiler::instrument(wgpu::RenderPassDescriptor& desc, const char* name)
+{
+    int pass = addPass(name);
+    if (pass < 0)
+        return;
+
+    auto& writes = renderWrites[pass];
+    writes[0].querySet = querySet;
+    writes[0].queryIndex = (uint32_t)pass * 2;
+    writes[0].location = wgpu::RenderPassTimestampLocation::Beginning;
+    writes[1].querySet = querySet;
+    writes[1].queryIndex = (uint32_t)pass * 2 + 1;
+    writes[1].location = wgpu::RenderPassTimestampLocation::End;
+
+    desc.timestampWriteCount = writes.size();
+    desc.timestampWrites = writes.data();
+}
+
+
+void GpuProfiler::instrument(wgpu::ComputePassDescriptor& desc, const char* name)
+{
+    int pass = addPass(name);
+    if (pass < 0)
+        return;
+
+    auto& writes = computeWrites[pass];
+    writes[0].querySet = querySet;
+    writes[0].queryIndex = (uint32_t)pass * 2;
+    writes[0].location = wgpu::ComputePassTimestampLocation::Beginning;
+    writes[1].querySet = querySet;
+    writes[1].queryIndex = (uint32_t)pass * 2 + 1;
+    writes[1].location = wgpu::ComputePassTimestampLocation::End;
+
+    desc.timestampWriteCount = writes.size();
+    desc.timestampWrites = writes.data();
+}
+
+
+void GpuProfiler::resolve(wgpu::CommandEncoder encoder)
+{
+    if (currentSlot < 0 || currentPasses == 0)
+        return;
+
+    Readback& r = ring[currentSlot];
+    uint64_t size = currentPasses * 2 * timestampSize;
+    encoder.resolveQuerySet(querySet, 0, currentPasses * 2, resolveBuffer, 0);
+    encoder.copyBufferToBuffer(resolveBuffer, 0, r.buffer, 0, size);
+
+    r.passCount = currentPasses;
+    r.busy = true;
+}
+
+
+void GpuProfiler::endFrame()
+{
+    if (currentSlot < 0 || !ring[currentSlot].busy)
+        return;
+
+    Readback& r = ring[currentSlot];
+    wgpuBufferMapAsync(r.buffer, wgpu::MapMode::Read, 0, r.passCount * 2 * timestampSize, mapCallback, &r);
+
+    currentSlot = -1;
+}
+
+
+void GpuProfiler::mapCallback(WGPUBufferMapAsyncStatus status, void* userdata)
+{
+    Readback& r = *reinterpret_cast<Readback*>(userdata);
+    r.owner->onMapped(r.index, status);
+}
+
+
+void GpuProfiler::onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status)
+{
+    Readback& r = ring[slot];
+    if (status == wgpu::BufferMapAsyncStatus::Success)
+    {
+        std::array<uint64_t, maxPassesPerFrame * 2> timestamps;
+        const void* data = r.buffer.getConstMappedRange(0, r.passCount * 2 * timestampSize);
+        std::memcpy(timestamps.data(), data, r.passCount * 2 * timestampSize);
+        r.buffer.unmap();
+
+        double frameTotal = 0.0;
+        for (uint32_t i = 0; i < r.passCount; i++)
+        {
+            uint64_t begin = timestamps[i * 2];
+            uint64_t end = timestamps[i * 2 + 1];
+            // Some drivers return zeros or reordered values for passes they merged or skipped
+            if (end >= begin && begin != 0)
+            {
+                // Dawn reports timestamps in nanoseconds, the only backend the profiler runs on
+                double ms = (end - begin) * 1e-6;
+                stats[r.passIds[i]].ms.add(ms);
+                frameTotal += ms;
+            }
+        }
+        if (r.passCount)
+        {
+            frameMs.add(frameTotal);
+        }
+    }
+
+    r.busy = false;
+    r.passCount = 0;
+}
+
+
+void GpuProfiler::clearStats()
+{
+    std::lock_guard<std::mutex> lock(passMutex);
+    for (auto& s : stats)
+    {
+        s.ms.clear();
+    }
+    frameMs.clear();
+}
+
+
+void GpuProfiler::printStats() const
+{
+    if (!supported)
+        return;
+
+    std::cout << "GPU pass timings, ms (min / avg / p99 over the last frames):" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& s : stats)
+    {
+        if (s.ms.empty())
+            continue;
+        std::cout << " - " << std::left << std::setw(24) << s.name << std::right << " "
+                  << s.ms.min() << " / " << s.ms.avg() << " / " << s.ms.percentile(99)
+                  << " (" << s.ms.total() << " frames)" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+    if (skippedFrames)
+    {
+        std::cout << " " << skippedFrames << " frames not measured, readback was behind" << std::endl;
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "sliding_stats.hpp"
+
+// Measures GPU time of render and compute passes with timestamp queries.
+// Each instrumented pass gets a begin/end timestamp pair, the queries are resolved at the end
+// of the frame and copied into one of the ring of map buffers, which is read back asynchronously.
+// If the device has no TimestampQuery feature, or on wgpu-native whose timestamps are in ticks of an
+// unknown period, all calls do nothing.
+class GpuProfiler
+{
+public:
+    static constexpr uint32_t maxPassesPerFrame = 16;
+    // Frames whose timings may be on their way back at the same time;
+    // a frame that finds no free buffer is not measured rather than stalled
+    static constexpr uint32_t readbackRingSize = 4;
+
+    GpuProfiler(wgpu::Device device, wgpu::Queue queue);
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    bool enabled() const
+    {
+        return supported;
+    }
+
+    void beginFrame();
+    // Adds timestamp writes to the pass, the writes stay valid until the next beginFrame().
+    // Can be called from several encoding threads at once.
+    void instrument(wgpu::RenderPassDescriptor& desc, const char* name);
+    void instrument(wgpu::ComputePassDescriptor& desc, const char* name);
+    // Resolves this frame's queries, call before encoder.finish()
+    void resolve(wgpu::CommandEncoder encoder);
+    // Starts the readback, call after queue.submit()
+    void endFrame();
+
+    // Per-pass GPU milliseconds, min/avg/p99 over the last frames
+    void printStats() const;
+
+    // GPU milliseconds of whole frames, the sum of their measured passes
+    const SlidingStats& frameStats() const
+    {
+        return frameMs;
+    }
+    // Forgets the timings so far, frames still on their way back are counted after it
+    void clearStats();
+
+private:
+    struct PassStats
+    {
+        std::string name;
+        SlidingStats ms;
+    };
+
+    struct Readback
+    {
+        // Map callback userdata, the C API is used so that a frame does not allocate a callback object
+        GpuProfiler* owner = nullptr;
+        uint32_t index = 0;
+        wgpu::Buffer buffer = nullptr;
+        // Busy from resolve() until the map callback has consumed the data
+        bool busy = false;
+        uint32_t passCount = 0;
+        std::array<uint32_t, maxPassesPerFrame> passIds {};
+    };
+
+    // Returns the index of a new pass, or -1 if it cannot be measured
+    int addPass(const char* name);
+    uint32_t passId(const char* name);
+    static void mapCallback(WGPUBufferMapAsyncStatus status, void* userdata);
+    void onMapped(uint32_t slot, wgpu::BufferMapAsyncStatus status);
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    bool supported = false;
+
+    wgpu::QuerySet querySet = nullptr;
+    wgpu::Buffer resolveBuffer = nullptr;
+    std::array<Readback, readbackRingSize> ring;
+
+    // Current frame
+    int currentSlot = -1;
+    uint32_t currentPasses = 0;
+    std::array<std::array<wgpu::RenderPassTimestampWrite, 2>, maxPassesPerFrame> renderWrites;
+    std::array<std::array<wgpu::ComputePassTimestampWrite, 2>, maxPassesPerFrame> computeWrites;
+    // Guards current frame passes and stats names
+    std::mutex passMutex;
+
+    std::vector<PassStats> stats;
+    SlidingStats frameMs;
+    uint64_t skippedFrames = 0;
+};
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <string>
+
+#include "gpu_radix_sort.hpp"
+
+// The numbers are workgroupSize, itemsPerThread, blockSize and digitCount
+static const char* commonShaderSource = R"(
+struct Params
+{
+    count : u32,
+    groupsPerRow : u32,
+    shift : u32,
+    blockCount : u32,
+    flip : u32,
+    padding0 : u32,
+    padding1 : u32,
+    padding2 : u32,
+};
+
+@group(0) @binding(0) var<uniform> params : Params;
+
+fn blockIndex(wid : vec3<u32>) -> u32
+{
+    return wid.y * params.groupsPerRow + wid.x;
+}
+
+fn digitOf(key : u32) -> u32
+{
+    return ((key >> params.shift) & 15u) ^ params.flip;
+}
+)";
+
+// Counts the digits of a block, the counts of a digit over all blocks are consecutive
+static const char* histogramShaderSource = R"(
+@group(0) @binding(1) var<storage, read> keys : array<u32>;
+@group(0) @binding(2) var<storage, read_write> histograms : array<u32>;
+
+var<workgroup> counts : array<atomic<u32>, 16>;
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    if (lid.x < 16u)
+    {
+        atomicStore(&counts[lid.x], 0u);
+    }
+    workgroupBarrier();
+
+    let blockId = blockIndex(wid);
+    let base = blockId * 1024u;
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let i = base + k * 256u + lid.x;
+        if (i < params.count)
+        {
+            atomicAdd(&counts[digitOf(keys[i])], 1u);
+        }
+    }
+    workgroupBarrier();
+
+    if (lid.x < 16u && blockId < params.blockCount)
+    {
+        histograms[lid.x * params.blockCount + blockId] = atomicLoad(&counts[lid.x]);
+    }
+}
+)";
+
+// Moves every key to the place of its digit in its block plus its rank among the same digits
+// of the block. Every thread takes 4 consecutive keys, so ranks follow the input order.
+static const char* scatterShaderSource = R"(
+@group(0) @binding(1) var<storage, read> keysIn : array<u32>;
+@group(0) @binding(2) var<storage, read_write> keysOut : array<u32>;
+@group(0) @binding(3) var<storage, read> offsets : array<u32>;
+VALUES_DECLARATION
+
+// Per thread 8 words of two 16-bit digit counts, a block has no more than 1024 of a digit
+var<workgroup> counts : array<u32, 2048>;
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wid : vec3<u32>, @builtin(local_invocation_id) lid : vec3<u32>)
+{
+    let blockId = blockIndex(wid);
+    let first = blockId * 1024u + lid.x * 4u;
+
+    var own : array<u32, 8>;
+    for (var w = 0u; w < 8u; w = w + 1u)
+    {
+        own[w] = 0u;
+    }
+
+    // 16 marks an element past the end
+    var digits : array<u32, 4>;
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        var d = 16u;
+        if (first + k < params.count)
+        {
+            d = digitOf(keysIn[first + k]);
+            own[d >> 1u] = own[d >> 1u] + (1u << ((d & 1u) * 16u));
+        }
+        digits[k] = d;
+    }
+
+    for (var w = 0u; w < 8u; w = w + 1u)
+    {
+        counts[lid.x * 8u + w] = own[w];
+    }
+    workgroupBarrier();
+
+    // Inclusive scan of the packed counts over the threads, lanes never carry into each other
+    for (var offset = 1u; offset < 256u; offset = offset << 1u)
+    {
+        var v : array<u32, 8>;
+        for (var w = 0u; w < 8u; w = w + 1u)
+        {
+            v[w] = counts[lid.x * 8u + w];
+            if (lid.x >= offset)
+            {
+                v[w] = v[w] + counts[(lid.x - offset) * 8u + w];
+            }
+        }
+        workgroupBarrier();
+        for (var w = 0u; w < 8u; w = w + 1u)
+        {
+            counts[lid.x * 8u + w] = v[w];
+        }
+        workgroupBarrier();
+    }
+
+    // Same digits in the threads before this one
+    var rank : array<u32, 8>;
+    for (var w = 0u; w < 8u; w = w + 1u)
+    {
+        rank[w] = counts[lid.x * 8u + w] - own[w];
+    }
+
+    for (var k = 0u; k < 4u; k = k + 1u)
+    {
+        let d = digits[k];
+        if (d < 16u)
+        {
+            let lane = (d & 1u) * 16u;
+            let dst = offsets[d * params.blockCount + blockId] + ((rank[d >> 1u] >> lane) & 0xffffu);
+            rank[d >> 1u] = rank[d >> 1u] + (1u << lane);
+
+            let i = first + k;
+            keysOut[dst] = keysIn[i];
+            VALUES_MOVE
+        }
+    }
+}
+)";
+
+static const char* valuesDeclaration = R"(
+@group(0) @binding(4) var<storage, read> valuesIn : array<u32>;
+@group(0) @binding(5) var<storage, read_write> valuesOut : array<u32>;
+)";
+
+
+static std::string scatterSource(bool withValues)
+{
+    std::string wgsl = std::string(commonShaderSource) + scatterShaderSource;
+    wgsl.replace(wgsl.find("VALUES_DECLARATION"), 18, withValues ? valuesDeclaration : "");
+    wgsl.replace(wgsl.find("VALUES_MOVE"), 11, withValues ? "valuesOut[dst] = valuesIn[i];" : "");
+    return wgsl;
+}
+
+
+GpuRadixSort::GpuRadixSort(ComputeRuntime& runtime, GpuPrimitives& primitives) :
+    runtime(runtime),
+    primitives(primitives)
+{
+    histogramKernel = runtime.createKernel("Radix sort histogram",
+                                           std::string(commonShaderSource) + histogramShaderSource);
+    scatterKeysKernel = runtime.createKernel("Radix sort scatter keys", scatterSource(false));
+    params = runtime.createBuffer("Radix sort params", maxPasses * paramsStride, wgpu::BufferUsage::Uniform);
+}
+
+
+GpuRadixSort::~GpuRadixSort()
+{
+    for (wgpu::Buffer buffer : { histograms, offsets, scratchKeys, scratchValues })
+    {
+        if (buffer)
+        {
+            runtime.destroyBuffer(buffer);
+        }
+    }
+    runtime.destroyBuffer(params);
+}
+
+
+void GpuRadixSort::grow(uint32_t count, uint32_t blockCount, bool withValues)
+{
+    if (histogramCapacity < blockCount)
+    {
+        if (histograms)
+        {
+            runtime.destroyBuffer(histograms);
+            runtime.destroyBuffer(offsets);
+        }
+        uint64_t size = (uint64_t)blockCount * digitCount * sizeof(uint32_t);
+        histograms = runtime.createBuffer("Radix sort histograms", size);
+        offsets = runtime.createBuffer("Radix sort offsets", size);
+        histogramCapacity = blockCount;
+    }
+
+    if (keyCapacity < count)
+    {
+        if (scratchKeys)
+        {
+            runtime.destroyBuffer(scratchKeys);
+        }
+        scratchKeys = runtime.createBuffer("Radix sort keys", (uint64_t)count * sizeof(uint32_t));
+        keyCapacity = count;
+    }
+
+    if (withValues && valueCapacity < count)
+    {
+        if (scratchValues)
+        {
+            runtime.destroyBuffer(scratchValues);
+        }
+        scratchValues = runtime.createBuffer("Radix sort values", (uint64_t)count * sizeof(uint32_t));
+        valueCapacity = count;
+    }
+}
+
+
+void GpuRadixSort::dispatchBlocks(ComputeKernel& k, uint32_t groups)
+{
+    uint32_t x = std::min(groups, runtime.maxWorkgroupsPerDimension());
+    runtime.dispatch(k, x, ComputeRuntime::groupCount(groups, x));
+}
+
+
+void GpuRadixSort::sort(wgpu::Buffer keys, wgpu::Buffer values, uint32_t count, uint32_t keyBits, bool descending)
+{
+    if (count < 2)
+        return;
+
+    bool withValues = (bool)values;
+    uint32_t passes = ComputeRuntime::groupCount(std::clamp(keyBits, 1u, 32u), bitsPerPass);
+    uint32_t blockCount = ComputeRuntime::groupCount(count, blockSize);
+    grow(count, blockCount, withValues);
+
+    if (withValues && !scatterPairsKernel)
+    {
+        scatterPairsKernel = runtime.createKernel("Radix sort scatter pairs", scatterSource(true));
+    }
+
+    // All passes' params go before their dispatches are recorded
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+        Params p = {};
+        p.count = count;
+        p.groupsPerRow = std::min(blockCount, runtime.maxWorkgroupsPerDimension());
+        p.shift = pass * bitsPerPass;
+        p.blockCount = blockCount;
+        p.flip = descending ? digitCount - 1 : 0;
+        runtime.write(params, pass * paramsStride, &p, sizeof(p));
+    }
+
+    ComputeKernel& scatter = withValues ? *scatterPairsKernel : *scatterKeysKernel;
+    wgpu::Buffer keysIn = keys;
+    wgpu::Buffer keysOut = scratchKeys;
+    wgpu::Buffer valuesIn = values;
+    wgpu::Buffer valuesOut = scratchValues;
+    for (uint32_t pass = 0; pass < passes; pass++)
+    {
+        histogramKernel->bind("params", params, pass * paramsStride, sizeof(Params));
+        histogramKernel->bind("keys", keysIn);
+        histogramKernel->bind("histograms", histograms);
+        dispatchBlocks(*histogramKernel, blockCount);
+
+        // Where each block's keys of each digit start in the output
+        primitives.scan(GpuPrimitives::Type::U32, histograms, offsets, blockCount * digitCount, false);
+
+        scatter.bind("params", params, pass * paramsStride, sizeof(Params));
+        scatter.bind("keysIn", keysIn);
+        scatter.bind("keysOut", keysOut);
+        scatter.bind("offsets", offsets);
+        if (withValues)
+        {
+            scatter.bind("valuesIn", valuesIn);
+            scatter.bind("valuesOut", valuesOut);
+        }
+        dispatchBlocks(scatter, blockCount);
+
+        std::swap(keysIn, keysOut);
+        std::swap(valuesIn, valuesOut);
+    }
+
+    if (passes % 2 != 0)
+    {
+        runtime.copy(keysIn, 0, keys, 0, (uint64_t)count * sizeof(uint32_t));
+        if (withValues)
+        {
+            runtime.copy(valuesIn, 0, values, 0, (uint64_t)count * sizeof(uint32_t));
+        }
+    }
+}
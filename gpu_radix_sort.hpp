@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <webgpu/webgpu.hpp>
+
+#include "compute_runtime.hpp"
+#include "gpu_primitives.hpp"
+
+// Stable LSD radix sort of u32 keys, with optional u32 values, in existing storage buffers.
+// Every pass sorts by 4 bits: a histogram of the digits per block of blockSize keys, an exclusive
+// scan of the histograms laid out digit by digit (which gives every block the place of each of
+// its digits in the output) and a scatter which ranks the keys within their block.
+// Keys ping-pong with a scratch buffer; after an even number of passes they are back in place,
+// after an odd one they are copied back. Non-negative floats sort correctly by their bits.
+// The work is recorded into the runtime, so sorting needs no CPU round trip. Not thread-safe.
+class GpuRadixSort
+{
+public:
+    // Must match the kernels
+    static constexpr uint32_t bitsPerPass = 4;
+    static constexpr uint32_t digitCount = 1 << bitsPerPass;
+    static constexpr uint32_t workgroupSize = 256;
+    static constexpr uint32_t itemsPerThread = 4;
+    static constexpr uint32_t blockSize = workgroupSize * itemsPerThread;
+
+    GpuRadixSort(ComputeRuntime& runtime, GpuPrimitives& primitives);
+    ~GpuRadixSort();
+
+    GpuRadixSort(const GpuRadixSort&) = delete;
+    GpuRadixSort& operator=(const GpuRadixSort&) = delete;
+
+    // Sorts the first count keys, and as many values along with them unless values is null.
+    // Only the lowest keyBits bits, rounded up to whole passes, are compared; fewer bits take fewer passes.
+    void sort(wgpu::Buffer keys, wgpu::Buffer values, uint32_t count, uint32_t keyBits = 32,
+              bool descending = false);
+
+private:
+    struct Params
+    {
+        uint32_t count;
+        // Workgroups per row of a 2D dispatch
+        uint32_t groupsPerRow;
+        uint32_t shift;
+        uint32_t blockCount;
+        // Digits are xor-ed with it, digitCount - 1 sorts in descending order
+        uint32_t flip;
+        uint32_t padding[3];
+    };
+
+    // Uniform offsets must be aligned to minUniformBufferOffsetAlignment, 256 is the largest it can be
+    static constexpr uint32_t paramsStride = 256;
+    static constexpr uint32_t maxPasses = 32 / bitsPerPass;
+
+    void grow(uint32_t count, uint32_t blockCount, bool withValues);
+    void dispatchBlocks(ComputeKernel& k, uint32_t groups);
+
+    ComputeRuntime& runtime;
+    GpuPrimitives& primitives;
+
+    std::unique_ptr<ComputeKernel> histogramKernel;
+    std::unique_ptr<ComputeKernel> scatterKeysKernel;
+    // Compiled on first use
+    std::unique_ptr<ComputeKernel> scatterPairsKernel;
+
+    wgpu::Buffer params = nullptr;
+    wgpu::Buffer histograms = nullptr;
+    wgpu::Buffer offsets = nullptr;
+    uint32_t histogramCapacity = 0;
+    wgpu::Buffer scratchKeys = nullptr;
+    wgpu::Buffer scratchValues = nullptr;
+    uint32_t keyCapacity = 0;
+    uint32_t valueCapacity = 0;
+};
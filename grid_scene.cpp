@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "grid_scene.hpp"
+#include "hash.hpp"
+#include "shader_module.hpp"
+
+static const char* gridShaderSource = R"(
+struct Object
+{
+    offsetScale : vec4<f32>,
+    color : vec4<f32>,
+};
+
+@group(0) @binding(0) var<uniform> object : Object;
+
+@vertex
+fn vs_main(@location(0) corner : vec2<f32>) -> @builtin(position) vec4<f32>
+{
+    let p = corner * object.offsetScale.zw + object.offsetScale.xy;
+    return vec4<f32>(p, 0.5, 1.0);
+}
+
+@fragment
+fn fs_main() -> @location(0) vec4<f32>
+{
+    return object.color;
+}
+)";
+
+// Two triangles of a unit quad
+static const float quadCorners[] =
+{
+    -1.0f, -1.0f,   1.0f, -1.0f,   1.0f, 1.0f,
+    -1.0f, -1.0f,   1.0f,  1.0f,  -1.0f, 1.0f,
+};
+
+
+GridScene::GridScene(wgpu::Device device, BlobCache* cache, PipelineCache& pipelines, BindGroupCache& bindGroups,
+                     wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat, uint32_t objectCount,
+                     bool useBundles) :
+    device(device),
+    pipelines(pipelines),
+    bindGroups(bindGroups),
+    offsets(objectCount, 0)
+{
+    columns = std::max(1u, (uint32_t)std::ceil(std::sqrt((double)objectCount)));
+
+    shaderModule = createShaderModule(device, "Grid shader", gridShaderSource, cache);
+
+    wgpu::BindGroupLayoutEntry entry;
+    entry.setDefault();
+    entry.binding = 0;
+    entry.visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
+    entry.buffer.type = wgpu::BufferBindingType::Uniform;
+    entry.buffer.hasDynamicOffset = true;
+    entry.buffer.minBindingSize = sizeof(ObjectUniforms);
+
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+    bindGroupLayoutDesc.label = "Grid objects";
+    bindGroupLayoutDesc.entryCount = 1;
+    bindGroupLayoutDesc.entries = &entry;
+    bindGroupLayout = bindGroups.getLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "Grid";
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    colorTarget.format = colorFormat;
+    colorTarget.blend = nullptr;
+    colorTarget.writeMask = wgpu::ColorWriteMask::All;
+
+    fragment.module = shaderModule;
+    fragment.entryPoint = "fs_main";
+    fragment.constantCount = 0;
+    fragment.constants = nullptr;
+    fragment.targetCount = 1;
+    fragment.targets = &colorTarget;
+
+    depthStencil.setDefault();
+    depthStencil.format = depthFormat;
+    depthStencil.depthWriteEnabled = true;
+    depthStencil.depthCompare = wgpu::CompareFunction::Less;
+    depthStencil.stencilReadMask = 0;
+    depthStencil.stencilWriteMask = 0;
+
+    pipelineDesc.label = "Grid";
+    pipelineDesc.layout = pipelineLayout;
+    pipelineDesc.vertex.module = shaderModule;
+    pipelineDesc.vertex.entryPoint = "vs_main";
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants = nullptr;
+    cornerAttribute.format = wgpu::VertexFormat::Float32x2;
+    cornerAttribute.offset = 0;
+    cornerAttribute.shaderLocation = 0;
+
+    vertexLayout.arrayStride = 2 * sizeof(float);
+    vertexLayout.stepMode = wgpu::VertexStepMode::Vertex;
+    vertexLayout.attributeCount = 1;
+    vertexLayout.attributes = &cornerAttribute;
+
+    pipelineDesc.vertex.bufferCount = 1;
+    pipelineDesc.vertex.buffers = &vertexLayout;
+    pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+    pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+    pipelineDesc.depthStencil = &depthStencil;
+    pipelineDesc.multisample.count = 1;
+    pipelineDesc.multisample.mask = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+    pipelineDesc.fragment = &fragment;
+    // Compiled in the background, the first frames are drawn without the grid
+    pipelines.getRenderPipeline(pipelineDesc);
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Grid vertices";
+    bufferDesc.usage = wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+    bufferDesc.size = sizeof(quadCorners);
+    bufferDesc.mappedAtCreation = false;
+    vertexBuffer = device.createBuffer(bufferDesc);
+
+    if (useBundles)
+    {
+        for (auto& b : bundles)
+        {
+            b = std::make_unique<StaticBundle>(device, "Grid draws", colorFormat, depthFormat);
+        }
+    }
+
+    std::cout << "Grid scene: " << objectCount << " objects" << (useBundles ? ", render bundles" : "") << std::endl;
+}
+
+
+GridScene::~GridScene()
+{
+    vertexBuffer.destroy();
+    vertexBuffer.release();
+    // A later scene may get the same addresses, its pipelines must not come from these
+    pipelines.forget(pipelineLayout);
+    pipelines.forget(shaderModule);
+    pipelineLayout.release();
+    shaderModule.release();
+}
+
+
+void GridScene::upload(StagingBelt& belt, wgpu::CommandEncoder encoder)
+{
+    void* dst = belt.writeBuffer(encoder, vertexBuffer, 0, sizeof(quadCorners));
+    std::memcpy(dst, quadCorners, sizeof(quadCorners));
+    uploaded = true;
+}
+
+
+void GridScene::update(UniformRing& ring, double seconds)
+{
+    // A hit on every frame after the first ones
+    pipeline = pipelines.getRenderPipeline(pipelineDesc);
+
+    const uint32_t rows = ((uint32_t)offsets.size() + columns - 1) / columns;
+    const float cellWidth = 2.0f / (float)columns;
+    const float cellHeight = 2.0f / (float)std::max(rows, 1u);
+
+    for (uint32_t i = 0; i < offsets.size(); i++)
+    {
+        uint32_t col = i % columns;
+        uint32_t row = i / columns;
+        float phase = (float)seconds * 2.0f + (float)i * 0.37f;
+        float pulse = 0.35f + 0.1f * std::sin(phase);
+
+        ObjectUniforms u;
+        u.offsetScale = { -1.0f + cellWidth * ((float)col + 0.5f),
+                          -1.0f + cellHeight * ((float)row + 0.5f),
+                          cellWidth * pulse, cellHeight * pulse };
+        u.color = { 0.5f + 0.5f * std::sin(phase),
+                    0.5f + 0.5f * std::sin(phase + 2.1f),
+                    0.5f + 0.5f * std::sin(phase + 4.2f), 1.0f };
+        offsets[i] = ring.push(u);
+    }
+}
+
+
+void GridScene::draw(wgpu::RenderPassEncoder pass, const UniformRing& ring, uint32_t slot)
+{
+    // Still compiling
+    if (offsets.empty() || !pipeline)
+        return;
+
+    // The same entry every frame, a hit unless the ring has grown
+    wgpu::BindGroupEntry entry;
+    entry.binding = 0;
+    entry.buffer = ring.buffer(slot);
+    entry.offset = 0;
+    entry.size = sizeof(ObjectUniforms);
+    entry.sampler = nullptr;
+    entry.textureView = nullptr;
+    wgpu::BindGroup bindGroup = bindGroups.get(bindGroupLayout, 1, &entry, "Grid objects");
+
+    if (!bundles[slot])
+    {
+        encodeDraws(pass, bindGroup);
+        return;
+    }
+
+    // Cheaper than encoding the draws: a hit unless the pipeline or the ring has changed
+    uint64_t key = fnvOffsetBasis;
+    hashCombine(key, (WGPURenderPipeline)pipeline);
+    hashCombine(key, (WGPUBindGroup)bindGroup);
+    hashCombine(key, (WGPUBuffer)vertexBuffer);
+    key = fnv1a(offsets.data(), offsets.size() * sizeof(uint32_t), key);
+    bundles[slot]->execute(pass, key, [this, bindGroup](wgpu::RenderBundleEncoder encoder)
+    {
+        encodeDraws(encoder, bindGroup);
+    });
+}
+
+
+template<typename Encoder>
+void GridScene::encodeDraws(Encoder& encoder, wgpu::BindGroup bindGroup)
+{
+    encoder.setPipeline(pipeline);
+    encoder.setVertexBuffer(0, vertexBuffer, 0, sizeof(quadCorners));
+    for (uint32_t offset : offsets)
+    {
+        encoder.setBindGroup(0, bindGroup, 1, &offset);
+        encoder.draw(6, 1, 0, 0);
+    }
+}
+
+
+uint64_t GridScene::bundleRecordCount() const
+{
+    uint64_t n = 0;
+    for (const auto& b : bundles)
+    {
+        n += b ? b->recordCount() : 0;
+    }
+    return n;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "bind_group_cache.hpp"
+#include "pipeline_cache.hpp"
+#include "staging_belt.hpp"
+#include "static_bundle.hpp"
+#include "uniform_ring.hpp"
+
+class BlobCache;
+
+// A grid of animated quads, each drawn separately with its own uniforms.
+// Stands in for a scene with many small draws: per-object data goes through the uniform ring
+// and is selected by a dynamic offset, there is no buffer per object.
+// The offsets are the same every frame, so the draws are recorded into a render bundle per
+// frames-in-flight slot and only re-recorded when the pipeline, bind group or object count changes.
+class GridScene
+{
+public:
+    struct ObjectUniforms
+    {
+        // xy is the center, zw the half size, in clip space
+        std::array<float, 4> offsetScale;
+        std::array<float, 4> color;
+    };
+
+    GridScene(wgpu::Device device, BlobCache* cache, PipelineCache& pipelines, BindGroupCache& bindGroups,
+              wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat, uint32_t objectCount,
+              bool useBundles = true);
+    ~GridScene();
+
+    GridScene(const GridScene&) = delete;
+    GridScene& operator=(const GridScene&) = delete;
+
+    // Static geometry goes to the GPU on the first frame through the staging belt
+    bool needsUpload() const
+    {
+        return !uploaded;
+    }
+    void upload(StagingBelt& belt, wgpu::CommandEncoder encoder);
+
+    wgpu::Buffer vertices() const
+    {
+        return vertexBuffer;
+    }
+
+    // Animates the objects and pushes their uniforms, call between ring.beginFrame() and ring.endFrame().
+    // Also picks up the pipeline once it is compiled.
+    void update(UniformRing& ring, double seconds);
+    // Records the draws, nothing until the pipeline is ready; call after ring.endFrame(), may run on any thread
+    void draw(wgpu::RenderPassEncoder pass, const UniformRing& ring, uint32_t slot);
+
+    uint32_t objectCount() const
+    {
+        return (uint32_t)offsets.size();
+    }
+
+    // Uploaded and the pipeline is compiled, so draw() draws everything
+    bool ready() const
+    {
+        return uploaded && pipeline;
+    }
+
+    // Bundle recordings over all slots, 0 without bundles
+    uint64_t bundleRecordCount() const;
+
+private:
+    // Either straight into the pass or into a bundle
+    template<typename Encoder>
+    void encodeDraws(Encoder& encoder, wgpu::BindGroup bindGroup);
+
+    wgpu::Device device;
+    PipelineCache& pipelines;
+    BindGroupCache& bindGroups;
+    wgpu::ShaderModule shaderModule = nullptr;
+    // Owned by the bind group cache
+    wgpu::BindGroupLayout bindGroupLayout = nullptr;
+    wgpu::PipelineLayout pipelineLayout = nullptr;
+    // Owned by the cache, null until it is compiled
+    wgpu::RenderPipeline pipeline = nullptr;
+
+    // Looked up in the cache every frame, so it is kept with everything it points to
+    wgpu::VertexAttribute cornerAttribute;
+    wgpu::VertexBufferLayout vertexLayout;
+    wgpu::ColorTargetState colorTarget;
+    wgpu::FragmentState fragment;
+    wgpu::DepthStencilState depthStencil;
+    wgpu::RenderPipelineDescriptor pipelineDesc;
+    wgpu::Buffer vertexBuffer = nullptr;
+    bool uploaded = false;
+
+    // Null without bundles
+    std::array<std::unique_ptr<StaticBundle>, FramesInFlight::maxSlots> bundles;
+
+    uint32_t columns = 1;
+    // Dynamic offsets of this frame's objects
+    std::vector<uint32_t> offsets;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// FNV-1a, good enough for cache keys, not for anything adversarial
+constexpr uint64_t fnvOffsetBasis = 0xcbf29ce484222325ull;
+constexpr uint64_t fnvPrime       = 0x100000001b3ull;
+
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t seed = fnvOffsetBasis)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= bytes[i];
+        h *= fnvPrime;
+    }
+    return h;
+}
+
+inline uint64_t fnv1a(const std::string& s, uint64_t seed = fnvOffsetBasis)
+{
+    return fnv1a(s.data(), s.size(), seed);
+}
+
+// Mixes a trivially copyable value into the running hash
+template<typename T>
+inline void hashCombine(uint64_t& h, const T& value)
+{
+    h = fnv1a(&value, sizeof(value), h);
+}
+
+inline std::string toHex(uint64_t h)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string s(16, '0');
+    for (int i = 15; i >= 0; i--)
+    {
+        s[i] = digits[h & 0xf];
+        h >>= 4;
+    }
+    return s;
+}
@@ -0,0 +1,261 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "options.hpp"
+#include "render_target.hpp"
+
+
+static const std::pair<const char*, WGPUTextureFormat> formatNames[] =
+{
+    { "bgra8unorm",  wgpu::TextureFormat::BGRA8Unorm  },
+    { "rgba8unorm",  wgpu::TextureFormat::RGBA8Unorm  },
+    { "rgba16float", wgpu::TextureFormat::RGBA16Float },
+};
+
+
+static uint32_t parseUint(const std::string& s, const std::string& what)
+{
+    size_t pos = 0;
+    unsigned long long v = 0;
+    // stoull() takes a sign and whitespace, -1 would wrap around; only digits are accepted
+    if (!s.empty() && s[0] >= '0' && s[0] <= '9')
+    {
+        try
+        {
+            v = std::stoull(s, &pos);
+        }
+        catch (const std::exception&)
+        {
+            pos = 0;
+        }
+    }
+    if (pos == 0 || pos != s.size() || v > UINT32_MAX)
+    {
+        throw std::runtime_error("Bad value for " + what + ": " + s);
+    }
+    return (uint32_t)v;
+}
+
+
+void printUsage(const char* argv0)
+{
+    std::cout << "Usage: " << argv0 << " [options]" << std::endl;
+    std::cout << "  --startup-report <file>  write startup phase timings as JSON" << std::endl;
+    std::cout << "                           (or set WEBGPU_DEMO_STARTUP_REPORT)" << std::endl;
+    std::cout << "  --render-graph <file>    write the first frame's render graph as Graphviz DOT" << std::endl;
+    std::cout << "  --headless               render offscreen, no window is created; stops after --frames," << std::endl;
+    std::cout << "                           " << defaultHeadlessFrames << " frames by default" << std::endl;
+    std::cout << "  --size <W>x<H>           render target size, 640x480 by default" << std::endl;
+    std::cout << "  --format <name>          offscreen format: bgra8unorm (default), rgba8unorm, rgba16float" << std::endl;
+    std::cout << "  --frames <N>             exit after N frames (0 runs until the window is closed)" << std::endl;
+    std::cout << "  --fallback-adapter       use the software adapter" << std::endl;
+    std::cout << "  --frames-in-flight <N>   how many frames the CPU may run ahead of the GPU, 1 to 3 (default 2)" << std::endl;
+    std::cout << "  --present-mode <mode>    fifo (default), mailbox or immediate; P key cycles them" << std::endl;
+    std::cout << "  --gpu-profiler           print per-pass GPU timings on exit (Dawn, needs TimestampQuery)" << std::endl;
+    std::cout << "  --check-allocations      fail if the frame loop allocates once warm" << std::endl;
+    std::cout << "  --check-handles          fail if live wgpu handles grow in the frame loop, or if they are not" << std::endl;
+    std::cout << "                           counted (release builds)" << std::endl;
+    std::cout << "  --encoder-threads <N>    record passes on N worker threads (default 0)" << std::endl;
+    std::cout << "  --objects <N>            quads in the demo grid, each drawn separately (default 64)" << std::endl;
+    std::cout << "  --no-bundles             encode the grid's draws every frame instead of replaying a render bundle" << std::endl;
+    std::cout << "  --gpu-driven             cull the objects on the GPU and draw them with one indirect draw" << std::endl;
+    std::cout << "  --compute-test           check compute kernels against the CPU and exit" << std::endl;
+    std::cout << "  --capture-frames <list>  write these frames as PNG, e.g. 0,10,100; C key captures the next one" << std::endl;
+    std::cout << "  --capture-every <N>      write every Nth frame as PNG" << std::endl;
+    std::cout << "  --capture-dir <dir>      where captured frames go (default captures)" << std::endl;
+    std::cout << "  --golden <dir>           compare fixed scenes and their frame times with references in dir and exit" << std::endl;
+    std::cout << "  --golden-update          write the references of --golden instead of comparing" << std::endl;
+    std::cout << "  --golden-tolerance <N>   largest channel difference of a matching pixel (default 2)" << std::endl;
+    std::cout << "  --golden-psnr <dB>       lowest PSNR of a matching frame (default 40)" << std::endl;
+    std::cout << "  --help                   show this message" << std::endl;
+}
+
+
+AppOptions parseOptions(int argc, char** argv)
+{
+    AppOptions options;
+
+    if (const char* env = std::getenv("WEBGPU_DEMO_STARTUP_REPORT"))
+    {
+        options.startupReportPath = env;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        auto nextValue = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+            {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--help" || arg == "-h")
+        {
+            options.showHelp = true;
+        }
+        else if (arg == "--startup-report")
+        {
+            options.startupReportPath = nextValue();
+        }
+        else if (arg == "--render-graph")
+        {
+            options.renderGraphPath = nextValue();
+        }
+        else if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--size")
+        {
+            std::string v = nextValue();
+            size_t x = v.find('x');
+            if (x == std::string::npos)
+            {
+                throw std::runtime_error("Bad value for --size: " + v);
+            }
+            options.width  = parseUint(v.substr(0, x), arg);
+            options.height = parseUint(v.substr(x + 1), arg);
+            if (!options.width || !options.height)
+            {
+                throw std::runtime_error("Bad value for --size: " + v);
+            }
+        }
+        else if (arg == "--format")
+        {
+            std::string v = nextValue();
+            bool found = false;
+            for (const auto& f : formatNames)
+            {
+                if (v == f.first)
+                {
+                    options.format = f.second;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                throw std::runtime_error("Unknown format: " + v);
+            }
+        }
+        else if (arg == "--frames")
+        {
+            options.frameCount = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--fallback-adapter")
+        {
+            options.fallbackAdapter = true;
+        }
+        else if (arg == "--present-mode")
+        {
+            std::string v = nextValue();
+            if (!parsePresentMode(v, options.presentMode))
+            {
+                throw std::runtime_error("Unknown present mode: " + v);
+            }
+        }
+        else if (arg == "--gpu-profiler")
+        {
+            options.gpuProfiler = true;
+        }
+        else if (arg == "--check-allocations")
+        {
+            options.checkAllocations = true;
+        }
+        else if (arg == "--check-handles")
+        {
+            options.checkHandles = true;
+        }
+        else if (arg == "--objects")
+        {
+            options.objectCount = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--no-bundles")
+        {
+            options.renderBundles = false;
+        }
+        else if (arg == "--gpu-driven")
+        {
+            options.gpuDriven = true;
+        }
+        else if (arg == "--compute-test")
+        {
+            options.computeTest = true;
+        }
+        else if (arg == "--capture-frames")
+        {
+            std::string v = nextValue();
+            size_t start = 0;
+            while (true)
+            {
+                size_t comma = v.find(',', start);
+                options.captureFrames.push_back(parseUint(v.substr(start, comma - start), arg));
+                if (comma == std::string::npos)
+                    break;
+                start = comma + 1;
+            }
+        }
+        else if (arg == "--capture-every")
+        {
+            options.captureEvery = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--capture-dir")
+        {
+            options.captureDir = nextValue();
+        }
+        else if (arg == "--golden")
+        {
+            options.goldenDir = nextValue();
+        }
+        else if (arg == "--golden-update")
+        {
+            options.goldenUpdate = true;
+        }
+        else if (arg == "--golden-tolerance")
+        {
+            options.goldenTolerance = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--golden-psnr")
+        {
+            options.goldenPsnr = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--encoder-threads")
+        {
+            options.encoderThreads = parseUint(nextValue(), arg);
+        }
+        else if (arg == "--frames-in-flight")
+        {
+            options.framesInFlight = parseUint(nextValue(), arg);
+            if (options.framesInFlight < 1 || options.framesInFlight > 3)
+            {
+                throw std::runtime_error("--frames-in-flight should be 1, 2 or 3");
+            }
+        }
+        else
+        {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    // Without a window nothing would stop the loop; the golden test stops after its scenes
+    if (options.headless && !options.frameCount && options.goldenDir.empty())
+    {
+        options.frameCount = defaultHeadlessFrames;
+    }
+
+    // References are only comparable when rendered the same way, and the GPU times are part of the result
+    if (!options.goldenDir.empty())
+    {
+        options.headless = true;
+        options.fallbackAdapter = true;
+        options.gpuProfiler = true;
+    }
+
+    return options;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+constexpr uint32_t defaultHeadlessFrames = 1000;
+
+struct AppOptions
+{
+    bool showHelp = false;
+
+    // Where to write a JSON report of startup phase timings, empty means no report
+    std::string startupReportPath;
+
+    // Where to write the first frame's render graph in Graphviz format, empty means nowhere
+    std::string renderGraphPath;
+
+    // Render into an offscreen texture, no GLFW window or surface is created
+    bool headless = false;
+    uint32_t width = 640;
+    uint32_t height = 480;
+    wgpu::TextureFormat format = wgpu::TextureFormat::BGRA8Unorm;
+    // Stop after that many frames, 0 means run until the window is closed.
+    // Headless runs have no window to close, they stop after defaultHeadlessFrames unless told otherwise.
+    uint32_t frameCount = 0;
+    // Ask for the software (fallback) adapter
+    bool fallbackAdapter = false;
+    // How many frames the CPU may be ahead of the GPU, 1 to 3
+    uint32_t framesInFlight = 2;
+    // Initial present mode, can be switched at runtime by the P key
+    wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+    // Measure GPU time of every pass with timestamp queries, if the adapter supports them
+    bool gpuProfiler = false;
+    // Worker threads recording passes, 0 records everything on the main thread
+    uint32_t encoderThreads = 0;
+    // Quads in the demo grid, each is a separate draw with its own uniforms
+    uint32_t objectCount = 64;
+    // Replay the grid's draws from render bundles instead of encoding them every frame
+    bool renderBundles = true;
+    // Cull the objects in a compute pass and draw the survivors with one indirect draw
+    bool gpuDriven = false;
+    // Run the compute kernels' self-test and exit instead of rendering
+    bool computeTest = false;
+    // Where captured frames are written as PNG, C captures the next frame in a window
+    std::string captureDir = "captures";
+    // Frame indices to capture
+    std::vector<uint64_t> captureFrames;
+    // Capture every Nth frame, 0 means none
+    uint32_t captureEvery = 0;
+    // Render the golden-image scenes headless on the fallback adapter and compare them with the references
+    // in this directory, empty means a normal run. Failing frames go to captureDir.
+    std::string goldenDir;
+    // Write the frames and frame times as the new references instead of comparing
+    bool goldenUpdate = false;
+    // Largest difference in a channel a pixel may have
+    uint32_t goldenTolerance = 2;
+    // Lowest PSNR of a frame in dB
+    uint32_t goldenPsnr = 40;
+    // Counts heap allocations in the frame loop and fails if a warm frame allocates
+    bool checkAllocations = false;
+    // Compares live handle counts of a warm frame and of the last one, fails if any has grown (debug builds)
+    bool checkHandles = false;
+};
+
+// Command line takes precedence over environment variables.
+// Throws std::runtime_error on unknown or malformed arguments.
+AppOptions parseOptions(int argc, char** argv);
+
+void printUsage(const char* argv0);
@@ -0,0 +1,116 @@
+#include "parallel_encoder.hpp"
+
+
+ParallelEncoder::ParallelEncoder(wgpu::Device device, uint32_t workerThreads) :
+    device(device)
+{
+    for (uint32_t i = 0; i < workerThreads; i++)
+    {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+
+ParallelEncoder::~ParallelEncoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+
+void ParallelEncoder::add(const char* label, RecordFunction fn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Job job;
+    job.label = label;
+    job.fn = std::move(fn);
+    jobs.push_back(std::move(job));
+}
+
+
+void ParallelEncoder::runJob(Job& job)
+{
+    wgpu::CommandEncoderDescriptor encoderDesc;
+    encoderDesc.label = job.label;
+    Owned<wgpu::CommandEncoder> encoder(device.createCommandEncoder(encoderDesc));
+
+    job.fn(encoder.get());
+
+    wgpu::CommandBufferDescriptor cmdBufferDesc;
+    cmdBufferDesc.label = job.label;
+    job.result.reset(encoder->finish(cmdBufferDesc));
+}
+
+
+void ParallelEncoder::drainJobs(std::unique_lock<std::mutex>& lock)
+{
+    while (nextJob < batch.size())
+    {
+        // The batch is not touched until every job is finished, the reference stays valid unlocked
+        Job& job = batch[nextJob++];
+
+        lock.unlock();
+        runJob(job);
+        lock.lock();
+
+        finishedJobs++;
+        if (finishedJobs == batch.size())
+        {
+            workDone.notify_all();
+        }
+    }
+}
+
+
+void ParallelEncoder::workerLoop()
+{
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        workAvailable.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+        if (stopping)
+            return;
+
+        // A worker waking late finds the batch finished, or still the one record() has published;
+        // jobs added for the next frame are not in it
+        seenGeneration = generation;
+        drainJobs(lock);
+    }
+}
+
+
+void ParallelEncoder::record(std::vector<WGPUCommandBuffer>& out)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The previous batch has finished, its buffers were submitted by now and are released with it
+    batch.clear();
+    // Both vectors keep their capacity, a warm frame does not allocate
+    std::swap(jobs, batch);
+    nextJob = 0;
+    finishedJobs = 0;
+
+    if (!workers.empty() && batch.size() > 1)
+    {
+        generation++;
+        workAvailable.notify_all();
+    }
+
+    // The calling thread works too instead of just waiting
+    drainJobs(lock);
+    workDone.wait(lock, [&]() { return finishedJobs == batch.size(); });
+
+    for (auto& job : batch)
+    {
+        out.push_back(job.result.get());
+    }
+}
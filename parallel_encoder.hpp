@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "gpu_handle.hpp"
+
+// Records independent passes concurrently.
+// Every job gets its own CommandEncoder, jobs run on worker threads and on the calling thread,
+// and the resulting command buffers come out in the order the jobs were added,
+// so the submit order does not depend on thread scheduling.
+// With zero worker threads everything is recorded on the calling thread.
+class ParallelEncoder
+{
+public:
+    using RecordFunction = std::function<void(wgpu::CommandEncoder)>;
+
+    ParallelEncoder(wgpu::Device device, uint32_t workerThreads);
+    ~ParallelEncoder();
+
+    ParallelEncoder(const ParallelEncoder&) = delete;
+    ParallelEncoder& operator=(const ParallelEncoder&) = delete;
+
+    // Label should outlive the next record() call
+    void add(const char* label, RecordFunction fn);
+
+    // Records all jobs added since the last call and appends their command buffers to out.
+    // Command buffers are owned by the encoder and released on the next record() call.
+    void record(std::vector<WGPUCommandBuffer>& out);
+
+    uint32_t workerCount() const
+    {
+        return (uint32_t)workers.size();
+    }
+
+private:
+    struct Job
+    {
+        const char* label = nullptr;
+        RecordFunction fn;
+        Owned<wgpu::CommandBuffer> result;
+    };
+
+    void workerLoop();
+    // Takes jobs of the published batch until none are left
+    void drainJobs(std::unique_lock<std::mutex>& lock);
+    void runJob(Job& job);
+
+    wgpu::Device device;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+    // Added since the last record(), workers never see them
+    std::vector<Job> jobs;
+    // Published by record(), the only jobs workers take. Not changed until all of them have finished,
+    // so a job being run stays in place; its command buffers live until the next record().
+    std::vector<Job> batch;
+    size_t nextJob = 0;
+    size_t finishedJobs = 0;
+    // Bumped by every record() which wakes the workers
+    uint64_t generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "pipeline_cache.hpp"
+#include "gpu_future.hpp"
+#include "hash.hpp"
+
+
+static void hashString(uint64_t& h, const char* s)
+{
+    // Length goes first so that "ab","c" and "a","bc" differ
+    size_t n = s ? std::strlen(s) : 0;
+    hashCombine(h, n);
+    h = fnv1a(s, n, h);
+}
+
+
+// Fields one by one: padding bytes in the structures are not initialized
+static void hashConstants(uint64_t& h, size_t count, const wgpu::ConstantEntry* constants)
+{
+    hashCombine(h, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        hashString(h, constants[i].key);
+        hashCombine(h, constants[i].value);
+    }
+}
+
+
+static void hashBlendComponent(uint64_t& h, const wgpu::BlendComponent& c)
+{
+    hashCombine(h, c.operation);
+    hashCombine(h, c.srcFactor);
+    hashCombine(h, c.dstFactor);
+}
+
+
+static void hashStencilFace(uint64_t& h, const wgpu::StencilFaceState& s)
+{
+    hashCombine(h, s.compare);
+    hashCombine(h, s.failOp);
+    hashCombine(h, s.depthFailOp);
+    hashCombine(h, s.passOp);
+}
+
+
+uint64_t PipelineCache::hashDescriptor(const wgpu::RenderPipelineDescriptor& desc)
+{
+    uint64_t h = fnvOffsetBasis;
+    hashString(h, "render");
+    hashCombine(h, (WGPUPipelineLayout)desc.layout);
+
+    const auto& vertex = desc.vertex;
+    hashCombine(h, (WGPUShaderModule)vertex.module);
+    hashString(h, vertex.entryPoint);
+    hashConstants(h, vertex.constantCount, vertex.constants);
+    hashCombine(h, vertex.bufferCount);
+    for (size_t i = 0; i < vertex.bufferCount; i++)
+    {
+        const auto& b = vertex.buffers[i];
+        hashCombine(h, b.arrayStride);
+        hashCombine(h, b.stepMode);
+        hashCombine(h, b.attributeCount);
+        for (size_t j = 0; j < b.attributeCount; j++)
+        {
+            hashCombine(h, b.attributes[j].format);
+            hashCombine(h, b.attributes[j].offset);
+            hashCombine(h, b.attributes[j].shaderLocation);
+        }
+    }
+
+    hashCombine(h, desc.primitive.topology);
+    hashCombine(h, desc.primitive.stripIndexFormat);
+    hashCombine(h, desc.primitive.frontFace);
+    hashCombine(h, desc.primitive.cullMode);
+
+    hashCombine(h, desc.depthStencil != nullptr);
+    if (desc.depthStencil)
+    {
+        const auto& ds = *desc.depthStencil;
+        hashCombine(h, ds.format);
+        hashCombine(h, ds.depthWriteEnabled);
+        hashCombine(h, ds.depthCompare);
+        hashStencilFace(h, ds.stencilFront);
+        hashStencilFace(h, ds.stencilBack);
+        hashCombine(h, ds.stencilReadMask);
+        hashCombine(h, ds.stencilWriteMask);
+        hashCombine(h, ds.depthBias);
+        hashCombine(h, ds.depthBiasSlopeScale);
+        hashCombine(h, ds.depthBiasClamp);
+    }
+
+    hashCombine(h, desc.multisample.count);
+    hashCombine(h, desc.multisample.mask);
+    hashCombine(h, desc.multisample.alphaToCoverageEnabled);
+
+    hashCombine(h, desc.fragment != nullptr);
+    if (desc.fragment)
+    {
+        const auto& fragment = *desc.fragment;
+        hashCombine(h, (WGPUShaderModule)fragment.module);
+        hashString(h, fragment.entryPoint);
+        hashConstants(h, fragment.constantCount, fragment.constants);
+        hashCombine(h, fragment.targetCount);
+        for (size_t i = 0; i < fragment.targetCount; i++)
+        {
+            const auto& t = fragment.targets[i];
+            hashCombine(h, t.format);
+            hashCombine(h, t.writeMask);
+            hashCombine(h, t.blend != nullptr);
+            if (t.blend)
+            {
+                hashBlendComponent(h, t.blend->color);
+                hashBlendComponent(h, t.blend->alpha);
+            }
+        }
+    }
+
+    return h;
+}
+
+
+uint64_t PipelineCache::hashDescriptor(const wgpu::ComputePipelineDescriptor& desc)
+{
+    uint64_t h = fnvOffsetBasis;
+    hashString(h, "compute");
+    hashCombine(h, (WGPUPipelineLayout)desc.layout);
+    hashCombine(h, (WGPUShaderModule)desc.compute.module);
+    hashString(h, desc.compute.entryPoint);
+    hashConstants(h, desc.compute.constantCount, desc.compute.constants);
+    return h;
+}
+
+
+PipelineCache::PipelineCache(wgpu::Device device) :
+    device(device),
+    compileMs(256)
+{ }
+
+
+PipelineCache::~PipelineCache()
+{
+    // Callbacks point to the entries
+    if (!waitIdle(std::chrono::milliseconds(5000)))
+    {
+        std::cout << "Pipeline cache: compiles still running on exit, leaking them" << std::endl;
+        for (auto& [key, e] : renderPipelines)
+        {
+            e.release();
+        }
+        for (auto& [key, e] : computePipelines)
+        {
+            e.release();
+        }
+        return;
+    }
+
+    for (auto& [key, e] : renderPipelines)
+    {
+        if (e->pipeline)
+        {
+            e->pipeline.release();
+        }
+    }
+    for (auto& [key, e] : computePipelines)
+    {
+        if (e->pipeline)
+        {
+            e->pipeline.release();
+        }
+    }
+}
+
+
+template<typename E, typename Pipeline>
+void PipelineCache::onCompiled(E& entry, wgpu::CreatePipelineAsyncStatus status, Pipeline pipeline,
+                               const char* message, const char* label)
+{
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - entry.start).count();
+    nPending--;
+
+    if (status != wgpu::CreatePipelineAsyncStatus::Success || !pipeline)
+    {
+        std::cout << "Pipeline " << (label ? label : "") << " failed to compile";
+        if (message)
+        {
+            std::cout << ": " << message;
+        }
+        std::cout << std::endl;
+        entry.failed = true;
+        nFailures++;
+        return;
+    }
+
+    entry.pipeline = pipeline;
+    entry.ready = true;
+    compileMs.add(ms);
+}
+
+
+wgpu::RenderPipeline PipelineCache::getRenderPipeline(const wgpu::RenderPipelineDescriptor& desc)
+{
+    uint64_t key = hashDescriptor(desc);
+    auto it = renderPipelines.find(key);
+    if (it != renderPipelines.end())
+    {
+        nHits++;
+        return it->second->ready ? it->second->pipeline : nullptr;
+    }
+
+    nMisses++;
+    auto entry = std::make_unique<RenderEntry>();
+    RenderEntry& e = *entry;
+    renderPipelines.emplace(key, std::move(entry));
+    e.objects = { (WGPUPipelineLayout)desc.layout, (WGPUShaderModule)desc.vertex.module,
+                  desc.fragment ? (WGPUShaderModule)desc.fragment->module : nullptr };
+
+    e.start = Clock::now();
+    nPending++;
+    const char* label = desc.label;
+#ifdef WEBGPU_BACKEND_DAWN
+    e.callbackHandle = device.createRenderPipelineAsync(desc, [this, &e, label](wgpu::CreatePipelineAsyncStatus status,
+                                                                                wgpu::RenderPipeline pipeline,
+                                                                                char const* message)
+    {
+        onCompiled(e, status, pipeline, message, label);
+    });
+#else
+    wgpu::RenderPipeline pipeline = device.createRenderPipeline(desc);
+    onCompiled(e, wgpu::CreatePipelineAsyncStatus::Success, pipeline, nullptr, label);
+#endif
+
+    return e.ready ? e.pipeline : nullptr;
+}
+
+
+wgpu::ComputePipeline PipelineCache::getComputePipeline(const wgpu::ComputePipelineDescriptor& desc)
+{
+    uint64_t key = hashDescriptor(desc);
+    auto it = computePipelines.find(key);
+    if (it != computePipelines.end())
+    {
+        nHits++;
+        return it->second->ready ? it->second->pipeline : nullptr;
+    }
+
+    nMisses++;
+    auto entry = std::make_unique<ComputeEntry>();
+    ComputeEntry& e = *entry;
+    computePipelines.emplace(key, std::move(entry));
+    e.objects = { (WGPUPipelineLayout)desc.layout, (WGPUShaderModule)desc.compute.module, nullptr };
+
+    e.start = Clock::now();
+    nPending++;
+    const char* label = desc.label;
+#ifdef WEBGPU_BACKEND_DAWN
+    e.callbackHandle = device.createComputePipelineAsync(desc, [this, &e, label](wgpu::CreatePipelineAsyncStatus status,
+                                                                                 wgpu::ComputePipeline pipeline,
+                                                                                 char const* message)
+    {
+        onCompiled(e, status, pipeline, message, label);
+    });
+#else
+    wgpu::ComputePipeline pipeline = device.createComputePipeline(desc);
+    onCompiled(e, wgpu::CreatePipelineAsyncStatus::Success, pipeline, nullptr, label);
+#endif
+
+    return e.ready ? e.pipeline : nullptr;
+}
+
+
+template<typename Map>
+bool PipelineCache::uses(const Map& entries, const void* object, bool pendingOnly)
+{
+    for (const auto& [key, e] : entries)
+    {
+        bool pending = !e->ready && !e->failed;
+        if ((pending || !pendingOnly) && std::find(e->objects.begin(), e->objects.end(), object) != e->objects.end())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+template<typename Map>
+void PipelineCache::erase(Map& entries, const void* object)
+{
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        auto& e = it->second;
+        if (std::find(e->objects.begin(), e->objects.end(), object) == e->objects.end())
+        {
+            ++it;
+            continue;
+        }
+        if (e->pipeline)
+        {
+            e->pipeline.release();
+        }
+        it = entries.erase(it);
+    }
+}
+
+
+void PipelineCache::forgetObject(const void* object)
+{
+    if (!object)
+        return;
+
+    // A compile callback points to its entry, it has to fire before the entry goes
+    if (uses(renderPipelines, object, true) || uses(computePipelines, object, true))
+    {
+        if (!waitIdle(std::chrono::milliseconds(5000)))
+        {
+            std::cout << "Pipeline cache: compiles still running, keeping their entries" << std::endl;
+            return;
+        }
+    }
+
+    erase(renderPipelines, object);
+    erase(computePipelines, object);
+}
+
+
+void PipelineCache::forget(wgpu::ShaderModule module)
+{
+    forgetObject((WGPUShaderModule)module);
+}
+
+
+void PipelineCache::forget(wgpu::PipelineLayout layout)
+{
+    forgetObject((WGPUPipelineLayout)layout);
+}
+
+
+bool PipelineCache::waitIdle(std::chrono::milliseconds timeout)
+{
+    auto start = Clock::now();
+    while (nPending > 0)
+    {
+        if (Clock::now() - start > timeout)
+        {
+            return false;
+        }
+        processEvents(device);
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+
+void PipelineCache::printStats() const
+{
+    std::cout << "Pipeline cache: " << renderPipelines.size() << " render, " << computePipelines.size()
+              << " compute pipelines, " << nHits << " hits, " << nMisses << " misses";
+    if (nFailures)
+    {
+        std::cout << ", " << nFailures << " failed";
+    }
+    std::cout << std::endl;
+
+    if (!compileMs.empty())
+    {
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << " compile time, ms (min / avg / max): " << compileMs.min() << " / "
+                  << compileMs.avg() << " / " << compileMs.max() << std::endl;
+        std::cout << std::defaultfloat;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <webgpu/webgpu.hpp>
+
+#include "sliding_stats.hpp"
+
+// Render and compute pipelines keyed by a hash of their full descriptor.
+// Shader modules and layouts are identified by their handles: before one is released, forget() drops
+// the pipelines built from it, or a new object at the same address would match them.
+// A miss starts an asynchronous compile and returns null until the pipeline is ready;
+// the caller skips the draw (or uses a fallback) meanwhile, so compiling never stalls a frame.
+// wgpu-native has no working async creation, there pipelines are created synchronously on a miss.
+// Not thread-safe, compile callbacks run on the thread that processes device events.
+class PipelineCache
+{
+public:
+    explicit PipelineCache(wgpu::Device device);
+    ~PipelineCache();
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    // Null while the pipeline is being compiled or if it failed to compile
+    wgpu::RenderPipeline getRenderPipeline(const wgpu::RenderPipelineDescriptor& desc);
+    wgpu::ComputePipeline getComputePipeline(const wgpu::ComputePipelineDescriptor& desc);
+
+    // Drops the pipelines using the module or layout, waits for their compiles if they are still running.
+    // Call before releasing it.
+    void forget(wgpu::ShaderModule module);
+    void forget(wgpu::PipelineLayout layout);
+
+    // Compiles still running
+    uint32_t pending() const
+    {
+        return nPending;
+    }
+
+    // Waits for all compiles started so far, e.g. before a frame which must not skip anything
+    bool waitIdle(std::chrono::milliseconds timeout);
+
+    uint64_t hits() const
+    {
+        return nHits;
+    }
+
+    uint64_t misses() const
+    {
+        return nMisses;
+    }
+
+    // Hit/miss counts and compile times
+    void printStats() const;
+
+    static uint64_t hashDescriptor(const wgpu::RenderPipelineDescriptor& desc);
+    static uint64_t hashDescriptor(const wgpu::ComputePipelineDescriptor& desc);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    template<typename Pipeline, typename Callback>
+    struct Entry
+    {
+        Pipeline pipeline = nullptr;
+        bool ready = false;
+        bool failed = false;
+        Clock::time_point start;
+        std::unique_ptr<Callback> callbackHandle;
+        // Layout and shader modules the pipeline is built from, see forget()
+        std::array<const void*, 3> objects {};
+    };
+
+    using RenderEntry = Entry<wgpu::RenderPipeline, wgpu::CreateRenderPipelineAsyncCallback>;
+    using ComputeEntry = Entry<wgpu::ComputePipeline, wgpu::CreateComputePipelineAsyncCallback>;
+
+    void forgetObject(const void* object);
+    template<typename Map>
+    static bool uses(const Map& entries, const void* object, bool pendingOnly);
+    template<typename Map>
+    static void erase(Map& entries, const void* object);
+
+    template<typename E, typename Pipeline>
+    void onCompiled(E& entry, wgpu::CreatePipelineAsyncStatus status, Pipeline pipeline,
+                    const char* message, const char* label);
+
+    wgpu::Device device;
+    std::unordered_map<uint64_t, std::unique_ptr<RenderEntry>> renderPipelines;
+    std::unordered_map<uint64_t, std::unique_ptr<ComputeEntry>> computePipelines;
+
+    uint32_t nPending = 0;
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    uint64_t nFailures = 0;
+    SlidingStats compileMs;
+};
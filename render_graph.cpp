@@ -0,0 +1,541 @@
+#include "gpu_profiler.hpp"
+#include "parallel_encoder.hpp"
+#include "render_graph.hpp"
+
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(ResourceId r)
+{
+    graph.addAccess(index, r, true, false);
+    return *this;
+}
+
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(ResourceId r)
+{
+    graph.addAccess(index, r, false, true);
+    return *this;
+}
+
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::color(ResourceId r, wgpu::LoadOp load, wgpu::StoreOp store,
+                                                          wgpu::Color clear)
+{
+    Pass& p = graph.passes[index];
+    if (!p.render || p.colorCount == maxColorAttachments)
+        return *this;
+
+    Attachment& a = p.colors[p.colorCount++];
+    a.resource = r;
+    a.load = load;
+    a.store = store;
+    a.clearColor = clear;
+    graph.addAccess(index, r, load == wgpu::LoadOp::Load, true);
+    p.accesses.back().attachment = true;
+    return *this;
+}
+
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::depth(ResourceId r, wgpu::LoadOp load, wgpu::StoreOp store,
+                                                          float clear)
+{
+    Pass& p = graph.passes[index];
+    if (!p.render)
+        return *this;
+
+    p.depth.resource = r;
+    p.depth.load = load;
+    p.depth.store = store;
+    p.depth.clearDepth = clear;
+    graph.addAccess(index, r, load == wgpu::LoadOp::Load, true);
+    p.accesses.back().attachment = true;
+    return *this;
+}
+
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffect()
+{
+    graph.passes[index].sideEffect = true;
+    return *this;
+}
+
+
+RenderGraph::RenderGraph(AttachmentPool& pool) :
+    pool(pool)
+{ }
+
+
+void RenderGraph::beginFrame()
+{
+    nPasses = 0;
+    resources.clear();
+    order.clear();
+    groups.clear();
+}
+
+
+RenderGraph::ResourceId RenderGraph::addResource(const char* name, ResourceKind kind)
+{
+    Resource r;
+    r.name = name;
+    r.kind = kind;
+    resources.push_back(r);
+    return (ResourceId)(resources.size() - 1);
+}
+
+
+RenderGraph::ResourceId RenderGraph::importTexture(const char* name, wgpu::TextureView view)
+{
+    ResourceId id = addResource(name, ResourceKind::ImportedTexture);
+    resources[id].view = view;
+    return id;
+}
+
+
+RenderGraph::ResourceId RenderGraph::importBuffer(const char* name, wgpu::Buffer buffer)
+{
+    ResourceId id = addResource(name, ResourceKind::ImportedBuffer);
+    resources[id].buffer = buffer;
+    return id;
+}
+
+
+RenderGraph::ResourceId RenderGraph::createTexture(const char* name, const AttachmentKey& key)
+{
+    ResourceId id = addResource(name, ResourceKind::Transient);
+    resources[id].key = key;
+    return id;
+}
+
+
+RenderGraph::Pass& RenderGraph::newPass(const char* name, bool render)
+{
+    if (nPasses == passes.size())
+    {
+        passes.emplace_back();
+    }
+
+    // Keeps the capacity of the previous frame's pass
+    Pass& p = passes[nPasses++];
+    p.name = name;
+    p.render = render;
+    p.sideEffect = false;
+    p.accesses.clear();
+    p.colorCount = 0;
+    p.depth = Attachment();
+    p.live = false;
+    p.emitted = false;
+    p.group = 0;
+    return p;
+}
+
+
+RenderGraph::PassBuilder RenderGraph::addRenderPass(const char* name, RenderFunction fn)
+{
+    Pass& p = newPass(name, true);
+    p.renderFn = std::move(fn);
+    p.encodeFn = nullptr;
+    return PassBuilder(*this, nPasses - 1);
+}
+
+
+RenderGraph::PassBuilder RenderGraph::addPass(const char* name, EncodeFunction fn)
+{
+    Pass& p = newPass(name, false);
+    p.renderFn = nullptr;
+    p.encodeFn = std::move(fn);
+    return PassBuilder(*this, nPasses - 1);
+}
+
+
+void RenderGraph::addAccess(uint32_t pass, ResourceId r, bool reads, bool writes)
+{
+    passes[pass].accesses.push_back({ r, reads, writes, false });
+}
+
+
+void RenderGraph::cull()
+{
+    stack.clear();
+    for (uint32_t i = 0; i < nPasses; i++)
+    {
+        Pass& p = passes[i];
+        p.live = p.sideEffect;
+        for (const Access& a : p.accesses)
+        {
+            if (a.writes && resources[a.resource].kind != ResourceKind::Transient)
+            {
+                p.live = true;
+            }
+        }
+        if (p.live)
+        {
+            stack.push_back(i);
+        }
+    }
+
+    // Writers of what a live pass reads are live too, back to the one that overwrote it completely
+    while (!stack.empty())
+    {
+        uint32_t i = stack.back();
+        stack.pop_back();
+
+        for (const Access& a : passes[i].accesses)
+        {
+            if (!a.reads)
+                continue;
+
+            bool overwritten = false;
+            for (uint32_t j = i; j-- > 0 && !overwritten; )
+            {
+                for (const Access& w : passes[j].accesses)
+                {
+                    if (w.resource != a.resource || !w.writes)
+                        continue;
+
+                    if (!passes[j].live)
+                    {
+                        passes[j].live = true;
+                        stack.push_back(j);
+                    }
+                    overwritten = overwritten || !w.reads;
+                }
+            }
+        }
+    }
+}
+
+
+bool RenderGraph::dependsOn(uint32_t b, uint32_t a) const
+{
+    for (const Access& x : passes[a].accesses)
+    {
+        for (const Access& y : passes[b].accesses)
+        {
+            if (x.resource == y.resource && (x.writes || y.writes))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+bool RenderGraph::canMerge(uint32_t a, uint32_t b) const
+{
+    const Pass& pa = passes[a];
+    const Pass& pb = passes[b];
+    if (!pa.render || !pb.render || pa.colorCount != pb.colorCount || pa.depth.resource != pb.depth.resource)
+        return false;
+
+    // The second one has to continue what the first one has drawn
+    for (uint32_t c = 0; c < pa.colorCount; c++)
+    {
+        if (pa.colors[c].resource != pb.colors[c].resource || pb.colors[c].load != wgpu::LoadOp::Load)
+            return false;
+    }
+    if (pb.depth.resource != noResource && pb.depth.load != wgpu::LoadOp::Load)
+        return false;
+
+    // Anything the first one writes cannot be read inside the same render pass
+    for (const Access& x : pb.accesses)
+    {
+        if (x.attachment)
+            continue;
+        for (const Access& y : pa.accesses)
+        {
+            if (y.writes && y.resource == x.resource)
+                return false;
+        }
+    }
+    return true;
+}
+
+
+void RenderGraph::sort()
+{
+    uint32_t liveCount = 0;
+    for (uint32_t i = 0; i < nPasses; i++)
+    {
+        passes[i].emitted = false;
+        liveCount += passes[i].live ? 1 : 0;
+    }
+
+    // Dependencies always point to earlier passes, so the first ready pass always exists.
+    // A pass continuing the render pass of the last one goes first, so that they can be merged.
+    order.clear();
+    while (order.size() < liveCount)
+    {
+        int pick = -1;
+        for (uint32_t i = 0; i < nPasses; i++)
+        {
+            if (!passes[i].live || passes[i].emitted)
+                continue;
+
+            bool ready = true;
+            for (uint32_t j = 0; j < i && ready; j++)
+            {
+                ready = !passes[j].live || passes[j].emitted || !dependsOn(i, j);
+            }
+            if (!ready)
+                continue;
+
+            if (!order.empty() && canMerge(order.back(), i))
+            {
+                pick = (int)i;
+                break;
+            }
+            if (pick < 0)
+            {
+                pick = (int)i;
+            }
+        }
+
+        passes[pick].emitted = true;
+        order.push_back((uint32_t)pick);
+    }
+}
+
+
+void RenderGraph::buildGroups()
+{
+    groups.clear();
+    for (uint32_t k = 0; k < order.size(); k++)
+    {
+        uint32_t i = order[k];
+
+        bool merge = !groups.empty() && groups.back().render;
+        if (merge)
+        {
+            const Group& g = groups.back();
+            for (uint32_t m = g.first; m < g.first + g.count && merge; m++)
+            {
+                merge = canMerge(order[m], i);
+            }
+        }
+
+        if (!merge)
+        {
+            Group& g = groups.emplace_back();
+            g.graph = this;
+            g.name = passes[i].name;
+            g.render = passes[i].render;
+            g.first = k;
+            g.count = 0;
+        }
+        groups.back().count++;
+        passes[i].group = (uint32_t)groups.size() - 1;
+    }
+
+    for (Resource& r : resources)
+    {
+        r.used = false;
+    }
+    for (uint32_t i : order)
+    {
+        for (const Access& a : passes[i].accesses)
+        {
+            Resource& r = resources[a.resource];
+            if (!r.used)
+            {
+                r.used = true;
+                r.firstGroup = passes[i].group;
+            }
+            r.lastGroup = passes[i].group;
+        }
+    }
+}
+
+
+void RenderGraph::compile()
+{
+    cull();
+    sort();
+    buildGroups();
+}
+
+
+uint32_t RenderGraph::renderPassCount() const
+{
+    uint32_t n = 0;
+    for (const Group& g : groups)
+    {
+        n += g.render ? 1 : 0;
+    }
+    return n;
+}
+
+
+void RenderGraph::fillDescriptor(Group& g)
+{
+    // Loads of the first merged pass, stores of the last one
+    const Pass& first = passes[order[g.first]];
+    const Pass& last = passes[order[g.first + g.count - 1]];
+
+    for (uint32_t c = 0; c < first.colorCount; c++)
+    {
+        wgpu::RenderPassColorAttachment& ca = g.colors[c];
+        ca.view = resources[first.colors[c].resource].view;
+        ca.resolveTarget = nullptr;
+        ca.loadOp = first.colors[c].load;
+        ca.storeOp = last.colors[c].store;
+        ca.clearValue = first.colors[c].clearColor;
+    }
+
+    g.desc.nextInChain = nullptr;
+    g.desc.label = g.name;
+    g.desc.colorAttachmentCount = first.colorCount;
+    g.desc.colorAttachments = g.colors.data();
+    g.desc.depthStencilAttachment = nullptr;
+    g.desc.timestampWriteCount = 0;
+    g.desc.timestampWrites = nullptr;
+
+    if (first.depth.resource != noResource)
+    {
+        g.depth.view = resources[first.depth.resource].view;
+        g.depth.depthClearValue = first.depth.clearDepth;
+        g.depth.depthLoadOp = first.depth.load;
+        g.depth.depthStoreOp = last.depth.store;
+        g.depth.depthReadOnly = false;
+        g.depth.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+        g.depth.stencilLoadOp = wgpu::LoadOp::Clear;
+        g.depth.stencilStoreOp = wgpu::StoreOp::Store;
+#else
+        // Dawn wants no stencil ops for a format without stencil
+        g.depth.stencilLoadOp = wgpu::LoadOp::Undefined;
+        g.depth.stencilStoreOp = wgpu::StoreOp::Undefined;
+#endif
+        g.depth.stencilReadOnly = true;
+        g.desc.depthStencilAttachment = &g.depth;
+    }
+}
+
+
+void RenderGraph::execute(ParallelEncoder& encoder, GpuProfiler* profiler)
+{
+    for (uint32_t gi = 0; gi < groups.size(); gi++)
+    {
+        for (Resource& r : resources)
+        {
+            if (r.kind == ResourceKind::Transient && r.used && r.firstGroup == gi)
+            {
+                r.view = pool.acquire(r.key, r.name);
+            }
+        }
+
+        Group& g = groups[gi];
+        g.profiler = profiler;
+        if (g.render)
+        {
+            fillDescriptor(g);
+        }
+        // A single reference, so that std::function keeps it inline
+        encoder.add(g.name, [&g](wgpu::CommandEncoder commandEncoder)
+        {
+            g.graph->record(g, commandEncoder);
+        });
+
+        // Jobs added later may get the same texture
+        for (Resource& r : resources)
+        {
+            if (r.kind == ResourceKind::Transient && r.used && r.lastGroup == gi)
+            {
+                pool.release(r.view);
+            }
+        }
+    }
+}
+
+
+void RenderGraph::record(Group& g, wgpu::CommandEncoder encoder)
+{
+    if (!g.render)
+    {
+        passes[order[g.first]].encodeFn(encoder);
+        return;
+    }
+
+    g.desc.timestampWriteCount = 0;
+    g.desc.timestampWrites = nullptr;
+    if (g.profiler)
+    {
+        g.profiler->instrument(g.desc, g.name);
+    }
+
+    Owned<wgpu::RenderPassEncoder> renderPass(encoder.beginRenderPass(g.desc));
+    for (uint32_t k = g.first; k < g.first + g.count; k++)
+    {
+        passes[order[k]].renderFn(renderPass.get());
+    }
+    renderPass->end();
+}
+
+
+void RenderGraph::writeDot(std::ostream& out) const
+{
+    out << "digraph RenderGraph" << std::endl << "{" << std::endl;
+    out << "    rankdir=LR;" << std::endl;
+
+    auto writePass = [this, &out](uint32_t i, const char* indent)
+    {
+        const Pass& p = passes[i];
+        out << indent << "p" << i << " [shape=box, label=\"" << p.name << "\"";
+        if (!p.live)
+        {
+            out << ", style=dashed, color=gray, fontcolor=gray";
+        }
+        out << "];" << std::endl;
+    };
+
+    // Merged passes are drawn inside one box
+    for (uint32_t gi = 0; gi < groups.size(); gi++)
+    {
+        const Group& g = groups[gi];
+        if (g.count < 2)
+            continue;
+
+        out << "    subgraph cluster_" << gi << std::endl << "    {" << std::endl;
+        out << "        label=\"render pass " << gi << "\";" << std::endl;
+        for (uint32_t k = g.first; k < g.first + g.count; k++)
+        {
+            writePass(order[k], "        ");
+        }
+        out << "    }" << std::endl;
+    }
+    for (uint32_t i = 0; i < nPasses; i++)
+    {
+        if (!passes[i].live || groups[passes[i].group].count < 2)
+        {
+            writePass(i, "    ");
+        }
+    }
+
+    for (uint32_t r = 0; r < resources.size(); r++)
+    {
+        const Resource& res = resources[r];
+        out << "    r" << r << " [shape=ellipse, label=\"" << res.name << "\"";
+        if (res.kind == ResourceKind::Transient)
+        {
+            out << ", style=dashed";
+        }
+        out << "];" << std::endl;
+    }
+
+    for (uint32_t i = 0; i < nPasses; i++)
+    {
+        for (const Access& a : passes[i].accesses)
+        {
+            if (a.reads)
+            {
+                out << "    r" << a.resource << " -> p" << i << ";" << std::endl;
+            }
+            if (a.writes)
+            {
+                out << "    p" << i << " -> r" << a.resource << ";" << std::endl;
+            }
+        }
+    }
+
+    out << "}" << std::endl;
+}
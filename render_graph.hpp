@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "attachment_pool.hpp"
+
+class GpuProfiler;
+class ParallelEncoder;
+
+// Declarative description of a frame.
+// Every frame the passes are added again together with the resources they read and write.
+// compile() culls the passes whose results nobody uses, orders the rest by their dependencies,
+// merges consecutive render passes drawing into the same attachments into one render pass and
+// leases transient textures from the AttachmentPool from their first to their last use,
+// so transients with non-overlapping lifetimes share a texture.
+// execute() adds a job per (merged) pass to a ParallelEncoder, in the compiled order.
+// WebGPU tracks resource usage and inserts barriers itself, the dependencies only have to order
+// the passes, which the single batched submit keeps.
+// Passes and resources are reused between frames, so a warm frame does not allocate. Not thread-safe.
+class RenderGraph
+{
+public:
+    using ResourceId = uint32_t;
+    static constexpr ResourceId noResource = ~0u;
+    static constexpr uint32_t maxColorAttachments = 4;
+
+    using RenderFunction = std::function<void(wgpu::RenderPassEncoder)>;
+    using EncodeFunction = std::function<void(wgpu::CommandEncoder)>;
+
+    // Declares what a pass uses, valid until the next pass is added
+    class PassBuilder
+    {
+    public:
+        // Sampled texture, vertex, uniform or storage buffer, copy source
+        PassBuilder& read(ResourceId r);
+        // Storage or copy destination whose previous contents are not needed
+        PassBuilder& write(ResourceId r);
+        // Render passes only; LoadOp::Load makes the attachment a read too
+        PassBuilder& color(ResourceId r, wgpu::LoadOp load, wgpu::StoreOp store,
+                           wgpu::Color clear = wgpu::Color{ 0.0, 0.0, 0.0, 0.0 });
+        PassBuilder& depth(ResourceId r, wgpu::LoadOp load, wgpu::StoreOp store, float clear = 1.0f);
+        // Kept even if nothing reads what it writes, e.g. readbacks
+        PassBuilder& sideEffect();
+
+    private:
+        friend class RenderGraph;
+
+        PassBuilder(RenderGraph& graph, uint32_t index) :
+            graph(graph),
+            index(index)
+        { }
+
+        RenderGraph& graph;
+        uint32_t index;
+    };
+
+    explicit RenderGraph(AttachmentPool& pool);
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Forgets the passes and resources of the previous frame
+    void beginFrame();
+
+    // Resources that live outside of the frame, a pass writing one of them is never culled
+    ResourceId importTexture(const char* name, wgpu::TextureView view);
+    ResourceId importBuffer(const char* name, wgpu::Buffer buffer);
+    // Texture which exists only while the passes using it run, taken from the pool
+    ResourceId createTexture(const char* name, const AttachmentKey& key);
+
+    // Names should outlive the frame
+    PassBuilder addRenderPass(const char* name, RenderFunction fn);
+    PassBuilder addPass(const char* name, EncodeFunction fn);
+
+    void compile();
+    // Adds the compiled passes to the encoder; the profiler, if any, measures every render pass
+    void execute(ParallelEncoder& encoder, GpuProfiler* profiler);
+
+    // For passes to find their inputs, valid from execute() until the next beginFrame()
+    wgpu::TextureView textureView(ResourceId r) const
+    {
+        return resources[r].view;
+    }
+
+    wgpu::Buffer buffer(ResourceId r) const
+    {
+        return resources[r].buffer;
+    }
+
+    // Counts of the last compile()
+    uint32_t passCount() const
+    {
+        return nPasses;
+    }
+
+    uint32_t culledCount() const
+    {
+        return nPasses - (uint32_t)order.size();
+    }
+
+    uint32_t renderPassCount() const;
+
+    // Graphviz of the last compiled frame: culled passes are dashed, merged passes share a box
+    void writeDot(std::ostream& out) const;
+
+private:
+    enum class ResourceKind
+    {
+        ImportedTexture,
+        ImportedBuffer,
+        Transient,
+    };
+
+    struct Resource
+    {
+        const char* name = nullptr;
+        ResourceKind kind = ResourceKind::Transient;
+        AttachmentKey key;
+        wgpu::TextureView view = nullptr;
+        wgpu::Buffer buffer = nullptr;
+        // Jobs of the first and the last pass using it, after compile()
+        uint32_t firstGroup = 0;
+        uint32_t lastGroup = 0;
+        bool used = false;
+    };
+
+    struct Access
+    {
+        ResourceId resource;
+        bool reads;
+        bool writes;
+        // Color or depth attachment of a render pass
+        bool attachment;
+    };
+
+    struct Attachment
+    {
+        ResourceId resource = noResource;
+        wgpu::LoadOp load = wgpu::LoadOp::Clear;
+        wgpu::StoreOp store = wgpu::StoreOp::Store;
+        wgpu::Color clearColor = wgpu::Color{ 0.0, 0.0, 0.0, 0.0 };
+        float clearDepth = 1.0f;
+    };
+
+    struct Pass
+    {
+        const char* name = nullptr;
+        bool render = false;
+        bool sideEffect = false;
+        RenderFunction renderFn;
+        EncodeFunction encodeFn;
+        std::vector<Access> accesses;
+        std::array<Attachment, maxColorAttachments> colors;
+        uint32_t colorCount = 0;
+        Attachment depth;
+
+        // Set by compile()
+        bool live = false;
+        bool emitted = false;
+        uint32_t group = 0;
+    };
+
+    // One job for the encoder: a render pass with one or more merged passes, or a single non-render pass
+    struct Group
+    {
+        RenderGraph* graph = nullptr;
+        GpuProfiler* profiler = nullptr;
+        const char* name = nullptr;
+        bool render = false;
+        // Range in order
+        uint32_t first = 0;
+        uint32_t count = 0;
+        std::array<wgpu::RenderPassColorAttachment, maxColorAttachments> colors;
+        wgpu::RenderPassDepthStencilAttachment depth;
+        wgpu::RenderPassDescriptor desc;
+    };
+
+    Pass& newPass(const char* name, bool render);
+    void addAccess(uint32_t pass, ResourceId r, bool reads, bool writes);
+    ResourceId addResource(const char* name, ResourceKind kind);
+
+    void cull();
+    // Whether a must run before b: they touch the same resource and one of them writes it
+    bool dependsOn(uint32_t b, uint32_t a) const;
+    // Whether b can continue the render pass of a
+    bool canMerge(uint32_t a, uint32_t b) const;
+    void sort();
+    void buildGroups();
+    void fillDescriptor(Group& group);
+    void record(Group& group, wgpu::CommandEncoder encoder);
+
+    AttachmentPool& pool;
+
+    // Reused between frames, only the first nPasses are valid
+    std::vector<Pass> passes;
+    uint32_t nPasses = 0;
+    std::vector<Resource> resources;
+
+    // Live passes in the compiled order and their jobs
+    std::vector<uint32_t> order;
+    std::vector<Group> groups;
+    std::vector<uint32_t> stack;
+};
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif
+
+#include "render_target.hpp"
+#include "gpu_future.hpp"
+
+// Validation of a new swap chain is a round trip to the device
+constexpr std::chrono::milliseconds validationTimeout(5000);
+
+
+static constexpr std::array<const char*, presentModes.size()> presentModeNames =
+{
+    "fifo",
+    "mailbox",
+    "immediate",
+};
+
+
+static size_t presentModeIndex(wgpu::PresentMode mode)
+{
+    for (size_t i = 0; i < presentModes.size(); i++)
+    {
+        if (presentModes[i] == mode)
+            return i;
+    }
+    return 0;
+}
+
+
+const char* presentModeName(wgpu::PresentMode mode)
+{
+    return presentModeNames[presentModeIndex(mode)];
+}
+
+
+bool parsePresentMode(const std::string& name, wgpu::PresentMode& mode)
+{
+    for (size_t i = 0; i < presentModes.size(); i++)
+    {
+        if (name == presentModeNames[i])
+        {
+            mode = presentModes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+wgpu::PresentMode nextPresentMode(wgpu::PresentMode mode)
+{
+    return presentModes[(presentModeIndex(mode) + 1) % presentModes.size()];
+}
+
+
+SwapChainTarget::SwapChainTarget(wgpu::Adapter adapter, wgpu::Device device, wgpu::Surface surface, uint32_t width,
+                                 uint32_t height, wgpu::TextureFormat format, wgpu::PresentMode presentMode,
+                                 bool copyable) :
+    adapter(adapter),
+    device(device),
+    surface(surface),
+    mode(presentMode),
+    copyable(copyable)
+{
+    w = width;
+    h = height;
+    fmt = format;
+
+    // FIFO is the one mode every surface has to support
+    if (!surfaceSupports(mode))
+    {
+        std::cout << "Present mode " << presentModeName(mode) << " is not supported, using fifo" << std::endl;
+        mode = wgpu::PresentMode::Fifo;
+    }
+
+    swapChain = create(mode);
+    if (!swapChain)
+    {
+        throw std::runtime_error("Failed to create a swap chain");
+    }
+}
+
+
+wgpu::SwapChain SwapChainTarget::create(wgpu::PresentMode presentMode)
+{
+    wgpu::SwapChainDescriptor swapChainDesc;
+    swapChainDesc.setDefault();
+
+    swapChainDesc.width = w;
+    swapChainDesc.height = h;
+    swapChainDesc.format = fmt;
+    swapChainDesc.usage = wgpu::TextureUsage::RenderAttachment;
+#ifdef WEBGPU_BACKEND_DAWN
+    if (copyable)
+    {
+        swapChainDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+    }
+#endif
+    swapChainDesc.presentMode = presentMode;
+    swapChainDesc.label = "Our swap chain";
+    wgpu::SwapChain sc = device.createSwapChain(surface, swapChainDesc);
+
+    std::cout << "Swapchain: " << sc << " " << w << "x" << h << ", " << presentModeName(presentMode) << std::endl;
+
+    return sc;
+}
+
+
+SwapChainTarget::~SwapChainTarget()
+{
+    printStats();
+    if (current)
+    {
+        current.release();
+    }
+    swapChain.release();
+}
+
+
+SwapChainTarget::ModeStats& SwapChainTarget::currentStats()
+{
+    return stats[presentModeIndex(mode)];
+}
+
+
+bool SwapChainTarget::surfaceSupports(wgpu::PresentMode presentMode) const
+{
+#ifdef WEBGPU_BACKEND_WGPU
+    // wgpu-native panics on a swap chain with an unsupported mode, it has to be known upfront
+    WGPUSurfaceCapabilities caps = {};
+    wgpuSurfaceGetCapabilities(surface, adapter, &caps);
+    bool supported = std::find(caps.presentModes, caps.presentModes + caps.presentModeCount,
+                               (WGPUPresentMode)presentMode) != caps.presentModes + caps.presentModeCount;
+    wgpuSurfaceCapabilitiesFreeMembers(caps);
+    return supported;
+#else
+    // Dawn has no present mode capabilities, the swap chain is validated when it is created
+    (void)presentMode;
+    return true;
+#endif
+}
+
+
+void SwapChainTarget::setPresentMode(wgpu::PresentMode newMode)
+{
+    if (newMode == mode)
+        return;
+
+    if (!surfaceSupports(newMode))
+    {
+        std::cout << "Present mode " << presentModeName(newMode) << " is not supported, staying on "
+                  << presentModeName(mode) << std::endl;
+        return;
+    }
+
+#ifdef WEBGPU_BACKEND_DAWN
+    // Dawn returns an error object rather than null for a swap chain it cannot create. A new swap chain
+    // which fails validation does not replace the old one, so the old one is kept until it is known to work.
+    using State = GpuFuture<bool>::State;
+    auto state = std::make_shared<State>();
+
+    device.pushErrorScope(wgpu::ErrorFilter::Validation);
+    wgpu::SwapChain newSwapChain = create(newMode);
+    state->callbackHandle = device.popErrorScope([state](wgpu::ErrorType type, char const* message)
+    {
+        state->value = (type == wgpu::ErrorType::NoError);
+        if (message)
+        {
+            state->message = message;
+        }
+        state->ready = true;
+    });
+
+    GpuFuture<bool> validated(state, [this]() { processEvents(device); });
+    if (!validated.wait(validationTimeout) || !validated.get(validationTimeout))
+    {
+        std::cout << "Present mode " << presentModeName(newMode) << " is not supported (" << validated.message()
+                  << "), staying on " << presentModeName(mode) << std::endl;
+        if (newSwapChain)
+        {
+            newSwapChain.release();
+        }
+        return;
+    }
+
+    swapChain.release();
+    swapChain = newSwapChain;
+#else
+    // The old one should be gone before a new one is created for the same surface
+    swapChain.release();
+    swapChain = create(newMode);
+#endif
+    mode = newMode;
+
+    // An interval spanning the recreation belongs to no mode
+    hasLastPresent = false;
+}
+
+
+void SwapChainTarget::resize(uint32_t width, uint32_t height)
+{
+    if (width == w && height == h)
+        return;
+
+    w = width;
+    h = height;
+
+    swapChain.release();
+    swapChain = create(mode);
+
+    hasLastPresent = false;
+}
+
+
+wgpu::TextureView SwapChainTarget::acquire()
+{
+    auto start = Clock::now();
+    wgpu::TextureView view = swapChain.getCurrentTextureView();
+    currentStats().acquireStall.add(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    return view;
+}
+
+
+void SwapChainTarget::present()
+{
+    if (current)
+    {
+        current.release();
+        current = nullptr;
+    }
+    swapChain.present();
+
+    auto now = Clock::now();
+    if (hasLastPresent)
+    {
+        currentStats().frameInterval.add(std::chrono::duration<double, std::milli>(now - lastPresent).count());
+    }
+    lastPresent = now;
+    hasLastPresent = true;
+}
+
+
+wgpu::Texture SwapChainTarget::copySource()
+{
+#ifdef WEBGPU_BACKEND_DAWN
+    // wgpu-native's swap chain does not give out its texture
+    if (copyable && !current)
+    {
+        current = wgpuSwapChainGetCurrentTexture(swapChain);
+    }
+#endif
+    return current;
+}
+
+
+void SwapChainTarget::printStats() const
+{
+    std::cout << "Present mode timings, ms (min / avg / p99 / max over the last frames):" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < presentModes.size(); i++)
+    {
+        const ModeStats& s = stats[i];
+        if (s.frameInterval.empty())
+            continue;
+
+        std::cout << " - " << presentModeNames[i] << ", " << s.frameInterval.total() << " frames" << std::endl;
+        std::cout << "     frame interval: " << s.frameInterval.min() << " / " << s.frameInterval.avg() << " / "
+                  << s.frameInterval.percentile(99) << " / " << s.frameInterval.max() << std::endl;
+        std::cout << "     acquire stall:  " << s.acquireStall.min() << " / " << s.acquireStall.avg() << " / "
+                  << s.acquireStall.percentile(99) << " / " << s.acquireStall.max() << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+
+OffscreenTarget::OffscreenTarget(wgpu::Device device, uint32_t width, uint32_t height, wgpu::TextureFormat format) :
+    device(device)
+{
+    w = width;
+    h = height;
+    fmt = format;
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.label = "Offscreen target";
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.size = { width, height, 1 };
+    textureDesc.format = format;
+    textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    tex = device.createTexture(textureDesc);
+
+    if (!tex)
+    {
+        throw std::runtime_error("Failed to create an offscreen texture");
+    }
+
+    std::cout << "Offscreen target: " << tex << " " << width << "x" << height << std::endl;
+}
+
+
+OffscreenTarget::~OffscreenTarget()
+{
+    tex.destroy();
+    tex.release();
+}
+
+
+wgpu::TextureView OffscreenTarget::acquire()
+{
+    wgpu::TextureViewDescriptor viewDesc;
+    viewDesc.label = "Offscreen target view";
+    viewDesc.format = fmt;
+    viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = 1;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.aspect = wgpu::TextureAspect::All;
+    return tex.createView(viewDesc);
+}
+
+
+void OffscreenTarget::present()
+{
+    // Nothing to show, but the device still has to retire finished work
+    processEvents(device);
+}
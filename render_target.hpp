@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <webgpu/webgpu.hpp>
+
+#include "sliding_stats.hpp"
+
+// Present modes we know about, in the order the hotkey cycles through them
+constexpr std::array<WGPUPresentMode, 3> presentModes =
+{
+    wgpu::PresentMode::Fifo,
+    wgpu::PresentMode::Mailbox,
+    wgpu::PresentMode::Immediate,
+};
+
+const char* presentModeName(wgpu::PresentMode mode);
+// Returns false on unknown name
+bool parsePresentMode(const std::string& name, wgpu::PresentMode& mode);
+wgpu::PresentMode nextPresentMode(wgpu::PresentMode mode);
+
+// Where the frame loop draws to: a window swap chain or an offscreen texture
+class RenderTarget
+{
+public:
+    virtual ~RenderTarget() = default;
+
+    // Returns a view to render the next frame into, null if it cannot be acquired.
+    // The view is owned by the caller.
+    virtual wgpu::TextureView acquire() = 0;
+    virtual void present() = 0;
+
+    // Texture behind the view acquire() has returned, if frames can be copied from it, null otherwise.
+    // Not owned by the caller, valid until present().
+    virtual wgpu::Texture copySource()
+    {
+        return nullptr;
+    }
+
+    uint32_t width() const
+    {
+        return w;
+    }
+
+    uint32_t height() const
+    {
+        return h;
+    }
+
+    wgpu::TextureFormat format() const
+    {
+        return fmt;
+    }
+
+protected:
+    uint32_t w = 0;
+    uint32_t h = 0;
+    wgpu::TextureFormat fmt = wgpu::TextureFormat::Undefined;
+};
+
+
+class SwapChainTarget : public RenderTarget
+{
+public:
+    // A copyable swap chain also gets CopySrc usage, so that frames can be captured (Dawn only).
+    // The adapter is asked which present modes the surface supports.
+    SwapChainTarget(wgpu::Adapter adapter, wgpu::Device device, wgpu::Surface surface, uint32_t width,
+                    uint32_t height, wgpu::TextureFormat format, wgpu::PresentMode presentMode,
+                    bool copyable = false);
+    ~SwapChainTarget() override;
+
+    wgpu::TextureView acquire() override;
+    void present() override;
+    wgpu::Texture copySource() override;
+
+    // Recreates the swap chain, the device stays the same.
+    // Stays on the previous mode, with its swap chain, if the surface does not support the new one.
+    void setPresentMode(wgpu::PresentMode mode);
+
+    wgpu::PresentMode presentMode() const
+    {
+        return mode;
+    }
+
+    // Recreates the swap chain with a new size
+    void resize(uint32_t width, uint32_t height);
+
+    // Frame interval and acquire stall for every mode used so far
+    void printStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Per present mode, to see which one gives the lowest latency on a given machine
+    struct ModeStats
+    {
+        // Between consecutive present() calls
+        SlidingStats frameInterval;
+        // Time blocked in acquire() waiting for the next image after present()
+        SlidingStats acquireStall;
+    };
+
+    wgpu::SwapChain create(wgpu::PresentMode presentMode);
+    // From the surface capabilities where the backend has them, true otherwise
+    bool surfaceSupports(wgpu::PresentMode presentMode) const;
+    ModeStats& currentStats();
+
+    wgpu::Adapter adapter;
+    wgpu::Device device;
+    wgpu::Surface surface;
+    wgpu::SwapChain swapChain = nullptr;
+    wgpu::PresentMode mode;
+    bool copyable;
+    // Taken by copySource(), released on present()
+    wgpu::Texture current = nullptr;
+
+    std::array<ModeStats, presentModes.size()> stats;
+    Clock::time_point lastPresent;
+    bool hasLastPresent = false;
+};
+
+
+// Renders into a texture with no window, surface or vsync behind it
+class OffscreenTarget : public RenderTarget
+{
+public:
+    OffscreenTarget(wgpu::Device device, uint32_t width, uint32_t height, wgpu::TextureFormat format);
+    ~OffscreenTarget() override;
+
+    wgpu::TextureView acquire() override;
+    void present() override;
+
+    // RenderAttachment | CopySrc, so that frames can be read back
+    wgpu::Texture texture() const
+    {
+        return tex;
+    }
+
+    wgpu::Texture copySource() override
+    {
+        return tex;
+    }
+
+private:
+    wgpu::Device device;
+    wgpu::Texture tex = nullptr;
+};
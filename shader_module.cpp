@@ -0,0 +1,68 @@
+#include <iostream>
+
+#include "shader_module.hpp"
+#include "blob_cache.hpp"
+#include "gpu_future.hpp"
+
+// Validation is a driver round trip, usually it takes a few milliseconds
+constexpr std::chrono::milliseconds validationTimeout(5000);
+
+
+wgpu::ShaderModule createShaderModule(wgpu::Device device, const char* label, const std::string& wgsl, BlobCache* cache)
+{
+    wgpu::ShaderModuleWGSLDescriptor wgslDesc;
+    wgslDesc.chain.next = nullptr;
+    wgslDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
+    wgslDesc.code = wgsl.c_str();
+
+    wgpu::ShaderModuleDescriptor desc;
+    desc.nextInChain = &wgslDesc.chain;
+    desc.label = label;
+
+    // A validation result, not compiled code; the whole source is the key, so a changed shader
+    // never matches an old entry
+    const std::string key = "wgsl-validated:" + wgsl;
+
+    std::vector<uint8_t> entry;
+    if (cache && cache->load(key, entry))
+    {
+        // Known to be valid, compiled without waiting for the error scope
+        return device.createShaderModule(desc);
+    }
+
+    using State = GpuFuture<bool>::State;
+    auto state = std::make_shared<State>();
+
+    device.pushErrorScope(wgpu::ErrorFilter::Validation);
+    wgpu::ShaderModule module = device.createShaderModule(desc);
+    state->callbackHandle = device.popErrorScope([state](wgpu::ErrorType type, char const* message)
+    {
+        state->value = (type == wgpu::ErrorType::NoError);
+        if (message)
+        {
+            state->message = message;
+        }
+        state->ready = true;
+    });
+
+    GpuFuture<bool> validated(state, [device]() { processEvents(device); });
+    if (!validated.wait(validationTimeout))
+    {
+        std::cout << "Shader module " << label << " validation timed out" << std::endl;
+        return module;
+    }
+
+    if (!validated.get(validationTimeout))
+    {
+        std::cout << "Shader module " << label << " failed validation: " << validated.message() << std::endl;
+        return module;
+    }
+
+    if (cache)
+    {
+        const uint8_t validMark = 1;
+        cache->store(key, &validMark, sizeof(validMark));
+    }
+
+    return module;
+}
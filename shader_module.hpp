@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+#include <webgpu/webgpu.hpp>
+
+class BlobCache;
+
+// Creates a WGSL shader module.
+// The cache only holds validation results: a module seen for the first time is validated in an
+// error scope and marked as valid, on next launches the error scope round trip is skipped, but the
+// module is still compiled from source. Compiled code is only cached on Dawn, through the device
+// blob cache hooks; wgpu-native gets no compile caching.
+// Cache can be null.
+wgpu::ShaderModule createShaderModule(wgpu::Device device, const char* label, const std::string& wgsl, BlobCache* cache);
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "sliding_stats.hpp"
+
+
+SlidingStats::SlidingStats(size_t window) :
+    window(std::max<size_t>(window, 1))
+{
+    samples.reserve(this->window);
+}
+
+
+void SlidingStats::add(double v)
+{
+    if (samples.size() < window)
+    {
+        samples.push_back(v);
+    }
+    else
+    {
+        samples[next] = v;
+    }
+    next = (next + 1) % window;
+    nTotal++;
+}
+
+
+void SlidingStats::clear()
+{
+    samples.clear();
+    next = 0;
+    nTotal = 0;
+}
+
+
+double SlidingStats::min() const
+{
+    return samples.empty() ? 0.0 : *std::min_element(samples.begin(), samples.end());
+}
+
+
+double SlidingStats::max() const
+{
+    return samples.empty() ? 0.0 : *std::max_element(samples.begin(), samples.end());
+}
+
+
+double SlidingStats::avg() const
+{
+    return samples.empty() ? 0.0 : std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+}
+
+
+double SlidingStats::percentile(double p) const
+{
+    if (samples.empty())
+        return 0.0;
+
+    std::vector<double> sorted = samples;
+    size_t k = (size_t)std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * sorted.size());
+    k = std::clamp<size_t>(k, 1, sorted.size()) - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Min/avg/max/percentiles over the last N samples.
+// Adding a sample never allocates, the window is reserved upfront.
+class SlidingStats
+{
+public:
+    explicit SlidingStats(size_t window = 1024);
+
+    void add(double v);
+    void clear();
+
+    // Samples ever added, not only those in the window
+    size_t total() const
+    {
+        return nTotal;
+    }
+
+    bool empty() const
+    {
+        return samples.empty();
+    }
+
+    double min() const;
+    double max() const;
+    double avg() const;
+    // p in [0, 100]
+    double percentile(double p) const;
+
+private:
+    size_t window;
+    std::vector<double> samples;
+    size_t next = 0;
+    size_t nTotal = 0;
+};
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "staging_belt.hpp"
+#include "gpu_future.hpp"
+
+
+static uint64_t alignUp(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+
+StagingBelt::StagingBelt(wgpu::Device device, uint64_t chunkSize) :
+    device(device),
+    queue(device.getQueue()),
+    chunkSize(alignUp(chunkSize, 256))
+{ }
+
+
+StagingBelt::~StagingBelt()
+{
+    // Callbacks point to the chunks, let them finish
+    auto pending = [this]()
+    {
+        return std::any_of(chunks.begin(), chunks.end(), [](const std::unique_ptr<Chunk>& c)
+        {
+            return c->state == ChunkState::Submitted || c->state == ChunkState::Mapping;
+        });
+    };
+    auto start = std::chrono::steady_clock::now();
+    while (pending() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+        processEvents(device);
+        std::this_thread::yield();
+    }
+
+    if (pending())
+    {
+        std::cout << "Staging belt: GPU is still busy on exit, leaking chunks" << std::endl;
+        for (auto& c : chunks)
+        {
+            c.release();
+        }
+        return;
+    }
+
+    for (auto& c : chunks)
+    {
+        destroyChunk(*c);
+    }
+    queue.release();
+}
+
+
+void StagingBelt::destroyChunk(Chunk& c)
+{
+    if (c.buffer)
+    {
+        c.buffer->destroy();
+        c.buffer.reset();
+    }
+}
+
+
+StagingBelt::Chunk& StagingBelt::allocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+    // Chunks already written this frame go first, so that a frame's copies share buffers
+    for (Chunk* c : active)
+    {
+        uint64_t o = alignUp(c->used, alignment);
+        if (o + size <= c->size)
+        {
+            offset = o;
+            c->used = o + size;
+            return *c;
+        }
+    }
+
+    Chunk* chunk = nullptr;
+    if (size <= chunkSize)
+    {
+        for (auto& c : chunks)
+        {
+            if (c->state == ChunkState::Mapped && !c->dedicated &&
+                std::find(active.begin(), active.end(), c.get()) == active.end())
+            {
+                chunk = c.get();
+                break;
+            }
+        }
+    }
+
+    if (!chunk)
+    {
+        // Dropped dedicated chunks are removed only here, their callbacks are done by now
+        chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [](const std::unique_ptr<Chunk>& c)
+        {
+            return c->state == ChunkState::Dropped;
+        }), chunks.end());
+
+        auto c = std::make_unique<Chunk>();
+        c->owner = this;
+        c->dedicated = size > chunkSize;
+        c->size = c->dedicated ? alignUp(size, 256) : chunkSize;
+
+        // Mapped at creation, the first use does not wait for anything
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = c->dedicated ? "Staging buffer" : "Staging belt chunk";
+        bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+        bufferDesc.size = c->size;
+        bufferDesc.mappedAtCreation = true;
+        c->buffer.reset(device.createBuffer(bufferDesc));
+        c->data = static_cast<uint8_t*>(c->buffer->getMappedRange(0, c->size));
+        c->state = ChunkState::Mapped;
+
+        chunk = c.get();
+        chunks.push_back(std::move(c));
+    }
+
+    chunk->used = size;
+    offset = 0;
+    active.push_back(chunk);
+    return *chunk;
+}
+
+
+void* StagingBelt::writeBuffer(wgpu::CommandEncoder encoder, wgpu::Buffer dst, uint64_t dstOffset, uint64_t size)
+{
+    uint64_t offset = 0;
+    Chunk& c = allocate(size, 4, offset);
+    encoder.copyBufferToBuffer(c.buffer, offset, dst, dstOffset, size);
+    totalBytes += size;
+    return c.data + offset;
+}
+
+
+void* StagingBelt::writeTexture(wgpu::CommandEncoder encoder, const wgpu::ImageCopyTexture& dst,
+                                uint32_t bytesPerRow, const wgpu::Extent3D& size)
+{
+    uint64_t bytes = (uint64_t)bytesPerRow * size.height * size.depthOrArrayLayers;
+    uint64_t offset = 0;
+    // Texture copies want the source offset aligned to the texel block, 256 covers every format
+    Chunk& c = allocate(bytes, 256, offset);
+
+    wgpu::ImageCopyBuffer src;
+    src.buffer = c.buffer.get();
+    src.layout.offset = offset;
+    src.layout.bytesPerRow = bytesPerRow;
+    src.layout.rowsPerImage = size.height;
+    encoder.copyBufferToTexture(src, dst, size);
+    totalBytes += bytes;
+    return c.data + offset;
+}
+
+
+void StagingBelt::finish()
+{
+    for (Chunk* c : active)
+    {
+        c->buffer->unmap();
+        c->data = nullptr;
+        c->state = ChunkState::Closed;
+        closed.push_back(c);
+    }
+    active.clear();
+}
+
+
+void StagingBelt::recall()
+{
+    for (Chunk* c : closed)
+    {
+        c->state = ChunkState::Submitted;
+#ifdef WEBGPU_BACKEND_DAWN
+        wgpuQueueOnSubmittedWorkDone(queue, /* signalValue */ 0, onWorkDone, c);
+#elif defined(WEBGPU_BACKEND_WGPU)
+        wgpuQueueOnSubmittedWorkDone(queue, onWorkDone, c);
+#endif
+    }
+    closed.clear();
+}
+
+
+void StagingBelt::onWorkDone(WGPUQueueWorkDoneStatus /* status */, void* userdata)
+{
+    Chunk& c = *reinterpret_cast<Chunk*>(userdata);
+    if (c.dedicated)
+    {
+        // Too big to keep around
+        c.owner->destroyChunk(c);
+        c.state = ChunkState::Dropped;
+        return;
+    }
+
+    c.state = ChunkState::Mapping;
+    wgpuBufferMapAsync(c.buffer.get(), wgpu::MapMode::Write, 0, c.size, onMapped, &c);
+}
+
+
+void StagingBelt::onMapped(WGPUBufferMapAsyncStatus status, void* userdata)
+{
+    Chunk& c = *reinterpret_cast<Chunk*>(userdata);
+    if (status != wgpu::BufferMapAsyncStatus::Success)
+    {
+        // Lost device or destroyed buffer, the chunk is not coming back
+        c.owner->destroyChunk(c);
+        c.state = ChunkState::Dropped;
+        return;
+    }
+
+    c.data = static_cast<uint8_t*>(c.buffer->getMappedRange(0, c.size));
+    c.used = 0;
+    c.state = ChunkState::Mapped;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "gpu_handle.hpp"
+
+// Uploads through mapped MapWrite|CopySrc buffers.
+// Callers write straight into mapped staging memory, the copies into the destination are recorded
+// into the caller's command encoder. After the submit a chunk is remapped asynchronously and reused
+// once the GPU is done with it, so there is no extra copy inside the implementation as with
+// queue.writeBuffer(). Not thread-safe.
+class StagingBelt
+{
+public:
+    // Uploads larger than a chunk get a dedicated buffer which is dropped after use
+    explicit StagingBelt(wgpu::Device device, uint64_t chunkSize = 4 << 20);
+    ~StagingBelt();
+
+    StagingBelt(const StagingBelt&) = delete;
+    StagingBelt& operator=(const StagingBelt&) = delete;
+
+    // Returns memory for size bytes which the encoder copies to dst at dstOffset.
+    // Size and offset must be multiples of 4, the memory is writable until finish().
+    void* writeBuffer(wgpu::CommandEncoder encoder, wgpu::Buffer dst, uint64_t dstOffset, uint64_t size);
+    // Same for a texture region; rows of the source are bytesPerRow apart, which must be a multiple of 256
+    void* writeTexture(wgpu::CommandEncoder encoder, const wgpu::ImageCopyTexture& dst,
+                       uint32_t bytesPerRow, const wgpu::Extent3D& size);
+
+    // Unmaps the chunks written since the last call, call before the encoder's commands are submitted
+    void finish();
+    // Starts taking the chunks back once the GPU has done the copies, call after the submit
+    void recall();
+
+    uint64_t bytesUploaded() const
+    {
+        return totalBytes;
+    }
+
+    // Chunks that exist right now, both in use and free
+    size_t chunkCount() const
+    {
+        return chunks.size();
+    }
+
+private:
+    enum class ChunkState
+    {
+        // Mapped, takes new writes
+        Mapped,
+        // Unmapped, waiting for the submit
+        Closed,
+        // Waiting for the GPU to do the copies
+        Submitted,
+        // Waiting for mapAsync
+        Mapping,
+        // Dedicated buffer which is not needed anymore
+        Dropped,
+    };
+
+    struct Chunk
+    {
+        // Callback userdata
+        StagingBelt* owner = nullptr;
+        Owned<wgpu::Buffer> buffer;
+        uint64_t size = 0;
+        uint64_t used = 0;
+        bool dedicated = false;
+        ChunkState state = ChunkState::Mapped;
+        // Mapped pointer, valid in Mapped state
+        uint8_t* data = nullptr;
+    };
+
+    // Finds or creates a mapped chunk with room for size bytes at the given alignment
+    Chunk& allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+    static void onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata);
+    static void onMapped(WGPUBufferMapAsyncStatus status, void* userdata);
+    void destroyChunk(Chunk& c);
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    uint64_t chunkSize;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    // Chunks written since the last finish() / recall()
+    std::vector<Chunk*> active;
+    std::vector<Chunk*> closed;
+    uint64_t totalBytes = 0;
+};
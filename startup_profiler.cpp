@@ -0,0 +1,167 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "startup_profiler.hpp"
+
+
+static double toMs(StartupProfiler::Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+static std::string jsonEscape(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n";  break;
+        case '\r': out += "\\r";  break;
+        case '\t': out += "\\t";  break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                const char* digits = "0123456789abcdef";
+                out += "\\u00";
+                out += digits[(c >> 4) & 0xf];
+                out += digits[c & 0xf];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+
+StartupProfiler::StartupProfiler() :
+    origin(Clock::now())
+{ }
+
+
+size_t StartupProfiler::begin(const std::string& name)
+{
+    Phase p;
+    p.name = name;
+    p.start = Clock::now();
+    phases.push_back(p);
+    return phases.size() - 1;
+}
+
+
+void StartupProfiler::end(size_t id)
+{
+    phases.at(id).end = Clock::now();
+    phases.at(id).finished = true;
+}
+
+
+void StartupProfiler::setInfo(const std::string& key, const std::string& value)
+{
+    for (auto& kv : info)
+    {
+        if (kv.first == key)
+        {
+            kv.second = value;
+            return;
+        }
+    }
+    info.emplace_back(key, value);
+}
+
+
+void StartupProfiler::setCounter(const std::string& key, uint64_t value)
+{
+    for (auto& kv : counters)
+    {
+        if (kv.first == key)
+        {
+            kv.second = value;
+            return;
+        }
+    }
+    counters.emplace_back(key, value);
+}
+
+
+void StartupProfiler::print() const
+{
+    std::cout << "Startup phases:" << std::endl;
+    for (const auto& p : phases)
+    {
+        std::cout << " - " << std::left << std::setw(24) << p.name << std::right
+                  << " at " << std::fixed << std::setprecision(3) << std::setw(9) << toMs(p.start - origin) << " ms";
+        if (p.finished)
+        {
+            std::cout << ", took " << std::setw(9) << toMs(p.end - p.start) << " ms";
+        }
+        else
+        {
+            std::cout << ", not finished";
+        }
+        std::cout << std::defaultfloat << std::endl;
+    }
+}
+
+
+bool StartupProfiler::writeJson(const std::string& path) const
+{
+    std::ofstream f(path);
+    if (!f)
+    {
+        std::cerr << "Cannot write startup report to " << path << std::endl;
+        return false;
+    }
+
+    Clock::time_point last = origin;
+    for (const auto& p : phases)
+    {
+        if (p.finished && p.end > last)
+            last = p.end;
+    }
+
+    f << std::fixed << std::setprecision(3);
+    f << "{\n";
+    f << "  \"info\": {";
+    for (size_t i = 0; i < info.size(); i++)
+    {
+        f << (i ? ",\n" : "\n") << "    \"" << jsonEscape(info[i].first) << "\": \"" << jsonEscape(info[i].second) << "\"";
+    }
+    f << (info.empty() ? "},\n" : "\n  },\n");
+
+    f << "  \"counters\": {";
+    for (size_t i = 0; i < counters.size(); i++)
+    {
+        f << (i ? ",\n" : "\n") << "    \"" << jsonEscape(counters[i].first) << "\": " << counters[i].second;
+    }
+    f << (counters.empty() ? "},\n" : "\n  },\n");
+
+    f << "  \"total_ms\": " << toMs(last - origin) << ",\n";
+    f << "  \"phases\": [";
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        const Phase& p = phases[i];
+        f << (i ? ",\n" : "\n") << "    { \"name\": \"" << jsonEscape(p.name) << "\", "
+          << "\"start_ms\": " << toMs(p.start - origin) << ", ";
+        if (p.finished)
+        {
+            f << "\"duration_ms\": " << toMs(p.end - p.start) << " }";
+        }
+        else
+        {
+            f << "\"duration_ms\": null }";
+        }
+    }
+    f << (phases.empty() ? "]\n" : "\n  ]\n");
+    f << "}\n";
+
+    return (bool)f;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Records how long each startup phase takes.
+// Phases may overlap (e.g. adapter request runs while the window is being created),
+// so each one keeps its own start and end timestamps.
+class StartupProfiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StartupProfiler();
+
+    // Returns phase id to pass to end()
+    size_t begin(const std::string& name);
+    void end(size_t id);
+
+    // Free-form context for the report: backend, adapter, etc.
+    void setInfo(const std::string& key, const std::string& value);
+    // Numbers gathered later in the run, e.g. cache hits; written with the report
+    void setCounter(const std::string& key, uint64_t value);
+
+    void print() const;
+    // Returns false if the file cannot be written
+    bool writeJson(const std::string& path) const;
+
+private:
+    struct Phase
+    {
+        std::string name;
+        Clock::time_point start;
+        Clock::time_point end;
+        bool finished = false;
+    };
+
+    Clock::time_point origin;
+    std::vector<Phase> phases;
+    std::vector<std::pair<std::string, std::string>> info;
+    std::vector<std::pair<std::string, uint64_t>> counters;
+};
+
+// Measures the enclosing scope
+class ScopedPhase
+{
+public:
+    ScopedPhase(StartupProfiler& profiler, const std::string& name) :
+        profiler(profiler),
+        id(profiler.begin(name))
+    { }
+
+    ~ScopedPhase()
+    {
+        profiler.end(id);
+    }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    StartupProfiler& profiler;
+    size_t id;
+};
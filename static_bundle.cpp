@@ -0,0 +1,48 @@
+#include "static_bundle.hpp"
+
+
+StaticBundle::StaticBundle(wgpu::Device device, const char* label, wgpu::TextureFormat colorFormat,
+                           wgpu::TextureFormat depthFormat, uint32_t sampleCount) :
+    device(device),
+    label(label),
+    colorFormat(colorFormat)
+{
+    desc.label = label;
+    desc.colorFormatsCount = 1;
+    desc.colorFormats = (WGPUTextureFormat*)&this->colorFormat;
+    desc.depthStencilFormat = depthFormat;
+    desc.sampleCount = sampleCount;
+    desc.depthReadOnly = false;
+    desc.stencilReadOnly = true;
+}
+
+
+StaticBundle::~StaticBundle()
+{
+    invalidate();
+}
+
+
+void StaticBundle::invalidate()
+{
+    // Frames in flight keep their references to the old bundle
+    bundle.reset();
+}
+
+
+wgpu::RenderBundleEncoder StaticBundle::begin()
+{
+    invalidate();
+    return device.createRenderBundleEncoder(desc);
+}
+
+
+void StaticBundle::finish(wgpu::RenderBundleEncoder encoder, uint64_t key)
+{
+    wgpu::RenderBundleDescriptor bundleDesc;
+    bundleDesc.label = label;
+    bundle.reset(encoder.finish(bundleDesc));
+
+    recordedKey = key;
+    nRecords++;
+}
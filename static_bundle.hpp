@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#include <webgpu/webgpu.hpp>
+
+#include "gpu_handle.hpp"
+
+// A draw list which rarely changes, recorded once into a RenderBundle and replayed with executeBundles().
+// The caller describes everything the draws depend on (pipeline, bind groups, buffers, offsets, counts)
+// with a key; the bundle is recorded again only when the key changes. The attachment formats are fixed,
+// a pass with other formats needs another bundle. Not thread-safe.
+class StaticBundle
+{
+public:
+    StaticBundle(wgpu::Device device, const char* label, wgpu::TextureFormat colorFormat,
+                 wgpu::TextureFormat depthFormat, uint32_t sampleCount = 1);
+    ~StaticBundle();
+
+    StaticBundle(const StaticBundle&) = delete;
+    StaticBundle& operator=(const StaticBundle&) = delete;
+
+    // Calls record(wgpu::RenderBundleEncoder) if the key differs from the last recorded one,
+    // then replays the bundle in the pass
+    template<typename F>
+    void execute(wgpu::RenderPassEncoder pass, uint64_t key, F&& record)
+    {
+        if (!bundle || key != recordedKey)
+        {
+            Owned<wgpu::RenderBundleEncoder> encoder(begin());
+            record(encoder.get());
+            finish(encoder.get(), key);
+        }
+
+        WGPURenderBundle raw = bundle.get();
+        pass.executeBundles(1, &raw);
+    }
+
+    // Forces a new recording on the next execute()
+    void invalidate();
+
+    // How many times the bundle was recorded
+    uint64_t recordCount() const
+    {
+        return nRecords;
+    }
+
+private:
+    wgpu::RenderBundleEncoder begin();
+    void finish(wgpu::RenderBundleEncoder encoder, uint64_t key);
+
+    wgpu::Device device;
+    const char* label;
+    wgpu::TextureFormat colorFormat;
+    wgpu::RenderBundleEncoderDescriptor desc;
+
+    Owned<wgpu::RenderBundle> bundle;
+    uint64_t recordedKey = 0;
+    uint64_t nRecords = 0;
+};
@@ -0,0 +1,3 @@
+// this definition with the include going next creates function definitions
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
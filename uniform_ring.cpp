@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "bind_group_cache.hpp"
+#include "uniform_ring.hpp"
+
+
+static uint64_t alignUp(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+
+UniformRing::UniformRing(wgpu::Device device, wgpu::Queue queue, uint32_t slots, uint64_t bytesPerFrame,
+                         BindGroupCache* bindGroups) :
+    device(device),
+    queue(queue),
+    bindGroups(bindGroups),
+    nSlots(slots)
+{
+    wgpu::SupportedLimits supported;
+    if (device.getLimits(&supported) && supported.limits.minUniformBufferOffsetAlignment)
+    {
+        align = supported.limits.minUniformBufferOffsetAlignment;
+    }
+
+    bufferSize = alignUp(bytesPerFrame, align);
+    data.resize(bufferSize);
+    createBuffers();
+}
+
+
+UniformRing::~UniformRing()
+{
+    for (uint32_t i = 0; i < nSlots; i++)
+    {
+        if (bindGroups)
+        {
+            bindGroups->invalidate((WGPUBuffer)buffers[i]);
+        }
+        buffers[i].release();
+    }
+}
+
+
+void UniformRing::createBuffers()
+{
+    for (uint32_t i = 0; i < nSlots; i++)
+    {
+        // Frames in flight keep their references, the implementation frees the old buffer later
+        if (buffers[i])
+        {
+            // Before the handle can be reused by a new buffer
+            if (bindGroups)
+            {
+                bindGroups->invalidate((WGPUBuffer)buffers[i]);
+            }
+            buffers[i].release();
+        }
+
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Uniform ring";
+        bufferDesc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+        bufferDesc.size = bufferSize;
+        bufferDesc.mappedAtCreation = false;
+        buffers[i] = device.createBuffer(bufferDesc);
+    }
+    gen++;
+}
+
+
+void UniformRing::beginFrame(uint32_t slot)
+{
+    currentSlot = slot;
+    used = 0;
+}
+
+
+uint32_t UniformRing::push(const void* value, uint32_t size)
+{
+    uint64_t offset = alignUp(used, align);
+    if (offset + size > data.size())
+    {
+        // Buffers follow in endFrame(), before anything is drawn with them
+        data.resize(std::max(data.size() * 2, alignUp(offset + size, align)));
+    }
+
+    std::memcpy(data.data() + offset, value, size);
+    used = offset + size;
+    return (uint32_t)offset;
+}
+
+
+void UniformRing::endFrame()
+{
+    if (data.size() > bufferSize)
+    {
+        bufferSize = data.size();
+        std::cout << "Uniform ring grown to " << bufferSize / 1024 << " KB per frame" << std::endl;
+        createBuffers();
+    }
+
+    if (used == 0)
+        return;
+
+    // writeBuffer wants a multiple of 4 bytes
+    queue.writeBuffer(buffers[currentSlot], 0, data.data(), alignUp(used, 4));
+}
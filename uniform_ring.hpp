@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <webgpu/webgpu.hpp>
+
+#include "frames_in_flight.hpp"
+
+class BindGroupCache;
+
+// Per-frame uniform data suballocated from one large buffer.
+// There is a Uniform|CopyDst buffer per frames-in-flight slot, so the data of a frame the GPU
+// still reads is never overwritten. Values are pushed into a CPU copy at offsets aligned to
+// minUniformBufferOffsetAlignment and uploaded with one writeBuffer per frame;
+// draws bind the slot's buffer with a dynamic offset.
+// If a frame pushes more than fits, the buffers grow and generation() changes;
+// bind groups of the old buffers are dropped from the cache, if one is given.
+class UniformRing
+{
+public:
+    UniformRing(wgpu::Device device, wgpu::Queue queue, uint32_t slots, uint64_t bytesPerFrame,
+                BindGroupCache* bindGroups = nullptr);
+    ~UniformRing();
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    // Starts a frame which uses the buffer of the given frames-in-flight slot
+    void beginFrame(uint32_t slot);
+    // Returns the dynamic offset of the copied data
+    uint32_t push(const void* data, uint32_t size);
+    template<typename T>
+    uint32_t push(const T& value)
+    {
+        return push(&value, (uint32_t)sizeof(T));
+    }
+    // Uploads what was pushed since beginFrame(), call before the frame's submit
+    void endFrame();
+
+    wgpu::Buffer buffer(uint32_t slot) const
+    {
+        return buffers[slot];
+    }
+
+    uint32_t alignment() const
+    {
+        return align;
+    }
+
+    uint64_t capacity() const
+    {
+        return bufferSize;
+    }
+
+    // Changes when the buffers are recreated, bind groups created with them must be recreated too
+    uint64_t generation() const
+    {
+        return gen;
+    }
+
+private:
+    void createBuffers();
+
+    wgpu::Device device;
+    wgpu::Queue queue;
+    BindGroupCache* bindGroups;
+    uint32_t nSlots;
+    uint32_t align = 256;
+    uint64_t bufferSize;
+    uint64_t gen = 0;
+    std::array<wgpu::Buffer, FramesInFlight::maxSlots> buffers {};
+
+    // Current frame
+    uint32_t currentSlot = 0;
+    uint64_t used = 0;
+    std::vector<uint8_t> data;
+};